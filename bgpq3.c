@@ -20,6 +20,7 @@
 
 extern int debug_expander;
 extern int debug_aggregation;
+extern int aggregation_threads;
 extern int pipelining;
 extern int expand_as23456;
 extern int expand_special_asn;
@@ -28,7 +29,9 @@ int
 usage(int ecode)
 {
 	printf("\nUsage: bgpq3 [-h host[:port]] [-S sources] [-P|E|G <num>|f <num>|t]"
-		" [-2346ABbDdHJjNnwXxz] [-R len] <OBJECTS>...\n");
+		" [-2346ABbcDdHJjNnowXxzZ] [-C file] [-e max] [-i file] [-I file]\n");
+	printf("       [-k file] [-O file] [-R len] [-Y threads] <OBJECTS>... "
+		"[EXCEPT <OBJECTS>...]\n       [AND|MINUS <OBJECTS>...]\n");
 	printf(" -2        : allow routes belonging to as23456 (transition-as) "
 		"(default: false)\n");
 	printf(" -3        : assume that your device is asn32-safe\n");
@@ -37,8 +40,14 @@ usage(int ecode)
 	printf(" -A        : try to aggregate prefix-lists/route-filters\n");
 	printf(" -B        : generate OpenBGPD output (Cisco IOS by default)\n");
 	printf(" -b        : generate BIRD output (Cisco IOS by default)\n");
+	printf(" -c        : compress consecutive ASNs into ranges (BIRD, JSON, "
+		"JunOS, OpenBGPD)\n");
+	printf(" -C file   : cache expanded as-sets in file, re-query only sets "
+		"whose\n             source serial changed\n");
 	printf(" -D        : use asdot notation in as-path (Cisco only)\n");
 	printf(" -d        : generate some debugging output\n");
+	printf(" -e max    : aggregate to at most max entries, accepting more "
+		"prefixes\n             than listed if needed\n");
 	printf(" -E        : generate extended access-list(Cisco), "
 		"route-filter(Juniper)\n"
 		"             [ip|ipv6]-prefix-list (Nokia) or prefix-set (OpenBGPD)"
@@ -51,8 +60,14 @@ usage(int ecode)
 	printf(" -h host   : host running IRRD software (whois.radb.net by "
 		"default)\n"
 		"             (use host:port to specify alternate port)\n");
+	printf(" -i file   : keep filter state in file, print only changes since "
+		"the\n             previous run (Cisco, JSON, JunOS)\n");
+	printf(" -I file   : load trees saved with -O from file instead of "
+		"expanding objects\n");
 	printf(" -J        : generate config for JunOS (Cisco IOS by default)\n");
 	printf(" -j        : generate JSON output (Cisco IOS by default)\n");
+	printf(" -k file   : check prefixes listed in file ('-' for stdin) against"
+		" the\n             generated filter instead of printing it\n");
 	printf(" -M match  : extra match conditions for JunOS route-filters\n");
 	printf(" -m len    : maximum prefix length (default: 32 for IPv4, "
 		"128 for IPv6)\n");
@@ -63,6 +78,10 @@ usage(int ecode)
 		"(Cisco IOS by default)\n");
 	printf(" -n        : generate config for Nokia SR OS MD-CLI (Cisco IOS "
 		"by default)\n");
+	printf(" -o        : generate minimal as-path regular expressions (Cisco,"
+		" IOS XR, Huawei)\n");
+	printf(" -O file   : save expanded trees to file, to be re-rendered later"
+		" with -I\n");
 	printf(" -P        : generate prefix-list (default, just for backward"
 		" compatibility)\n");
 	printf(" -R len    : allow more specific routes up to specified masklen\n");
@@ -81,6 +100,9 @@ usage(int ecode)
 	printf(" -X        : generate config for IOS XR (Cisco IOS by default)\n");
 	printf(" -x        : generate mixed-family (both IPv4 and IPv6) prefix "
 		"filters\n");
+	printf(" -Z        : aggregate to the fewest entries possible, report the "
+		"count\n             next to -A\n");
+	printf(" -Y threads: aggregate in that many threads (default: 1)\n");
 	printf("\n" PACKAGE_NAME " version: " PACKAGE_VERSION "\n");
 	printf("Copyright(c) Alexandre Snarskii <snar@snar.spb.ru> 2007-2022\n\n");
 	exit(ecode);
@@ -139,20 +161,66 @@ parseasnumber(struct bgpq_expander* expander, char* optarg, int zero)
 	return 0;
 };
 
+/* right-hand side of AND/MINUS, expanded separately and then combined
+ * into the main expander */
+struct bgpq_operand {
+	STAILQ_ENTRY(bgpq_operand) next;
+	int minus;
+	struct bgpq_expander expander;
+};
+
+STAILQ_HEAD(bgpq_operands, bgpq_operand);
+
+struct bgpq_expander*
+newoperand(struct bgpq_operands* operands, struct bgpq_expander* b, int minus)
+{
+	struct bgpq_operand* op=malloc(sizeof(struct bgpq_operand));
+	if(!op) {
+		sx_report(SX_FATAL,"Unable to allocate %lu bytes: %s\n",
+			(unsigned long)sizeof(struct bgpq_operand), strerror(errno));
+		exit(1);
+	};
+	op->minus=minus;
+	bgpq_expander_init(&op->expander,b->family);
+	if(b->treex && !(op->expander.treex=sx_radix_tree_new(AF_INET6))) {
+		sx_report(SX_FATAL, "error initializing treex: %s\n",
+			strerror(errno));
+		exit(1);
+	};
+	op->expander.sources=b->sources;
+	op->expander.name=b->name;
+	op->expander.generation=b->generation;
+	op->expander.identify=b->identify;
+	op->expander.maxdepth=b->maxdepth;
+	op->expander.validate_asns=b->validate_asns;
+	op->expander.asn32=b->asn32;
+	op->expander.server=b->server;
+	op->expander.port=b->port;
+	op->expander.maxlen=b->maxlen;
+	op->expander.cache=b->cache;
+	STAILQ_INSERT_TAIL(operands, op, next);
+	return &op->expander;
+};
+
 int
 main(int argc, char* argv[])
 {
 	int c;
-	struct bgpq_expander expander;
+	struct bgpq_expander expander, *cur=&expander;
+	struct bgpq_operands operands;
+	struct bgpq_operand* op;
 	int af=AF_INET, selectedipv4 = 0, exceptmode = 0;
 	int widthSet=0, aggregate=0, refine=0, refineLow=0, hyperaggregate=0;
+	int optimal=0, budget=0;
 	unsigned long maxlen=0;
+	char* check=NULL, *state=NULL, *treein=NULL, *treeout=NULL;
 
 	bgpq_expander_init(&expander,af);
+	STAILQ_INIT(&operands);
 	if (getenv("IRRD_SOURCES"))
 		expander.sources=getenv("IRRD_SOURCES");
 
-	while((c=getopt(argc,argv,"2346a:AbBdDEF:HS:jJf:l:L:m:M:NnW:Ppr:R:G:tTh:UwXxsz"))
+	while((c=getopt(argc,argv,"2346a:AbBcC:dDe:EF:HS:i:I:jJf:k:l:L:m:M:NnoO:W:Ppr:R:G:tTh:UwXxY:szZ"))
 		!=EOF) {
 	switch(c) {
 		case '2':
@@ -198,10 +266,32 @@ main(int argc, char* argv[])
 			expander.vendor=V_OPENBGPD;
 			expander.asn32=1;
 			break;
+		case 'c': expander.asranges=1;
+			break;
+		case 'C': expander.cache=optarg;
+			break;
+		case 'i': state=optarg;
+			break;
+		case 'I': treein=optarg;
+			break;
+		case 'k': check=optarg;
+			break;
+		case 'O': treeout=optarg;
+			break;
 		case 'D': expander.asdot=1;
 			break;
 		case 'd': debug_expander++;
 			break;
+		case 'e': {
+			char* eon;
+			budget=strtoul(optarg, &eon, 10);
+			if(budget<1 || *eon) {
+				sx_report(SX_FATAL, "Invalid entry budget %s, positive number "
+					"expected\n", optarg);
+				exit(1);
+			};
+			break;
+		};
 		case 'E': if(expander.generation) exclusive();
 			expander.generation=T_EACL;
 			break;
@@ -224,8 +314,19 @@ main(int argc, char* argv[])
 				sx_report(SX_FATAL, "-A and -H are mutually exclusive\n");
 				exit(1);
 			};
+			if(optimal) {
+				sx_report(SX_FATAL, "-Z and -H are mutually exclusive\n");
+				exit(1);
+			};
 			hyperaggregate=1;
 			break;
+		case 'Z':
+			if(hyperaggregate) {
+				sx_report(SX_FATAL, "-Z and -H are mutually exclusive\n");
+				exit(1);
+			};
+			optimal=1;
+			break;
 		case 'h': {
 			char* d=strchr(optarg, ':');
 			expander.server=optarg;
@@ -241,6 +342,8 @@ main(int argc, char* argv[])
 		case 'j': if(expander.vendor) vendor_exclusive();
 			expander.vendor=V_JSON;
 			break;
+		case 'o': expander.asregex=1;
+			break;
 		case 'p':
 			expand_special_asn=1;
 			break;
@@ -359,6 +462,16 @@ main(int argc, char* argv[])
 				exit(1);
 			};
 			break;
+		case 'Y': {
+			char* eon;
+			aggregation_threads=strtoul(optarg, &eon, 10);
+			if(aggregation_threads<1 || *eon) {
+				sx_report(SX_FATAL, "Invalid number of threads %s, positive "
+					"number expected\n", optarg);
+				exit(1);
+			};
+			break;
+		};
 		case 'z':
 			if(expander.generation) exclusive();
 			expander.generation=T_ROUTE_FILTER_LIST;
@@ -370,6 +483,10 @@ main(int argc, char* argv[])
 	argc-=optind;
 	argv+=optind;
 
+	/* optimal and lossy aggregation go where greedy one does */
+	if(optimal || budget)
+		aggregate=1;
+
 	if(!widthSet) {
 		if(expander.generation==T_ASPATH) {
 			if(expander.vendor==V_CISCO) {
@@ -443,6 +560,33 @@ main(int argc, char* argv[])
 			"other formats use asplain only\n");
 	};
 
+	if(expander.asranges && expander.generation!=T_ASPATH &&
+		expander.generation!=T_OASPATH && expander.generation!=T_ASSET) {
+		sx_report(SX_FATAL, "Sorry, ASN ranges (-c) make sense only for "
+			"as-path (-f/-G) and as-set (-t) generation\n");
+		exit(1);
+	};
+
+	if(expander.asregex && expander.generation!=T_ASPATH &&
+		expander.generation!=T_OASPATH) {
+		sx_report(SX_FATAL, "Sorry, minimal as-path regular expressions (-o)"
+			" make sense only for as-path (-f/-G) generation\n");
+		exit(1);
+	};
+
+	if(expander.asregex && expander.vendor!=V_CISCO &&
+		expander.vendor!=V_CISCO_XR && expander.vendor!=V_HUAWEI) {
+		sx_report(SX_FATAL, "Sorry, minimal as-path regular expressions (-o)"
+			" supported for Cisco, IOS XR (-X) and Huawei (-U) only\n");
+		exit(1);
+	};
+
+	if(expander.asregex && expander.asdot) {
+		sx_report(SX_FATAL, "Sorry, minimal as-path regular expressions (-o)"
+			" are not compatible with asdot notation (-D)\n");
+		exit(1);
+	};
+
 	if(!expander.asn32 && expander.asnumber>65535) {
 		expander.asnumber=23456;
 	};
@@ -490,6 +634,38 @@ main(int argc, char* argv[])
 		exit(1);
 	};
 
+	if(check && expander.generation<T_PREFIXLIST) {
+		sx_report(SX_FATAL, "Sorry, route check (-k) works with prefix-lists, "
+			"extended access-lists and route-filters only\n");
+		exit(1);
+	};
+
+	if(state && (expander.generation<T_PREFIXLIST ||
+		!(expander.vendor==V_JUNIPER || (expander.generation==T_PREFIXLIST &&
+		(expander.vendor==V_CISCO || expander.vendor==V_JSON))))) {
+		sx_report(SX_FATAL, "Sorry, incremental output (-i) is supported for "
+			"Cisco and JSON prefix-lists and JunOS prefix-lists, route-filters "
+			"and route-filter-lists only\n");
+		exit(1);
+	};
+	if(state && expander.sequence) {
+		sx_report(SX_FATAL, "Sorry, sequence numbers (-s) can't be used with "
+			"incremental output (-i)\n");
+		exit(1);
+	};
+	if(state && check) {
+		sx_report(SX_FATAL, "Sorry, route check (-k) and incremental output "
+			"(-i) are mutually exclusive\n");
+		exit(1);
+	};
+
+	if((treein || treeout) && expander.generation<T_PREFIXLIST) {
+		sx_report(SX_FATAL, "Sorry, saved trees (-I/-O) hold prefixes, they "
+			"work with prefix-lists, extended access-lists and route-filters "
+			"only\n");
+		exit(1);
+	};
+
 	if(hyperaggregate && expander.generation<T_PREFIXLIST) {
 		sx_report(SX_FATAL, "Sorry, hyperaggregation (-H) used only for "
 			"prefix-lists, extended access-lists and route-filters\n");
@@ -633,39 +809,53 @@ main(int argc, char* argv[])
 		sx_report(SX_FATAL, "Sorry, -f 0 makes no sense with OpenBGPD\n");
 	};
 
-	if(!argv[0])
+	if(treein && argv[0]) {
+		sx_report(SX_FATAL, "Objects are taken from trees file %s (-I), "
+			"no objects expected\n", treein);
+		exit(1);
+	};
+
+	if(!argv[0] && !treein)
 		usage(1);
 
 	while(argv[0]) {
-		if(!strcmp(argv[0], "EXCEPT")) {
+		if(!strcmp(argv[0], "AND") || !strcmp(argv[0], "MINUS")) {
+			if(!argv[1]) {
+				sx_report(SX_FATAL, "%s requires right-hand side objects\n",
+					argv[0]);
+				exit(1);
+			};
+			cur = newoperand(&operands, &expander, argv[0][0]=='M');
+			exceptmode = 0;
+		} else if(!strcmp(argv[0], "EXCEPT")) {
 			exceptmode = 1;
 		} else if (exceptmode) {
-			bgpq_expander_add_stop(&expander,argv[0]);
+			bgpq_expander_add_stop(cur,argv[0]);
 		} else if(!strncasecmp(argv[0],"AS-",3)) {
-			bgpq_expander_add_asset(&expander,argv[0]);
+			bgpq_expander_add_asset(cur,argv[0]);
 		} else if(!strncasecmp(argv[0],"RS-",3)) {
-			bgpq_expander_add_rset(&expander,argv[0]);
+			bgpq_expander_add_rset(cur,argv[0]);
 		} else if(!strncasecmp(argv[0],"AS",2)) {
 			char* c;
 			if((c=strchr(argv[0],':'))) {
 				if(!strncasecmp(c+1,"AS-",3)) {
-					bgpq_expander_add_asset(&expander,argv[0]);
+					bgpq_expander_add_asset(cur,argv[0]);
 				} else if(!strncasecmp(c+1,"RS-",3)) {
-					bgpq_expander_add_rset(&expander,argv[0]);
+					bgpq_expander_add_rset(cur,argv[0]);
 				} else {
 					SX_DEBUG(debug_expander,"Unknown sub-as object %s\n",
 						argv[0]);
 				};
 			} else {
-				bgpq_expander_add_as(&expander,argv[0]);
+				bgpq_expander_add_as(cur,argv[0]);
 			};
 		} else {
 			char* c = strchr(argv[0], '^');
-			if (!c && !bgpq_expander_add_prefix(&expander,argv[0])) {
+			if (!c && !bgpq_expander_add_prefix(cur,argv[0])) {
 				sx_report(SX_ERROR, "Unable to add prefix %s (bad prefix or "
 					"address-family)\n", argv[0]);
 				exit(1);
-			} else if (c && !bgpq_expander_add_prefix_range(&expander,argv[0])){
+			} else if (c && !bgpq_expander_add_prefix_range(cur,argv[0])){
 				sx_report(SX_ERROR, "Unable to add prefix-range %s (bad range "
 					"or address-family)\n", argv[0]);
 				exit(1);
@@ -675,28 +865,111 @@ main(int argc, char* argv[])
 		argc--;
 	};
 
-	if(!bgpq_expand(&expander)) {
+	if(treein) {
+		if(!bgpq_tree_load(&expander, treein))
+			exit(1);
+	} else if(!bgpq_expand(&expander)) {
+		exit(1);
+	};
+
+	STAILQ_FOREACH(op, &operands, next) {
+		if(!bgpq_expand(&op->expander)) {
+			exit(1);
+		};
+		if(op->minus)
+			bgpq_expander_minus(&expander, &op->expander);
+		else
+			bgpq_expander_and(&expander, &op->expander);
+		sx_radix_tree_destroy(op->expander.tree);
+		sx_radix_tree_destroy(op->expander.treex);
+		sx_tset_free(&op->expander.already);
+		sx_tset_free(&op->expander.stoplist);
+		sx_tset_free(&op->expander.stopasns);
+		sx_arena_free(&op->expander.arena);
+	};
+
+	if(treeout && !bgpq_tree_save(&expander, treeout))
 		exit(1);
+
+	/* prefix-ranges are kept as single entries unless the output has no
+	 * way to express them */
+	if(expander.vendor==V_FORMAT ||
+		(expander.vendor==V_JUNIPER && expander.generation==T_PREFIXLIST) ||
+		((expander.vendor==V_NOKIA_MD || expander.vendor==V_NOKIA) &&
+		expander.generation!=T_PREFIXLIST)) {
+		sx_radix_tree_expand_ranges(expander.tree);
+		if (expander.treex)
+			sx_radix_tree_expand_ranges(expander.treex);
 	};
 
 	if(refine)
 		sx_radix_tree_refine(expander.tree,refine);
 
 	if(refineLow)
-		sx_radix_tree_refineLow(expander.tree, refineLow);
-
-	if(aggregate || hyperaggregate) {
+		sx_radix_tree_refineLow(expander.tree, refineLow, refine);
+
+	if(optimal) {
+		struct sx_radix_tree* greedy;
+		int entries=0, gentries=0;
+		if((greedy=sx_radix_tree_copy(expander.tree))) {
+			sx_radix_tree_aggregate(greedy);
+			gentries+=sx_radix_tree_entries(greedy);
+			sx_radix_tree_destroy(greedy);
+		};
+		if(expander.treex && (greedy=sx_radix_tree_copy(expander.treex))) {
+			sx_radix_tree_aggregate(greedy);
+			gentries+=sx_radix_tree_entries(greedy);
+			sx_radix_tree_destroy(greedy);
+		};
+		entries+=sx_radix_tree_optimize(expander.tree);
+		if (expander.treex)
+			entries+=sx_radix_tree_optimize(expander.treex);
+		fprintf(stderr, "Optimal aggregation: %i entries (greedy -A: %i)\n",
+			entries, gentries);
+	} else if(aggregate || hyperaggregate) {
 		sx_radix_tree_aggregate(expander.tree);
 		if (expander.treex)
 			sx_radix_tree_aggregate(expander.treex);
 	};
 
+	if(budget) {
+		struct sx_radix_tree* trees[2]={expander.tree, expander.treex};
+		double pairs, addrs, p0=0, a0=0, p1=0, a1=0;
+		int entries, before=sx_radix_tree_entries(expander.tree)+
+			sx_radix_tree_entries(expander.treex);
+		for(c=0; c<2; c++) {
+			sx_radix_tree_accepted(trees[c], &pairs, &addrs);
+			p0+=pairs;
+			a0+=addrs;
+		};
+		entries=sx_radix_tree_budget(trees, 2, budget);
+		for(c=0; c<2; c++) {
+			sx_radix_tree_accepted(trees[c], &pairs, &addrs);
+			p1+=pairs;
+			a1+=addrs;
+		};
+		fprintf(stderr, "Entry budget %i: %i entries cut to %i, accepting "
+			"%.0f more prefixes (+%.2f%%) and %.0f more addresses (+%.2f%%)\n",
+			budget, before, entries, p1-p0, p0?(p1-p0)*100/p0:0, a1-a0,
+			a0?(a1-a0)*100/a0:0);
+		if(entries>budget)
+			sx_report(SX_ERROR, "Can't fit in %i entries\n", budget);
+	};
+
 	if(hyperaggregate) {
 		sx_radix_tree_hyperaggregate(expander.tree);
 		if (expander.treex)
 			sx_radix_tree_hyperaggregate(expander.treex);
 	};
 
+	if(check) {
+		bgpq_check_routes(stdout, &expander, check);
+		return 0;
+	};
+
+	if(state && bgpq_state_delta(stdout, &expander, state))
+		goto printed;
+
 	switch(expander.generation) {
 		case T_NONE: sx_report(SX_FATAL,"Unreachable point... call snar\n");
 			exit(1);
@@ -715,6 +988,16 @@ main(int argc, char* argv[])
 			break;
 	};
 
+printed:
+	/* state follows what was actually printed */
+	if(state) {
+		if(fflush(stdout) || ferror(stdout)) {
+			sx_report(SX_FATAL, "Unable to write output, state %s not "
+				"saved: %s\n", state, strerror(errno));
+			exit(1);
+		};
+		bgpq_state_save(&expander, state);
+	};
 	return 0;
 };
 
@@ -41,17 +41,19 @@ struct bgpq_request {
 	int size, offset;
 	int (*callback)(char*, struct bgpq_expander*, struct bgpq_request*);
 	void *udata;
-	unsigned depth;
+	int linestart;	/* token passed to callback begins a reply line */
 };
 
 struct bgpq_expander {
 	struct sx_radix_tree* tree, *treex;
-	STAILQ_HEAD(sx_slentries, sx_slentry) macroses, rsets;
-	RB_HEAD(tentree, sx_tentry) already, stoplist;
+	struct sx_prefix* loadq;	/* prefixes waiting for sx_radix_tree_load */
+	int nloadq, sloadq;
+	STAILQ_HEAD(sx_slentries, sx_slentry) macroses, rsets, levelq;
+	struct sx_tset already, stoplist, stopasns;
 	int family;
 	char* sources;
 	uint32_t asnumber;
-	int aswidth, asdot;
+	int aswidth, asdot, asranges, asregex;
 	char* name;
 	bgpq_vendor_t vendor;
 	bgpq_gen_t    generation;
@@ -68,8 +70,19 @@ struct bgpq_expander {
 	char* port;
 	char* format;
 	unsigned maxlen;
-	STAILQ_HEAD(bgpq_requests, bgpq_request) wq, rq;
+	STAILQ_HEAD(bgpq_requests, bgpq_request) wq, rq, freeq;
 	int fd, cdepth;
+	struct sx_arena arena;
+	char* cache;
+	struct sx_tset cached, serials;
+};
+
+/* as-set membership kept between runs (-C) */
+struct bgpq_cached {
+	char* source;
+	char* serial;
+	int sourcenext;
+	struct sx_slentries members;
 };
 
 
@@ -81,7 +94,67 @@ int bgpq_expander_add_prefix(struct bgpq_expander* b, char* prefix);
 int bgpq_expander_add_prefix_range(struct bgpq_expander* b, char* prefix);
 int bgpq_expander_add_stop(struct bgpq_expander* b, char* object);
 
+/* non-zero if asn is in b->asn32s */
+int bgpq_expander_asn_isset(struct bgpq_expander* b, uint32_t asn);
+
+/* sets *asn to the first ASN in b->asn32s that is not below from.
+ * Returns 0 (leaving *asn alone) if there is none. */
+int bgpq_expander_asn_find(struct bgpq_expander* b, uint32_t from,
+	uint32_t* asn);
+/* advances *asn to the next ASN in b->asn32s, returns 0 if none is left */
+int bgpq_expander_asn_next(struct bgpq_expander* b, uint32_t* asn);
+
+/* returns last ASN of the run of consecutive ASNs starting at asn */
+uint32_t bgpq_expander_asn_run(struct bgpq_expander* b, uint32_t asn);
+
+/* AS0 is a valid member, so the end of iteration is a separate flag,
+ * more, an int the caller declares along with asn */
+#define BGPQ_ASN_FOREACH(asn, more, b)					\
+	for (more = bgpq_expander_asn_find((b), 0, &(asn));		\
+		more; more = bgpq_expander_asn_next((b), &(asn)))
+
+/* set algebra over expanded objects: b=b AND o, b=b MINUS o */
+int bgpq_expander_and(struct bgpq_expander* b, struct bgpq_expander* o);
+int bgpq_expander_minus(struct bgpq_expander* b, struct bgpq_expander* o);
+
 int bgpq_expand(struct bgpq_expander* b);
+int bgpq_expanded_macro_limit(char* as, struct bgpq_expander* b,
+	struct bgpq_request* req);
+
+FILE* bgpq_tmpfile(const char* file, char* tmp, size_t size);
+int bgpq_cache_load(struct bgpq_expander* b);
+int bgpq_cache_save(struct bgpq_expander* b);
+int bgpq_cache_expand(struct bgpq_expander* b, char* name,
+	struct bgpq_cached** entry);
+void bgpq_cache_add_member(struct bgpq_expander* b, struct bgpq_cached* c,
+	char* name);
+int bgpq_cache_serial(char* token, struct bgpq_expander* b,
+	struct bgpq_request* req);
+int bgpq_cache_source(char* token, struct bgpq_expander* b,
+	struct bgpq_request* req);
+
+/* prefix filter entry as printed: prefix accepted at lengths lo-hi,
+ * lo==hi==masklen for an exact match */
+struct bgpq_entry {
+	struct sx_prefix prefix;
+	unsigned char lo, hi;
+};
+
+/* incremental output (-i): print changes against the entries kept in the
+ * state file, 0 when there is no usable state and the whole filter is to
+ * be printed. bgpq_state_save stores the entries of the current trees. */
+int bgpq_state_delta(FILE* f, struct bgpq_expander* b, char* file);
+int bgpq_state_save(struct bgpq_expander* b, char* file);
+int bgpq3_print_prefixlist_delta(FILE* f, struct bgpq_expander* b,
+	struct bgpq_entry* removed, int nremoved, struct bgpq_entry* added,
+	int nadded);
+
+/* expanded trees saved (-O) and loaded back instead of querying (-I) */
+int bgpq_tree_save(struct bgpq_expander* b, char* file);
+int bgpq_tree_load(struct bgpq_expander* b, char* file);
+
+/* route check (-k): match prefixes read from file against the trees */
+int bgpq_check_routes(FILE* f, struct bgpq_expander* b, char* filename);
 
 int bgpq3_print_prefixlist(FILE* f, struct bgpq_expander* b);
 int bgpq3_print_eacl(FILE* f, struct bgpq_expander* b);
@@ -7,7 +7,10 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
@@ -21,10 +24,386 @@ int bgpq3_print_bird_aspath(FILE* f, struct bgpq_expander* b);
 int bgpq3_print_openbgpd_aspath(FILE* f, struct bgpq_expander* b);
 int bgpq3_print_openbgpd_asset(FILE* f, struct bgpq_expander* b);
 
+/* with -c, returns last ASN of the run starting at asn (runs shorter than
+ * 3 ASNs are not worth a range), stopping before skip. Otherwise asn. */
+static uint32_t
+bgpq3_asn_range(struct bgpq_expander* b, uint32_t asn, uint32_t skip)
+{
+	uint32_t last;
+	if(!b->asranges)
+		return asn;
+	last=bgpq_expander_asn_run(b, asn);
+	if(skip>asn && skip<=last)
+		last=skip-1;
+	if(last-asn<2)
+		return asn;
+	return last;
+};
+
+static void
+bgpq3_fprint_asrange(FILE* f, uint32_t first, uint32_t last, char* sep)
+{
+	if(first==last)
+		fprintf(f,"%u",first);
+	else
+		fprintf(f,"%u%s%u",first,sep,last);
+};
+
+/* Minimal regular expressions for as-path filters (-o): ASNs are put into
+ * a decimal digit trie per number of digits, identical subtrees are merged
+ * and sibling digits leading to the same subtree become character classes,
+ * so 64500-64599 turns into 645[0-9][0-9]. */
+
+/* -o splits expressions so that every emitted configuration line fits
+ * the platform's CLI input line (not counting the newline): 254 characters
+ * on IOS, 1023 on IOS XR and 510 on Huawei VRP, where the as-path regular
+ * expression itself is further limited to 255 characters */
+#define ASREGEX_CISCO_LINE 254
+#define ASREGEX_CISCO_XR_LINE 1023
+#define ASREGEX_HUAWEI_LINE 510
+#define ASREGEX_HUAWEI_REGEX 255
+/* a single 10-digit ASN has to fit anyway */
+#define ASREGEX_MIN_ROOM 10
+
+struct asregex_node {
+	int child[10];
+};
+
+struct asregex {
+	struct asregex_node* nodes;
+	int nnodes, size;
+	int* canon;
+	int root[11];
+};
+
+static int
+asregex_node_new(struct asregex* rx)
+{
+	if(rx->nnodes==rx->size) {
+		int nsize=rx->size ? rx->size*2 : 1024;
+		struct asregex_node* n=realloc(rx->nodes,
+			nsize*sizeof(struct asregex_node));
+		if(!n) {
+			sx_report(SX_FATAL, "Unable to allocate %lu bytes: %s\n",
+				(unsigned long)(nsize*sizeof(struct asregex_node)),
+				strerror(errno));
+			exit(1);
+		};
+		rx->nodes=n;
+		rx->size=nsize;
+	};
+	memset(rx->nodes+rx->nnodes, 0xff, sizeof(struct asregex_node));
+	return rx->nnodes++;
+};
+
+static void
+asregex_insert(struct asregex* rx, uint32_t asn)
+{
+	char digits[16];
+	int len=snprintf(digits, sizeof(digits), "%u", asn), i, n;
+	if(rx->root[len]<0)
+		rx->root[len]=asregex_node_new(rx);
+	n=rx->root[len];
+	for(i=0;i<len;i++) {
+		int d=digits[i]-'0';
+		if(rx->nodes[n].child[d]<0) {
+			int c=asregex_node_new(rx);
+			rx->nodes[n].child[d]=c;
+		};
+		n=rx->nodes[n].child[d];
+	};
+};
+
+/* children are always created after their parents, so walking the node
+ * array backwards assigns ids to subtrees bottom-up */
+static void
+asregex_canonicalize(struct asregex* rx)
+{
+	int hsize=1, *hash, (*sigs)[10], nsigs=0, n, d;
+	while(hsize<rx->nnodes*2) hsize<<=1;
+	hash=malloc(hsize*sizeof(int));
+	sigs=malloc(rx->nnodes*sizeof(*sigs));
+	rx->canon=malloc(rx->nnodes*sizeof(int));
+	if(!hash || !sigs || !rx->canon) {
+		sx_report(SX_FATAL, "Unable to allocate memory for as-path "
+			"regex: %s\n", strerror(errno));
+		exit(1);
+	};
+	memset(hash, 0xff, hsize*sizeof(int));
+	for(n=rx->nnodes-1;n>=0;n--) {
+		int sig[10];
+		unsigned h=0;
+		for(d=0;d<10;d++) {
+			int c=rx->nodes[n].child[d];
+			sig[d]=c<0 ? -1 : rx->canon[c];
+			h=h*31+(unsigned)sig[d];
+		};
+		h&=hsize-1;
+		while(hash[h]>=0 && memcmp(sigs[hash[h]], sig, sizeof(sig)))
+			h=(h+1)&(hsize-1);
+		if(hash[h]<0) {
+			memcpy(sigs[nsigs], sig, sizeof(sig));
+			hash[h]=nsigs++;
+		};
+		rx->canon[n]=hash[h];
+	};
+	free(hash);
+	free(sigs);
+};
+
+struct asregex_buf {
+	char* text;
+	int len, size;
+};
+
+static void
+asregex_buf_add(struct asregex_buf* buf, const char* text, int len)
+{
+	if(buf->len+len+1>buf->size) {
+		int nsize=buf->size ? buf->size : 256;
+		char* t;
+		while(nsize<buf->len+len+1) nsize*=2;
+		t=realloc(buf->text, nsize);
+		if(!t) {
+			sx_report(SX_FATAL, "Unable to allocate %i bytes: %s\n",
+				nsize, strerror(errno));
+			exit(1);
+		};
+		buf->text=t;
+		buf->size=nsize;
+	};
+	memcpy(buf->text+buf->len, text, len);
+	buf->len+=len;
+	buf->text[buf->len]=0;
+};
+
+/* groups children of node n by their subtree: group[d] is the first digit
+ * of the group d belongs to. Returns the number of groups. */
+static int
+asregex_groups(struct asregex* rx, int n, int* group)
+{
+	int d, e, ngroups=0;
+	for(d=0;d<10;d++) {
+		int c=rx->nodes[n].child[d];
+		group[d]=-1;
+		if(c<0)
+			continue;
+		for(e=0;e<d;e++) {
+			if(group[e]==e &&
+				rx->canon[rx->nodes[n].child[e]]==rx->canon[c]) {
+				group[d]=e;
+				break;
+			};
+		};
+		if(group[d]<0) {
+			group[d]=d;
+			ngroups++;
+		};
+	};
+	return ngroups;
+};
+
+static void
+asregex_class(int* group, int g, struct asregex_buf* buf)
+{
+	char cls[24];
+	int d, len=0, cnt=0, first=-1, last=-1, contiguous=1;
+	for(d=g;d<10;d++) {
+		if(group[d]!=g)
+			continue;
+		if(last>=0 && d!=last+1)
+			contiguous=0;
+		if(first<0)
+			first=d;
+		last=d;
+		cnt++;
+	};
+	if(cnt==1) {
+		len=snprintf(cls, sizeof(cls), "%i", first);
+	} else if(contiguous && cnt>2) {
+		len=snprintf(cls, sizeof(cls), "[%i-%i]", first, last);
+	} else {
+		cls[len++]='[';
+		for(d=g;d<10;d++)
+			if(group[d]==g)
+				cls[len++]='0'+d;
+		cls[len++]=']';
+	};
+	asregex_buf_add(buf, cls, len);
+};
+
+static void
+asregex_expr(struct asregex* rx, int n, struct asregex_buf* buf)
+{
+	int group[10], ngroups=asregex_groups(rx, n, group), d, nc=0;
+	if(!ngroups)
+		return;
+	if(ngroups>1)
+		asregex_buf_add(buf, "(", 1);
+	for(d=0;d<10;d++) {
+		if(group[d]!=d)
+			continue;
+		if(nc++)
+			asregex_buf_add(buf, "|", 1);
+		asregex_class(group, d, buf);
+		asregex_expr(rx, rx->nodes[n].child[d], buf);
+	};
+	if(ngroups>1)
+		asregex_buf_add(buf, ")", 1);
+};
+
+/* splits expression for node n (prefixed with prefix) into alternatives
+ * no longer than maxlen where possible */
+static void
+asregex_atoms(struct asregex* rx, int n, struct asregex_buf* prefix,
+	int maxlen, int top, struct asregex_buf* atoms)
+{
+	struct asregex_buf expr={NULL, 0, 0};
+	int group[10], ngroups=asregex_groups(rx, n, group), d;
+
+	asregex_buf_add(&expr, prefix->text ? prefix->text : "", prefix->len);
+	asregex_expr(rx, n, &expr);
+	if(!ngroups || (expr.len<=maxlen && !(top && ngroups>1))) {
+		asregex_buf_add(atoms, expr.text, expr.len+1);
+		free(expr.text);
+		return;
+	};
+	free(expr.text);
+	for(d=0;d<10;d++) {
+		struct asregex_buf sub={NULL, 0, 0};
+		if(group[d]!=d)
+			continue;
+		asregex_buf_add(&sub, prefix->text ? prefix->text : "", prefix->len);
+		asregex_class(group, d, &sub);
+		asregex_atoms(rx, rx->nodes[n].child[d], &sub, maxlen, 0, atoms);
+		free(sub.text);
+	};
+};
+
+static void
+asregex_line_add(struct sx_slentries* lines, char* text)
+{
+	struct sx_slentry* le=sx_slentry_new(text);
+	if(!le || !le->text) {
+		sx_report(SX_FATAL, "Unable to allocate memory for as-path "
+			"regex: %s\n", strerror(errno));
+		exit(1);
+	};
+	STAILQ_INSERT_TAIL(lines, le, next);
+};
+
+/* fills lines with '|'-joined minimal regexes matching all ASNs in the
+ * set but *skip, if any, each line no longer than maxlen characters */
+static void
+bgpq3_asregex_lines(struct bgpq_expander* b, const uint32_t* skip, int maxlen,
+	struct sx_slentries* lines)
+{
+	struct asregex rx;
+	struct asregex_buf atoms={NULL, 0, 0}, line={NULL, 0, 0}, prefix={NULL, 0, 0};
+	uint32_t asn;
+	int more;
+	int len;
+	char* c;
+
+	STAILQ_INIT(lines);
+	memset(&rx, 0, sizeof(rx));
+	memset(rx.root, 0xff, sizeof(rx.root));
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		if(!skip || asn!=*skip)
+			asregex_insert(&rx, asn);
+	};
+	if(!rx.nnodes)
+		return;
+	asregex_canonicalize(&rx);
+
+	for(len=1;len<=10;len++)
+		if(rx.root[len]>=0)
+			asregex_atoms(&rx, rx.root[len], &prefix, maxlen, 1, &atoms);
+
+	for(c=atoms.text;c<atoms.text+atoms.len;c+=strlen(c)+1) {
+		int clen=strlen(c);
+		if(line.len && line.len+1+clen>maxlen) {
+			asregex_line_add(lines, line.text);
+			line.len=0;
+		};
+		if(line.len)
+			asregex_buf_add(&line, "|", 1);
+		asregex_buf_add(&line, c, clen);
+	};
+	if(line.len)
+		asregex_line_add(lines, line.text);
+
+	free(line.text);
+	free(atoms.text);
+	free(rx.nodes);
+	free(rx.canon);
+};
+
+/* room left for the alternation on a line limited to limit characters
+ * of which used are taken by the fixed text around it */
+static int
+bgpq3_asregex_room(int limit, int used)
+{
+	if(limit-used<ASREGEX_MIN_ROOM) {
+		sx_report(SX_FATAL, "as-path name is too long to keep -o lines "
+			"within %i characters\n", limit);
+		exit(1);
+	};
+	return limit-used;
+};
+
+/* Huawei limits both the line and the expression following "permit " */
+static int
+bgpq3_asregex_huawei_room(const char* head)
+{
+	int line=bgpq3_asregex_room(ASREGEX_HUAWEI_LINE, strlen(head)+2);
+	int expr=bgpq3_asregex_room(ASREGEX_HUAWEI_REGEX,
+		strlen(strrchr(head, '^'))+2);
+	return line<expr?line:expr;
+};
+
+/* formats the fixed text preceding the alternation on each -o line */
+static char*
+bgpq3_asregex_head(const char* fmt, ...)
+{
+	va_list ap;
+	char* head;
+	int len;
+
+	va_start(ap, fmt);
+	len=vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	head=malloc(len+1);
+	if(!head) {
+		sx_report(SX_FATAL, "Unable to allocate %i bytes: %s\n", len+1,
+			strerror(errno));
+		exit(1);
+	};
+	va_start(ap, fmt);
+	vsnprintf(head, len+1, fmt, ap);
+	va_end(ap);
+	return head;
+};
+
+static void
+bgpq3_asregex_free(struct sx_slentries* lines)
+{
+	struct sx_slentry* le;
+	while((le=STAILQ_FIRST(lines))!=NULL) {
+		STAILQ_REMOVE_HEAD(lines, next);
+		free(le->text);
+		free(le);
+	};
+};
+
 int
 bgpq3_print_cisco_aspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, i, j, k, empty=1;
+	int nc=0, empty=1;
+	uint32_t asn;
+	int more;
+	struct sx_slentries lines;
+	struct sx_slentry* le;
 	fprintf(f,"no ip as-path access-list %s\n", b->name?b->name:"NN");
 	if(b->asn32s[b->asnumber/65536] &&
 		b->asn32s[b->asnumber/65536][(b->asnumber%65536)/8]&
@@ -40,48 +419,59 @@ bgpq3_print_cisco_aspath(FILE* f, struct bgpq_expander* b)
 			empty=0;
 		};
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(b->asnumber>0 && k*65536+i*8+j==b->asnumber)
-						continue;
-					if(!nc) {
-						if(b->asdot && k>0 && b->asnumber>0) {
-							fprintf(f,"ip as-path access-list %s permit"
-								" ^%u(_[0-9]+)*_(%u.%u", b->name?b->name:"NN",
-								b->asnumber,k,i*8+j);
-							empty=0;
-						} else if(b->asnumber>0) {
-							fprintf(f,"ip as-path access-list %s permit"
-								" ^%u(_[0-9]+)*_(%u", b->name?b->name:"NN",
-								b->asnumber,k*65536+i*8+j);
-							empty=0;
-						} else if(b->asdot && k>0) {
-							/* b->asnumber==0 is implied */
-							fprintf(f,"ip as-path access-list %s permit"
-								" ^.*(%u.%u", b->name?b->name:"NN",k,i*8+j);
-						} else {
-							fprintf(f,"ip as-path access-list %s permit"
-								" ^.*(%u",b->name?b->name:"NN",k*65536+i*8+j);
-						};
-					} else {
-						if(b->asdot && k>0) {
-							fprintf(f,"|%u.%u",k,i*8+j);
-							empty=0;
-						} else {
-							fprintf(f,"|%u",k*65536+i*8+j);
-							empty=0;
-						};
-					}
-					nc++;
-					if(nc==b->aswidth) {
-						fprintf(f,")$\n");
-						nc=0;
-					};
+	if(b->asregex) {
+		char* head;
+		if(b->asnumber>0) {
+			head=bgpq3_asregex_head("ip as-path access-list %s permit"
+				" ^%u(_[0-9]+)*_(", b->name?b->name:"NN", b->asnumber);
+		} else {
+			head=bgpq3_asregex_head("ip as-path access-list %s permit"
+				" ^.*(", b->name?b->name:"NN");
+		};
+		bgpq3_asregex_lines(b, b->asnumber>0?&b->asnumber:NULL,
+			bgpq3_asregex_room(ASREGEX_CISCO_LINE, strlen(head)+2), &lines);
+		STAILQ_FOREACH(le, &lines, next) {
+			fprintf(f,"%s%s)$\n", head, le->text);
+			empty=0;
+		};
+		free(head);
+		bgpq3_asregex_free(&lines);
+	} else {
+		BGPQ_ASN_FOREACH(asn, more, b) {
+			if(b->asnumber>0 && asn==b->asnumber)
+				continue;
+			if(!nc) {
+				if(b->asdot && asn>65535 && b->asnumber>0) {
+					fprintf(f,"ip as-path access-list %s permit"
+						" ^%u(_[0-9]+)*_(%u.%u", b->name?b->name:"NN",
+						b->asnumber,asn>>16,asn&0xffff);
+					empty=0;
+				} else if(b->asnumber>0) {
+					fprintf(f,"ip as-path access-list %s permit"
+						" ^%u(_[0-9]+)*_(%u", b->name?b->name:"NN",
+						b->asnumber,asn);
+					empty=0;
+				} else if(b->asdot && asn>65535) {
+					/* b->asnumber==0 is implied */
+					fprintf(f,"ip as-path access-list %s permit"
+						" ^.*(%u.%u", b->name?b->name:"NN",asn>>16,asn&0xffff);
+				} else {
+					fprintf(f,"ip as-path access-list %s permit"
+						" ^.*(%u",b->name?b->name:"NN",asn);
 				};
+			} else {
+				if(b->asdot && asn>65535) {
+					fprintf(f,"|%u.%u",asn>>16,asn&0xffff);
+					empty=0;
+				} else {
+					fprintf(f,"|%u",asn);
+					empty=0;
+				};
+			}
+			nc++;
+			if(nc==b->aswidth) {
+				fprintf(f,")$\n");
+				nc=0;
 			};
 		};
 	};
@@ -94,7 +484,11 @@ bgpq3_print_cisco_aspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_cisco_xr_aspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, i, j, k, comma=0;
+	int nc=0, comma=0;
+	uint32_t asn;
+	int more;
+	struct sx_slentries lines;
+	struct sx_slentry* le;
 	fprintf(f, "as-path-set %s", b->name?b->name:"NN");
 	if(b->asnumber!=0 && b->asn32s[b->asnumber/65536] &&
 		b->asn32s[b->asnumber/65536][(b->asnumber%65536)/8]&
@@ -102,31 +496,42 @@ bgpq3_print_cisco_xr_aspath(FILE* f, struct bgpq_expander* b)
 		fprintf(f,"\n  ios-regex '^%u(_%u)*$'", b->asnumber,b->asnumber);
 		comma=1;
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(b->asnumber!=0 && k*65536+i*8+j==b->asnumber)
-						continue;
-					if(!nc && b->asnumber!=0) {
-						fprintf(f,"%s\n  ios-regex '^%u(_[0-9]+)*_(%u",
-							comma?",":"", b->asnumber,k*65536+i*8+j);
-						comma=1;
-					} else if(!nc) {
-						fprintf(f,"%s\n  ios-regex '^([0-9]+_)*(%u",
-							comma?",":"",k*65536+i*8+j);
-						comma=1;
-					} else {
-						fprintf(f,"|%u",k*65536+i*8+j);
-					}
-					nc++;
-					if(nc==b->aswidth) {
-						fprintf(f,")$'");
-						nc=0;
-					};
-				};
+	if(b->asregex) {
+		char* head;
+		if(b->asnumber!=0) {
+			head=bgpq3_asregex_head("  ios-regex '^%u(_[0-9]+)*_(",
+				b->asnumber);
+		} else {
+			head=bgpq3_asregex_head("  ios-regex '^([0-9]+_)*(");
+		};
+		/* ")$'" and the trailing comma */
+		bgpq3_asregex_lines(b, b->asnumber>0?&b->asnumber:NULL,
+			bgpq3_asregex_room(ASREGEX_CISCO_XR_LINE, strlen(head)+4), &lines);
+		STAILQ_FOREACH(le, &lines, next) {
+			fprintf(f,"%s\n%s%s)$'", comma?",":"", head, le->text);
+			comma=1;
+		};
+		free(head);
+		bgpq3_asregex_free(&lines);
+	} else {
+		BGPQ_ASN_FOREACH(asn, more, b) {
+			if(b->asnumber!=0 && asn==b->asnumber)
+				continue;
+			if(!nc && b->asnumber!=0) {
+				fprintf(f,"%s\n  ios-regex '^%u(_[0-9]+)*_(%u",
+					comma?",":"", b->asnumber,asn);
+				comma=1;
+			} else if(!nc) {
+				fprintf(f,"%s\n  ios-regex '^([0-9]+_)*(%u",
+					comma?",":"",asn);
+				comma=1;
+			} else {
+				fprintf(f,"|%u",asn);
+			}
+			nc++;
+			if(nc==b->aswidth) {
+				fprintf(f,")$'");
+				nc=0;
 			};
 		};
 	};
@@ -137,7 +542,11 @@ bgpq3_print_cisco_xr_aspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_cisco_oaspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, i, j, k, empty=1;
+	int nc=0, empty=1;
+	uint32_t asn;
+	int more;
+	struct sx_slentries lines;
+	struct sx_slentry* le;
 	fprintf(f,"no ip as-path access-list %s\n", b->name?b->name:"NN");
 	if(b->asn32s[b->asnumber/65536] &&
 		b->asn32s[b->asnumber/65536][(b->asnumber%65536)/8]&
@@ -151,39 +560,45 @@ bgpq3_print_cisco_oaspath(FILE* f, struct bgpq_expander* b)
 		};
 		empty=0;
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(k*65536+i*8+j==b->asnumber) continue;
-					if(!nc) {
-						if(b->asdot && k>0) {
-							fprintf(f,"ip as-path access-list %s permit"
-								" ^(_[0-9]+)*_(%u.%u", b->name?b->name:"NN",
-								k,i*8+j);
-							empty=0;
-						} else {
-							fprintf(f,"ip as-path access-list %s permit"
-								" ^(_[0-9]+)*_(%u", b->name?b->name:"NN",
-								k*65536+i*8+j);
-							empty=0;
-						};
-					} else {
-						if(b->asdot && k>0) {
-							fprintf(f,"|%u.%u",k,i*8+j);
-							empty=0;
-						} else {
-							fprintf(f,"|%u",k*65536+i*8+j);
-							empty=0;
-						};
-					}
-					nc++;
-					if(nc==b->aswidth) {
-						fprintf(f,")$\n");
-						nc=0;
-					};
+	if(b->asregex) {
+		char* head=bgpq3_asregex_head("ip as-path access-list %s permit"
+			" ^(_[0-9]+)*_(", b->name?b->name:"NN");
+		bgpq3_asregex_lines(b, &b->asnumber, bgpq3_asregex_room(
+			ASREGEX_CISCO_LINE, strlen(head)+2), &lines);
+		STAILQ_FOREACH(le, &lines, next) {
+			fprintf(f,"%s%s)$\n", head, le->text);
+			empty=0;
+		};
+		free(head);
+		bgpq3_asregex_free(&lines);
+	} else {
+		BGPQ_ASN_FOREACH(asn, more, b) {
+			if(asn==b->asnumber) continue;
+			if(!nc) {
+				if(b->asdot && asn>65535) {
+					fprintf(f,"ip as-path access-list %s permit"
+						" ^(_[0-9]+)*_(%u.%u", b->name?b->name:"NN",
+						asn>>16,asn&0xffff);
+					empty=0;
+				} else {
+					fprintf(f,"ip as-path access-list %s permit"
+						" ^(_[0-9]+)*_(%u", b->name?b->name:"NN",
+						asn);
+					empty=0;
 				};
+			} else {
+				if(b->asdot && asn>65535) {
+					fprintf(f,"|%u.%u",asn>>16,asn&0xffff);
+					empty=0;
+				} else {
+					fprintf(f,"|%u",asn);
+					empty=0;
+				};
+			}
+			nc++;
+			if(nc==b->aswidth) {
+				fprintf(f,")$\n");
+				nc=0;
 			};
 		};
 	};
@@ -196,7 +611,11 @@ bgpq3_print_cisco_oaspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_cisco_xr_oaspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, i, j, k, comma=0;
+	int nc=0, comma=0;
+	uint32_t asn;
+	int more;
+	struct sx_slentries lines;
+	struct sx_slentry* le;
 	fprintf(f, "as-path-set %s", b->name?b->name:"NN");
 	if(b->asn32s[b->asnumber/65536] &&
 		b->asn32s[b->asnumber/65536][(b->asnumber%65536)/8]&
@@ -204,25 +623,29 @@ bgpq3_print_cisco_xr_oaspath(FILE* f, struct bgpq_expander* b)
 		fprintf(f,"\n  ios-regex '^(_%u)*$'",b->asnumber);
 		comma=1;
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(k*65536+i*8+j==b->asnumber) continue;
-					if(!nc) {
-						fprintf(f,"%s\n  ios-regex '^(_[0-9]+)*_(%u",
-							comma?",":"", k*65536+i*8+j);
-						comma=1;
-					} else {
-						fprintf(f,"|%u",k*65536+i*8+j);
-					}
-					nc++;
-					if(nc==b->aswidth) {
-						fprintf(f,")$'");
-						nc=0;
-					};
-				};
+	if(b->asregex) {
+		static const char head[]="  ios-regex '^(_[0-9]+)*_(";
+		bgpq3_asregex_lines(b, &b->asnumber, bgpq3_asregex_room(
+			ASREGEX_CISCO_XR_LINE, strlen(head)+4), &lines);
+		STAILQ_FOREACH(le, &lines, next) {
+			fprintf(f,"%s\n%s%s)$'", comma?",":"", head, le->text);
+			comma=1;
+		};
+		bgpq3_asregex_free(&lines);
+	} else {
+		BGPQ_ASN_FOREACH(asn, more, b) {
+			if(asn==b->asnumber) continue;
+			if(!nc) {
+				fprintf(f,"%s\n  ios-regex '^(_[0-9]+)*_(%u",
+					comma?",":"", asn);
+				comma=1;
+			} else {
+				fprintf(f,"|%u",asn);
+			}
+			nc++;
+			if(nc==b->aswidth) {
+				fprintf(f,")$'");
+				nc=0;
 			};
 		};
 	};
@@ -234,7 +657,9 @@ bgpq3_print_cisco_xr_oaspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_juniper_aspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, lineNo=0, i, j, k;
+	int nc=0, lineNo=0;
+	uint32_t asn, last;
+	int more;
 	fprintf(f,"policy-options {\nreplace:\n as-path-group %s {\n",
 		b->name?b->name:"NN");
 
@@ -245,30 +670,24 @@ bgpq3_print_juniper_aspath(FILE* f, struct bgpq_expander* b)
 			b->asnumber);
 		lineNo++;
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(b->asnumber!=0 && k*65536+i*8+j==b->asnumber)
-						continue;
-					if(!nc && b->asnumber!=0) {
-						fprintf(f,"  as-path a%u \"^%u(.)*(%u",
-							lineNo,b->asnumber,k*65536+i*8+j);
-					} else if (!nc) {
-						fprintf(f,"  as-path a%u \"^.*(%u", lineNo,
-							k*65536+i*8+j);
-					} else {
-						fprintf(f,"|%u",k*65536+i*8+j);
-					};
-					nc++;
-					if(nc==b->aswidth) {
-						fprintf(f,")$\";\n");
-						nc=0;
-						lineNo++;
-					};
-				};
-			};
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		if(b->asnumber!=0 && asn==b->asnumber)
+			continue;
+		last=bgpq3_asn_range(b, asn, b->asnumber);
+		if(!nc && b->asnumber!=0) {
+			fprintf(f,"  as-path a%u \"^%u(.)*(", lineNo, b->asnumber);
+		} else if (!nc) {
+			fprintf(f,"  as-path a%u \"^.*(", lineNo);
+		} else {
+			fprintf(f,"|");
+		};
+		bgpq3_fprint_asrange(f, asn, last, "-");
+		asn=last;
+		nc++;
+		if(nc==b->aswidth) {
+			fprintf(f,")$\";\n");
+			nc=0;
+			lineNo++;
 		};
 	};
 	if(nc) fprintf(f,")$\";\n");
@@ -281,7 +700,9 @@ bgpq3_print_juniper_aspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_juniper_oaspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, lineNo=0, i, j, k;
+	int nc=0, lineNo=0;
+	uint32_t asn, last;
+	int more;
 	fprintf(f,"policy-options {\nreplace:\n as-path-group %s {\n",
 		b->name?b->name:"NN");
 
@@ -292,27 +713,21 @@ bgpq3_print_juniper_oaspath(FILE* f, struct bgpq_expander* b)
 			b->asnumber);
 		lineNo++;
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(k*65536+i*8+j==b->asnumber) continue;
-					if(!nc) {
-						fprintf(f,"  as-path a%u \"^(.)*(%u",
-							lineNo,k*65536+i*8+j);
-					} else {
-						fprintf(f,"|%u",k*65536+i*8+j);
-					}
-					nc++;
-					if(nc==b->aswidth) {
-						fprintf(f,")$\";\n");
-						nc=0;
-						lineNo++;
-					};
-				};
-			};
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		if(asn==b->asnumber) continue;
+		last=bgpq3_asn_range(b, asn, b->asnumber);
+		if(!nc) {
+			fprintf(f,"  as-path a%u \"^(.)*(", lineNo);
+		} else {
+			fprintf(f,"|");
+		}
+		bgpq3_fprint_asrange(f, asn, last, "-");
+		asn=last;
+		nc++;
+		if(nc==b->aswidth) {
+			fprintf(f,")$\";\n");
+			nc=0;
+			lineNo++;
 		};
 	};
 	if(nc) fprintf(f,")$\";\n");
@@ -325,20 +740,17 @@ bgpq3_print_juniper_oaspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_openbgpd_oaspath(FILE* f, struct bgpq_expander* b)
 {
-	int i, j, k, lineNo=0;
-
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					fprintf(f, "allow to AS %u AS %u\n", b->asnumber,
-						k*65536+i*8+j);
-					lineNo++;
-				};
-			};
-		};
+	int lineNo=0;
+	uint32_t asn, last;
+	int more;
+
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		last=bgpq3_asn_range(b, asn, 0);
+		fprintf(f, "allow to AS %u AS ", b->asnumber);
+		bgpq3_fprint_asrange(f, asn, last, " - ");
+		fprintf(f, "\n");
+		asn=last;
+		lineNo++;
 	};
 	if(!lineNo)
 		fprintf(f, "deny to AS %u\n", b->asnumber);
@@ -348,7 +760,9 @@ bgpq3_print_openbgpd_oaspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_nokia_aspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, lineNo=1, i, j, k;
+	int nc=0, lineNo=1;
+	uint32_t asn;
+	int more;
 
 	fprintf(f,"configure router policy-options\nbegin\nno as-path-group \"%s\"\n",
 		b->name ? b->name : "NN");
@@ -360,29 +774,22 @@ bgpq3_print_nokia_aspath(FILE* f, struct bgpq_expander* b)
 		fprintf(f,"  entry %u expression \"%u+\"\n", lineNo, b->asnumber);
 		lineNo++;
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(b->asnumber>0 && k*65536+i*8+j==b->asnumber) continue;
-					if(!nc && b->asnumber!=0) {
-						fprintf(f,"  entry %u expression \"%u.*[%u",
-							lineNo,b->asnumber,k*65536+i*8+j);
-					} else if(!nc) {
-						fprintf(f,"  entry %u expression \".*[%u",
-							lineNo,k*65536+i*8+j);
-					} else {
-						fprintf(f," %u",k*65536+i*8+j);
-					};
-					nc++;
-					if(nc==b->aswidth) {
-						fprintf(f,"]\"\n");
-						nc=0;
-						lineNo++;
-					};
-				};
-			};
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		if(b->asnumber>0 && asn==b->asnumber) continue;
+		if(!nc && b->asnumber!=0) {
+			fprintf(f,"  entry %u expression \"%u.*[%u",
+				lineNo,b->asnumber,asn);
+		} else if(!nc) {
+			fprintf(f,"  entry %u expression \".*[%u",
+				lineNo,asn);
+		} else {
+			fprintf(f," %u",asn);
+		};
+		nc++;
+		if(nc==b->aswidth) {
+			fprintf(f,"]\"\n");
+			nc=0;
+			lineNo++;
 		};
 	};
 	if(nc) fprintf(f,"]\"\n");
@@ -393,7 +800,9 @@ bgpq3_print_nokia_aspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_nokia_md_aspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, lineNo=1, i, j, k;
+	int nc=0, lineNo=1;
+	uint32_t asn;
+	int more;
 
 	fprintf(f,"/configure policy-options\ndelete as-path-group \"%s\"\n",
 		b->name ? b->name : "NN");
@@ -406,29 +815,22 @@ bgpq3_print_nokia_md_aspath(FILE* f, struct bgpq_expander* b)
 			b->asnumber);
 		lineNo++;
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(b->asnumber!=0 && k*65536+i*8+j==b->asnumber) continue;
-					if(!nc && b->asnumber!=0) {
-						fprintf(f,"  entry %u {\n    expression \"%u.*[%u",
-							lineNo,b->asnumber,k*65536+i*8+j);
-					} else if(!nc) {
-						fprintf(f,"  entry %u {\n    expression \".*[%u",
-							lineNo,k*65536+i*8+j);
-					} else {
-						fprintf(f," %u",k*65536+i*8+j);
-					};
-					nc++;
-					if(nc==b->aswidth) {
-						fprintf(f,"]\"\n  }\n");
-						nc=0;
-						lineNo++;
-					};
-				};
-			};
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		if(b->asnumber!=0 && asn==b->asnumber) continue;
+		if(!nc && b->asnumber!=0) {
+			fprintf(f,"  entry %u {\n    expression \"%u.*[%u",
+				lineNo,b->asnumber,asn);
+		} else if(!nc) {
+			fprintf(f,"  entry %u {\n    expression \".*[%u",
+				lineNo,asn);
+		} else {
+			fprintf(f," %u",asn);
+		};
+		nc++;
+		if(nc==b->aswidth) {
+			fprintf(f,"]\"\n  }\n");
+			nc=0;
+			lineNo++;
 		};
 	};
 	if(nc) fprintf(f,"]\"\n  }\n");
@@ -440,7 +842,11 @@ bgpq3_print_nokia_md_aspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_huawei_aspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, i, j, k, empty=1;
+	int nc=0, empty=1;
+	uint32_t asn;
+	int more;
+	struct sx_slentries lines;
+	struct sx_slentry* le;
 
 	fprintf(f,"undo ip as-path-filter %s\n",
 		b->name ? b->name : "NN");
@@ -452,30 +858,42 @@ bgpq3_print_huawei_aspath(FILE* f, struct bgpq_expander* b)
 			b->name?b->name:"NN",b->asnumber,b->asnumber);
 		empty=0;
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(b->asnumber!=0 && k*65536+i*8+j==b->asnumber)
-						continue;
-					if(!nc && b->asnumber!=0) {
-						fprintf(f,"ip as-path-filter %s permit ^%u(_[0-9]+)*"
-							"_(%u",
-							b->name?b->name:"NN",b->asnumber,k*65536+i*8+j);
-						empty=0;
-					} else if (!nc) {
-						fprintf(f,"ip as-path-filter %s permit ^.*_(%u",
-							b->name?b->name:"NN",k*65536+i*8+j);
-					} else {
-						fprintf(f,"|%u",k*65536+i*8+j);
-					};
-					nc++;
-					if(nc==b->aswidth) {
-						fprintf(f,")$\n");
-						nc=0;
-					};
-				};
+	if(b->asregex) {
+		char* head;
+		if(b->asnumber!=0) {
+			head=bgpq3_asregex_head("ip as-path-filter %s permit ^%u(_[0-9]+)*"
+				"_(", b->name?b->name:"NN", b->asnumber);
+		} else {
+			head=bgpq3_asregex_head("ip as-path-filter %s permit ^.*_(",
+				b->name?b->name:"NN");
+		};
+		bgpq3_asregex_lines(b, b->asnumber>0?&b->asnumber:NULL,
+			bgpq3_asregex_huawei_room(head), &lines);
+		STAILQ_FOREACH(le, &lines, next) {
+			fprintf(f,"%s%s)$\n", head, le->text);
+			empty=0;
+		};
+		free(head);
+		bgpq3_asregex_free(&lines);
+	} else {
+		BGPQ_ASN_FOREACH(asn, more, b) {
+			if(b->asnumber!=0 && asn==b->asnumber)
+				continue;
+			if(!nc && b->asnumber!=0) {
+				fprintf(f,"ip as-path-filter %s permit ^%u(_[0-9]+)*"
+					"_(%u",
+					b->name?b->name:"NN",b->asnumber,asn);
+				empty=0;
+			} else if (!nc) {
+				fprintf(f,"ip as-path-filter %s permit ^.*_(%u",
+					b->name?b->name:"NN",asn);
+			} else {
+				fprintf(f,"|%u",asn);
+			};
+			nc++;
+			if(nc==b->aswidth) {
+				fprintf(f,")$\n");
+				nc=0;
 			};
 		};
 	};
@@ -488,7 +906,11 @@ bgpq3_print_huawei_aspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_huawei_oaspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, i, j, k, empty=1;
+	int nc=0, empty=1;
+	uint32_t asn;
+	int more;
+	struct sx_slentries lines;
+	struct sx_slentry* le;
 
 	fprintf(f,"undo ip as-path-filter %s\n",
 		b->name ? b->name : "NN");
@@ -500,26 +922,31 @@ bgpq3_print_huawei_oaspath(FILE* f, struct bgpq_expander* b)
 			b->asnumber);
 		empty=0;
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(k*65536+i*8+j==b->asnumber) continue;
-					if(!nc) {
-						fprintf(f,"ip as-path-filter %s permit ^(_[0-9]+)*_(%u",
-							b->name?b->name:"NN",k*65536+i*8+j);
-					} else {
-						fprintf(f,"|%u",k*65536+i*8+j);
-					}
-					nc++;
-					empty=0;
-					if(nc==b->aswidth) {
-						fprintf(f,")$\n");
-						nc=0;
-					};
-				};
+	if(b->asregex) {
+		char* head=bgpq3_asregex_head("ip as-path-filter %s permit"
+			" ^(_[0-9]+)*_(", b->name?b->name:"NN");
+		bgpq3_asregex_lines(b, &b->asnumber, bgpq3_asregex_huawei_room(head),
+			&lines);
+		STAILQ_FOREACH(le, &lines, next) {
+			fprintf(f,"%s%s)$\n", head, le->text);
+			empty=0;
+		};
+		free(head);
+		bgpq3_asregex_free(&lines);
+	} else {
+		BGPQ_ASN_FOREACH(asn, more, b) {
+			if(asn==b->asnumber) continue;
+			if(!nc) {
+				fprintf(f,"ip as-path-filter %s permit ^(_[0-9]+)*_(%u",
+					b->name?b->name:"NN",asn);
+			} else {
+				fprintf(f,"|%u",asn);
+			}
+			nc++;
+			empty=0;
+			if(nc==b->aswidth) {
+				fprintf(f,")$\n");
+				nc=0;
 			};
 		};
 	};
@@ -532,7 +959,9 @@ bgpq3_print_huawei_oaspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_nokia_oaspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, lineNo=1, i, j, k;
+	int nc=0, lineNo=1;
+	uint32_t asn;
+	int more;
 
 	fprintf(f,"configure router policy-options\nbegin\nno as-path-group \"%s\"\n",
 		b->name ? b->name : "NN");
@@ -544,27 +973,19 @@ bgpq3_print_nokia_oaspath(FILE* f, struct bgpq_expander* b)
 		fprintf(f,"  entry %u expression \"%u+\"\n", lineNo, b->asnumber);
 		lineNo++;
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(k*65536+i*8+j==b->asnumber) continue;
-					if(!nc) {
-						fprintf(f,"  entry %u expression \".*[%u",
-							lineNo,k*65536+i*8+j);
-					} else {
-						fprintf(f," %u",k*65536+i*8+j);
-					}
-					nc++;
-					if(nc==b->aswidth) {
-						fprintf(f,"]\"\n");
-						nc=0;
-						lineNo++;
-					};
-				};
-			};
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		if(asn==b->asnumber) continue;
+		if(!nc) {
+			fprintf(f,"  entry %u expression \".*[%u",
+				lineNo,asn);
+		} else {
+			fprintf(f," %u",asn);
+		}
+		nc++;
+		if(nc==b->aswidth) {
+			fprintf(f,"]\"\n");
+			nc=0;
+			lineNo++;
 		};
 	};
 	if(nc) fprintf(f,"]\"\n");
@@ -574,7 +995,9 @@ bgpq3_print_nokia_oaspath(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_nokia_md_oaspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, lineNo=1, i, j, k;
+	int nc=0, lineNo=1;
+	uint32_t asn;
+	int more;
 
 	fprintf(f,"/configure policy-options\ndelete as-path-group \"%s\"\n",
 		b->name ? b->name : "NN");
@@ -587,27 +1010,19 @@ bgpq3_print_nokia_md_oaspath(FILE* f, struct bgpq_expander* b)
 			b->asnumber);
 		lineNo++;
 	};
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(k*65536+i*8+j==b->asnumber) continue;
-					if(!nc) {
-						fprintf(f,"  entry %u {\n    expression \".*[%u",
-							lineNo,k*65536+i*8+j);
-					} else {
-						fprintf(f," %u",k*65536+i*8+j);
-					}
-					nc++;
-					if(nc==b->aswidth) {
-						fprintf(f,"]\"\n  }\n");
-						nc=0;
-						lineNo++;
-					};
-				};
-			};
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		if(asn==b->asnumber) continue;
+		if(!nc) {
+			fprintf(f,"  entry %u {\n    expression \".*[%u",
+				lineNo,asn);
+		} else {
+			fprintf(f," %u",asn);
+		}
+		nc++;
+		if(nc==b->aswidth) {
+			fprintf(f,"]\"\n  }\n");
+			nc=0;
+			lineNo++;
 		};
 	};
 	if(nc) fprintf(f,"]\"\n  }\n");
@@ -721,34 +1136,29 @@ bgpq3_print_json_prefix(struct sx_radix_node* n, void* ff)
 	needscomma=1;
 checkSon:
 	if(n->son)
-		bgpq3_print_json_prefix(n->son, ff);
+		bgpq3_print_json_prefix(sx_radix_son(n), ff);
 };
 
 int
 bgpq3_print_json_aspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, i, j, k;
+	int nc=0;
+	uint32_t asn, last;
+	int more;
 	fprintf(f,"{\"%s\": [", b->name?b->name:"NN");
 
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(!nc) {
-						fprintf(f,"%s\n  %u",needscomma?",":"", k*65536+i*8+j);
-						needscomma=1;
-					} else {
-						fprintf(f,"%s%u",needscomma?",":"", k*65536+i*8+j);
-						needscomma=1;
-					}
-					nc++;
-					if(nc==b->aswidth) {
-						nc=0;
-					};
-				};
-			};
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		last=bgpq3_asn_range(b, asn, 0);
+		fprintf(f,"%s%s",needscomma?",":"", nc?"":"\n  ");
+		if(last!=asn)
+			fprintf(f,"{ \"from\": %u, \"to\": %u }", asn, last);
+		else
+			fprintf(f,"%u", asn);
+		needscomma=1;
+		asn=last;
+		nc++;
+		if(nc==b->aswidth) {
+			nc=0;
 		};
 	};
 	fprintf(f,"\n]}\n");
@@ -778,37 +1188,34 @@ bgpq3_print_bird_prefix(struct sx_radix_node* n, void* ff)
 	needscomma=1;
 checkSon:
 	if(n->son)
-		bgpq3_print_bird_prefix(n->son, ff);
+		bgpq3_print_bird_prefix(sx_radix_son(n), ff);
 };
 
 int
 bgpq3_print_bird_aspath(FILE* f, struct bgpq_expander* b)
 {
-	int nc=0, i, j, k, empty=1;
+	int nc=0, empty=1;
+	uint32_t asn, last;
+	int more;
 	char buffer[2048];
 	snprintf(buffer, sizeof(buffer), "%s = [", b->name?b->name:"NN");
 
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					if(buffer[0])
-						fprintf(f, "%s", buffer);
-					buffer[0]=0;
-					if(!nc) {
-						fprintf(f, "%s%u", empty?"":",\n    ", k*65536+i*8+j);
-						empty = 0;
-					} else {
-						fprintf(f, ", %u", k*65536+i*8+j);
-					};
-					nc++;
-					if(nc==b->aswidth) {
-						nc=0;
-					};
-				};
-			};
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		if(buffer[0])
+			fprintf(f, "%s", buffer);
+		buffer[0]=0;
+		last=bgpq3_asn_range(b, asn, 0);
+		if(!nc) {
+			fprintf(f, "%s", empty?"":",\n    ");
+			empty = 0;
+		} else {
+			fprintf(f, ", ");
+		};
+		bgpq3_fprint_asrange(f, asn, last, "..");
+		asn=last;
+		nc++;
+		if(nc==b->aswidth) {
+			nc=0;
 		};
 	};
 	if(!empty)
@@ -839,29 +1246,23 @@ bgpq3_print_openbgpd_prefix(struct sx_radix_node* n, void* ff)
 	};
 checkSon:
 	if(n->son)
-		bgpq3_print_openbgpd_prefix(n->son, ff);
+		bgpq3_print_openbgpd_prefix(sx_radix_son(n), ff);
 };
 
 int
 bgpq3_print_openbgpd_asset(FILE* f, struct bgpq_expander* b)
 {
-	int i, j, k, nc=0;
+	int nc=0;
+	uint32_t asn;
+	int more;
 
 	fprintf(f, "as-set %s {", b->name?b->name:"NN");
 
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					fprintf(f, "%s%u", nc==0 ? "\n\t" : " ", k*65536+i*8+j);
-					nc++;
-					if(nc==b->aswidth)
-						nc=0;
-				};
-			};
-		};
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		fprintf(f, "%s%u", nc==0 ? "\n\t" : " ", asn);
+		nc++;
+		if(nc==b->aswidth)
+			nc=0;
 	};
 	fprintf(f, "\n}\n");
 	return 0;
@@ -870,20 +1271,17 @@ bgpq3_print_openbgpd_asset(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_openbgpd_aspath(FILE* f, struct bgpq_expander* b)
 {
-	int i, j, k, lineNo=0;
-
-	for(k=0;k<65536;k++) {
-		if(!b->asn32s[k]) continue;
-
-		for(i=0;i<8192;i++) {
-			for(j=0;j<8;j++) {
-				if(b->asn32s[k][i]&(0x80>>j)) {
-					fprintf(f, "allow from AS %u AS %u\n", b->asnumber,
-						k*65536+i*8+j);
-					lineNo++;
-				};
-			};
-		};
+	int lineNo=0;
+	uint32_t asn, last;
+	int more;
+
+	BGPQ_ASN_FOREACH(asn, more, b) {
+		last=bgpq3_asn_range(b, asn, 0);
+		fprintf(f, "allow from AS %u AS ", b->asnumber);
+		bgpq3_fprint_asrange(f, asn, last, " - ");
+		fprintf(f, "\n");
+		asn=last;
+		lineNo++;
 	};
 	if(!lineNo)
 		fprintf(f, "deny from AS %u\n", b->asnumber);
@@ -916,7 +1314,7 @@ bgpq3_print_jrfilter(struct sx_radix_node* n, void* ff)
 	};
 checkSon:
 	if(n->son)
-		bgpq3_print_jrfilter(n->son, ff);
+		bgpq3_print_jrfilter(sx_radix_son(n), ff);
 };
 		
 
@@ -950,7 +1348,7 @@ bgpq3_print_cprefix(struct sx_radix_node* n, void* ff)
 	};
 checkSon:
 	if(n->son)
-		bgpq3_print_cprefix(n->son,ff);
+		bgpq3_print_cprefix(sx_radix_son(n),ff);
 };
 
 void
@@ -976,7 +1374,7 @@ bgpq3_print_cprefixxr(struct sx_radix_node* n, void* ff)
 	needscomma=1;
 checkSon:
 	if(n->son)
-		bgpq3_print_cprefixxr(n->son,ff);
+		bgpq3_print_cprefixxr(sx_radix_son(n),ff);
 };
 
 void
@@ -1005,7 +1403,7 @@ bgpq3_print_hprefix(struct sx_radix_node* n, void* ff)
 	};
 checkSon:
 	if(n->son)
-		bgpq3_print_hprefix(n->son,ff);
+		bgpq3_print_hprefix(sx_radix_son(n),ff);
 };
 
 
@@ -1071,7 +1469,7 @@ bgpq3_print_ceacl(struct sx_radix_node* n, void* ff)
 	};
 checkSon:
 	if(n->son)
-		bgpq3_print_ceacl(n->son,ff);
+		bgpq3_print_ceacl(sx_radix_son(n),ff);
 };
 
 void
@@ -1085,7 +1483,7 @@ bgpq3_print_nokia_ipfilter(struct sx_radix_node* n, void* ff)
 	fprintf(f,"    prefix %s\n", prefix);
 checkSon:
 	if(n->son)
-		bgpq3_print_nokia_ipfilter(n->son, ff);
+		bgpq3_print_nokia_ipfilter(sx_radix_son(n), ff);
 };
 
 void
@@ -1099,7 +1497,7 @@ bgpq3_print_nokia_md_ipfilter(struct sx_radix_node* n, void* ff)
 	fprintf(f,"    prefix %s { }\n", prefix);
 checkSon:
 	if(n->son)
-		bgpq3_print_nokia_md_ipfilter(n->son, ff);
+		bgpq3_print_nokia_md_ipfilter(sx_radix_son(n), ff);
 };
 
 void
@@ -1123,7 +1521,7 @@ bgpq3_print_nokia_prefix(struct sx_radix_node* n, void* ff)
 	};
 checkSon:
 	if(n->son)
-		bgpq3_print_nokia_prefix(n->son, ff);
+		bgpq3_print_nokia_prefix(sx_radix_son(n), ff);
 
 };
 
@@ -1150,18 +1548,22 @@ bgpq3_print_nokia_md_prefix(struct sx_radix_node* n, void* ff)
 	};
 checkSon:
 	if(n->son)
-		bgpq3_print_nokia_md_prefix(n->son, ff);
+		bgpq3_print_nokia_md_prefix(sx_radix_son(n), ff);
 
 };
 
 int
 bgpq3_print_juniper_prefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	fprintf(f,"policy-options {\nreplace:\n prefix-list %s {\n",
 		b->name?b->name:"NN");
-	sx_radix_tree_foreach(b->tree,bgpq3_print_jprefix,f);
+	SX_RADIX_FOREACH(n, &cur, b->tree)
+		bgpq3_print_jprefix(n, f);
 	if (b->treex)
-		sx_radix_tree_foreach(b->treex, bgpq3_print_jprefix, f);
+		SX_RADIX_FOREACH(n, &cur, b->treex)
+			bgpq3_print_jprefix(n, f);
 	fprintf(f," }\n}\n");
 	return 0;
 };
@@ -1169,11 +1571,12 @@ bgpq3_print_juniper_prefixlist(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_juniper_routefilter(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	char* c=NULL;
 	if(b->name && (c=strchr(b->name,'/'))) {
-		*c=0;
-		fprintf(f,"policy-options {\n policy-statement %s {\n  term %s {\n"
-			"replace:\n   from {\n", b->name, c+1);
+		fprintf(f,"policy-options {\n policy-statement %.*s {\n  term %s {\n"
+			"replace:\n   from {\n", (int)(c-b->name), b->name, c+1);
 		if(b->match)
 			fprintf(f,"    %s;\n",b->match);
 	} else {
@@ -1185,9 +1588,11 @@ bgpq3_print_juniper_routefilter(FILE* f, struct bgpq_expander* b)
 	if(!sx_radix_tree_empty(b->tree) || (b->treex &&
 		!sx_radix_tree_empty(b->treex))) {
 		jrfilter_prefixed=1;
-		sx_radix_tree_foreach(b->tree,bgpq3_print_jrfilter,f);
+		SX_RADIX_FOREACH(n, &cur, b->tree)
+			bgpq3_print_jrfilter(n, f);
 		if (b->treex)
-			sx_radix_tree_foreach(b->treex, bgpq3_print_jrfilter, f);
+			SX_RADIX_FOREACH(n, &cur, b->treex)
+				bgpq3_print_jrfilter(n, f);
 	} else {
 		fprintf(f,"    route-filter %s/0 orlonger reject;\n",
 			b->tree->family == AF_INET ? "0.0.0.0" : "::");
@@ -1205,6 +1610,8 @@ bgpq3_print_juniper_routefilter(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_openbgpd_prefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	bname=b->name ? b->name : "NN";
 	if (sx_radix_tree_empty(b->tree)) {
 		fprintf(f, "# generated prefix-list %s (AS %u) is empty\n", bname,
@@ -1220,7 +1627,8 @@ bgpq3_print_openbgpd_prefixlist(FILE* f, struct bgpq_expander* b)
 			}
 		}
 		fprintf(f,"prefix { ");
-		sx_radix_tree_foreach(b->tree,bgpq3_print_openbgpd_prefix,f);
+		SX_RADIX_FOREACH(n, &cur, b->tree)
+			bgpq3_print_openbgpd_prefix(n, f);
 		fprintf(f, "\n\t}");
 		if(b->name){
 			if(strcmp(b->name, "NN") != 0) {
@@ -1237,10 +1645,13 @@ bgpq3_print_openbgpd_prefixlist(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_openbgpd_prefixset(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	bname=b->name ? b->name : "NN";
 	fprintf(f,"prefix-set %s {", b->name);
 	if (!sx_radix_tree_empty(b->tree))
-		sx_radix_tree_foreach(b->tree,bgpq3_print_openbgpd_prefix,f);
+		SX_RADIX_FOREACH(n, &cur, b->tree)
+			bgpq3_print_openbgpd_prefix(n, f);
 	fprintf(f, "\n}\n");
 	return 0;
 };
@@ -1248,12 +1659,15 @@ bgpq3_print_openbgpd_prefixset(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_cisco_prefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	bname=b->name ? b->name : "NN";
 	seq=b->sequence;
 	fprintf(f,"no %s prefix-list %s\n",
 		(b->family==AF_INET)?"ip":"ipv6",bname);
 	if (!sx_radix_tree_empty(b->tree)) {
-		sx_radix_tree_foreach(b->tree,bgpq3_print_cprefix,f);
+		SX_RADIX_FOREACH(n, &cur, b->tree)
+			bgpq3_print_cprefix(n, f);
 	} else {
 		char seqno[16] = "";
 		if(b->sequence) {
@@ -1270,9 +1684,13 @@ bgpq3_print_cisco_prefixlist(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_ciscoxr_prefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	bname=b->name ? b->name : "NN";
+	needscomma=0;
 	fprintf(f,"no prefix-set %s\nprefix-set %s\n", bname, bname);
-	sx_radix_tree_foreach(b->tree,bgpq3_print_cprefixxr,f);
+	SX_RADIX_FOREACH(n, &cur, b->tree)
+		bgpq3_print_cprefixxr(n, f);
 	fprintf(f, "\nend-set\n");
 	return 0;
 };
@@ -1280,11 +1698,16 @@ bgpq3_print_ciscoxr_prefixlist(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_json_prefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
+	needscomma=0;
 	fprintf(f,"{ \"%s\": [",
 		b->name?b->name:"NN");
-	sx_radix_tree_foreach(b->tree,bgpq3_print_json_prefix,f);
+	SX_RADIX_FOREACH(n, &cur, b->tree)
+		bgpq3_print_json_prefix(n, f);
 	if (b->treex)
-		sx_radix_tree_foreach(b->treex, bgpq3_print_json_prefix, f);
+		SX_RADIX_FOREACH(n, &cur, b->treex)
+			bgpq3_print_json_prefix(n, f);
 	fprintf(f,"\n] }\n");
 	return 0;
 };
@@ -1292,10 +1715,14 @@ bgpq3_print_json_prefixlist(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_bird_prefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
+	needscomma=0;
 	if (!sx_radix_tree_empty(b->tree)) {
 		fprintf(f,"%s = [",
 			b->name?b->name:"NN");
-		sx_radix_tree_foreach(b->tree,bgpq3_print_bird_prefix,f);
+		SX_RADIX_FOREACH(n, &cur, b->tree)
+			bgpq3_print_bird_prefix(n, f);
 		fprintf(f,"\n];\n");
 	} else {
 		SX_DEBUG(debug_expander, "skip empty prefix-list in BIRD format\n");
@@ -1306,12 +1733,15 @@ bgpq3_print_bird_prefixlist(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_huawei_prefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	bname=b->name ? b->name : "NN";
 	seq=b->sequence;
 	fprintf(f,"undo ip %s-prefix %s\n",
 		(b->family==AF_INET)?"ip":"ipv6",bname);
 	if (!sx_radix_tree_empty(b->tree)) {
-		sx_radix_tree_foreach(b->tree,bgpq3_print_hprefix,f);
+		SX_RADIX_FOREACH(n, &cur, b->tree)
+			bgpq3_print_hprefix(n, f);
 	} else {
 		fprintf(f, "ip %s-prefix %s deny %s\n",
 			(b->family==AF_INET) ? "ip" : "ipv6", bname,
@@ -1346,10 +1776,14 @@ bgpq3_print_format_prefix(struct sx_radix_node* n, void* ff)
 int
 bgpq3_print_format_prefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	struct fpcbdata ff = {.f=f, .b=b};
-	sx_radix_tree_foreach(b->tree,bgpq3_print_format_prefix,&ff);
+	SX_RADIX_FOREACH(n, &cur, b->tree)
+		bgpq3_print_format_prefix(n, &ff);
 	if (b->treex)
-		sx_radix_tree_foreach(b->treex, bgpq3_print_format_prefix, &ff);
+		SX_RADIX_FOREACH(n, &cur, b->treex)
+			bgpq3_print_format_prefix(n, &ff);
 	if (strcmp(b->format+strlen(b->format-2), "\n"))
 		fprintf(f, "\n");
 	return 0;
@@ -1358,11 +1792,14 @@ bgpq3_print_format_prefixlist(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_nokia_prefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	bname=b->name ? b->name : "NN";
 	fprintf(f,"configure router policy-options\nbegin\nno prefix-list \"%s\"\n",
 		bname);
 	fprintf(f,"prefix-list \"%s\"\n", bname);
-	sx_radix_tree_foreach(b->tree,bgpq3_print_nokia_prefix,f);
+	SX_RADIX_FOREACH(n, &cur, b->tree)
+		bgpq3_print_nokia_prefix(n, f);
 	fprintf(f,"exit\ncommit\n");
 	return 0;
 };
@@ -1370,11 +1807,14 @@ bgpq3_print_nokia_prefixlist(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_cisco_eacl(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	bname=b->name ? b->name : "NN";
 	fprintf(f,"no ip access-list extended %s\n", bname);
 	if (!sx_radix_tree_empty(b->tree)) {
 		fprintf(f,"ip access-list extended %s\n", bname);
-		sx_radix_tree_foreach(b->tree,bgpq3_print_ceacl,f);
+		SX_RADIX_FOREACH(n, &cur, b->tree)
+			bgpq3_print_ceacl(n, f);
 	} else {
 		fprintf(f,"! generated access-list %s is empty\n", bname);
 		fprintf(f,"ip access-list extended %s deny any any\n", bname);
@@ -1385,12 +1825,15 @@ bgpq3_print_cisco_eacl(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_nokia_ipprefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	bname=b->name ? b->name : "NN";
 	fprintf(f,"configure filter match-list\nno %s-prefix-list \"%s\"\n",
 		 b->tree->family==AF_INET?"ip":"ipv6", bname);
 	fprintf(f,"%s-prefix-list \"%s\" create\n", b->tree->family==AF_INET?"ip":"ipv6", bname);
 	if (!sx_radix_tree_empty(b->tree)) {
-		sx_radix_tree_foreach(b->tree,bgpq3_print_nokia_ipfilter,f);
+		SX_RADIX_FOREACH(n, &cur, b->tree)
+			bgpq3_print_nokia_ipfilter(n, f);
 	} else {
 		fprintf(f,"# generated ip-prefix-list %s is empty\n", bname);
 	};
@@ -1401,13 +1844,16 @@ bgpq3_print_nokia_ipprefixlist(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_nokia_md_prefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	bname=b->name ? b->name : "NN";
 	fprintf(f,"/configure filter match-list\ndelete %s-prefix-list \"%s\"\n",
 		 b->tree->family==AF_INET?"ip":"ipv6", bname);
 	fprintf(f,"%s-prefix-list \"%s\" {\n", b->tree->family==AF_INET?"ip":"ipv6",
 		bname);
 	if (!sx_radix_tree_empty(b->tree)) {
-		sx_radix_tree_foreach(b->tree,bgpq3_print_nokia_md_ipfilter,f);
+		SX_RADIX_FOREACH(n, &cur, b->tree)
+			bgpq3_print_nokia_md_ipfilter(n, f);
 	} else {
 		fprintf(f,"# generated %s-prefix-list %s is empty\n",
 			b->tree->family==AF_INET?"ip":"ipv6", bname);
@@ -1419,11 +1865,14 @@ bgpq3_print_nokia_md_prefixlist(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_nokia_md_ipprefixlist(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	bname=b->name ? b->name : "NN";
 	fprintf(f,"/configure policy-options\ndelete prefix-list \"%s\"\n", bname);
 	fprintf(f,"prefix-list \"%s\" {\n", bname);
 	if (!sx_radix_tree_empty(b->tree)) {
-		sx_radix_tree_foreach(b->tree,bgpq3_print_nokia_md_prefix,f);
+		SX_RADIX_FOREACH(n, &cur, b->tree)
+			bgpq3_print_nokia_md_prefix(n, f);
 	};
 	fprintf(f,"}\n");
 	return 0;
@@ -1468,6 +1917,8 @@ bgpq3_print_eacl(FILE* f, struct bgpq_expander* b)
 int
 bgpq3_print_juniper_route_filter_list(FILE* f, struct bgpq_expander* b)
 {
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
 	fprintf(f, "policy-options {\nreplace:\n  route-filter-list %s {\n",
 		b->name?b->name:"NN");
 	if (sx_radix_tree_empty(b->tree) && (!b->treex ||
@@ -1478,9 +1929,11 @@ bgpq3_print_juniper_route_filter_list(FILE* f, struct bgpq_expander* b)
 			fprintf(f, "    ::/0 orlonger reject;\n");
 	} else {
 		jrfilter_prefixed=0;
-		sx_radix_tree_foreach(b->tree, bgpq3_print_jrfilter, f);
+		SX_RADIX_FOREACH(n, &cur, b->tree)
+			bgpq3_print_jrfilter(n, f);
 		if (b->treex)
-			sx_radix_tree_foreach(b->treex, bgpq3_print_jrfilter, f);
+			SX_RADIX_FOREACH(n, &cur, b->treex)
+				bgpq3_print_jrfilter(n, f);
 	};
 	fprintf(f, "  }\n}\n");
 	return 0;
@@ -1495,3 +1948,125 @@ bgpq3_print_route_filter_list(FILE* f, struct bgpq_expander* b)
 	};
 	return 0;
 };
+
+/* changes against the previous run (-i), in the vendor's own syntax for
+ * adding and removing single entries */
+static void
+bgpq3_entry_node(struct bgpq_entry* e, struct sx_radix_node* n)
+{
+	memset(n, 0, sizeof(struct sx_radix_node));
+	n->prefix=e->prefix;
+	if(e->lo!=e->prefix.masklen || e->hi!=e->prefix.masklen) {
+		n->isAggregate=1;
+		n->aggregateLow=e->lo;
+		n->aggregateHi=e->hi;
+	};
+};
+
+static int
+bgpq3_print_cisco_delta(FILE* f, struct bgpq_expander* b,
+	struct bgpq_entry* removed, int nremoved, struct bgpq_entry* added,
+	int nadded)
+{
+	struct sx_radix_node n;
+	int i;
+	bname=b->name ? b->name : "NN";
+	seq=0;
+	for(i=0; i<nremoved; i++) {
+		bgpq3_entry_node(removed+i, &n);
+		fprintf(f, "no ");
+		bgpq3_print_cprefix(&n, f);
+	};
+	for(i=0; i<nadded; i++) {
+		bgpq3_entry_node(added+i, &n);
+		bgpq3_print_cprefix(&n, f);
+	};
+	return 0;
+};
+
+static void
+bgpq3_print_jdelta(FILE* f, const char* op, const char* path,
+	struct bgpq_entry* e, int exact)
+{
+	char prefix[128];
+	sx_prefix_snprintf(&e->prefix, prefix, sizeof(prefix));
+	if(!exact) {
+		fprintf(f, "%s %s %s\n", op, path, prefix);
+	} else if(e->lo==e->prefix.masklen && e->hi==e->prefix.masklen) {
+		fprintf(f, "%s %s %s exact\n", op, path, prefix);
+	} else if(e->lo>e->prefix.masklen) {
+		fprintf(f, "%s %s %s prefix-length-range /%u-/%u\n", op, path,
+			prefix, e->lo, e->hi);
+	} else {
+		fprintf(f, "%s %s %s upto /%u\n", op, path, prefix, e->hi);
+	};
+};
+
+static int
+bgpq3_print_juniper_delta(FILE* f, struct bgpq_expander* b,
+	struct bgpq_entry* removed, int nremoved, struct bgpq_entry* added,
+	int nadded)
+{
+	char path[256];
+	char* name=b->name?b->name:"NN", *c=strchr(name, '/');
+	int i, exact=1;
+
+	if(b->generation==T_PREFIXLIST) {
+		snprintf(path, sizeof(path), "policy-options prefix-list %s", name);
+		exact=0;
+	} else if(b->generation==T_ROUTE_FILTER_LIST) {
+		snprintf(path, sizeof(path), "policy-options route-filter-list %s",
+			name);
+	} else if(c) {
+		snprintf(path, sizeof(path), "policy-options policy-statement %.*s "
+			"term %s from route-filter", (int)(c-name), name, c+1);
+	} else {
+		snprintf(path, sizeof(path), "policy-options policy-statement %s "
+			"from route-filter", name);
+	};
+	for(i=0; i<nremoved; i++)
+		bgpq3_print_jdelta(f, "delete", path, removed+i, exact);
+	for(i=0; i<nadded; i++)
+		bgpq3_print_jdelta(f, "set", path, added+i, exact);
+	return 0;
+};
+
+static int
+bgpq3_print_json_delta(FILE* f, struct bgpq_expander* b,
+	struct bgpq_entry* removed, int nremoved, struct bgpq_entry* added,
+	int nadded)
+{
+	struct sx_radix_node n;
+	int i;
+	fprintf(f, "{ \"%s\": {\n  \"removed\": [", b->name?b->name:"NN");
+	needscomma=0;
+	for(i=0; i<nremoved; i++) {
+		bgpq3_entry_node(removed+i, &n);
+		bgpq3_print_json_prefix(&n, f);
+	};
+	fprintf(f, "\n  ],\n  \"added\": [");
+	needscomma=0;
+	for(i=0; i<nadded; i++) {
+		bgpq3_entry_node(added+i, &n);
+		bgpq3_print_json_prefix(&n, f);
+	};
+	fprintf(f, "\n  ]\n} }\n");
+	return 0;
+};
+
+int
+bgpq3_print_prefixlist_delta(FILE* f, struct bgpq_expander* b,
+	struct bgpq_entry* removed, int nremoved, struct bgpq_entry* added,
+	int nadded)
+{
+	switch(b->vendor) {
+		case V_CISCO: return bgpq3_print_cisco_delta(f, b, removed, nremoved,
+			added, nadded);
+		case V_JUNIPER: return bgpq3_print_juniper_delta(f, b, removed,
+			nremoved, added, nadded);
+		case V_JSON: return bgpq3_print_json_delta(f, b, removed, nremoved,
+			added, nadded);
+		default: sx_report(SX_FATAL, "unreachable point\n");
+	};
+	return 0;
+};
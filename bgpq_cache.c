@@ -0,0 +1,245 @@
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "bgpq3.h"
+#include "sx_report.h"
+
+extern int debug_expander;
+
+/* Cache file keeps one as-set per line:
+ *   <as-set> <source> <serial> [<member> ...]
+ * Set is reused as long as IRRd reports the same serial for its source. */
+
+static struct bgpq_cached*
+bgpq_cache_entry(struct bgpq_expander* b, char* name)
+{
+	struct sx_tentry* te=sx_tset_insert(&b->cached, name);
+	if(!te) {
+		sx_report(SX_FATAL, "Unable to cache %s: %s\n", name,
+			strerror(errno));
+		exit(1);
+	};
+	if(!te->data) {
+		struct bgpq_cached* c=sx_arena_alloc(&b->arena,
+			sizeof(struct bgpq_cached));
+		if(!c) {
+			sx_report(SX_FATAL, "Unable to cache %s: %s\n", name,
+				strerror(errno));
+			exit(1);
+		};
+		memset(c, 0, sizeof(struct bgpq_cached));
+		STAILQ_INIT(&c->members);
+		te->data=c;
+	};
+	return te->data;
+};
+
+void
+bgpq_cache_add_member(struct bgpq_expander* b, struct bgpq_cached* c,
+	char* name)
+{
+	struct sx_slentry* le=sx_slentry_arena_new(&b->arena, name);
+	if(!le) {
+		sx_report(SX_FATAL, "Unable to cache %s: %s\n", name,
+			strerror(errno));
+		exit(1);
+	};
+	STAILQ_INSERT_TAIL(&c->members, le, next);
+};
+
+/* serials are numbers, anything else cannot tell changes */
+static int
+bgpq_cache_serial_valid(const char* serial)
+{
+	return *serial && !serial[strspn(serial, "0123456789")];
+};
+
+int
+bgpq_cache_load(struct bgpq_expander* b)
+{
+	FILE* f=fopen(b->cache, "r");
+	char* line=NULL, *name, *source, *serial, *member;
+	size_t size=0;
+	unsigned lineno=0;
+	struct bgpq_cached* c;
+
+	if(!f) {
+		if(errno!=ENOENT)
+			sx_report(SX_ERROR, "Unable to open cache %s: %s\n", b->cache,
+				strerror(errno));
+		return 0;
+	};
+	while(getline(&line, &size, f)>0) {
+		lineno++;
+		if(!(name=strtok(line, " \t\n")))
+			continue;
+		if(!(source=strtok(NULL, " \t\n")) || !(serial=strtok(NULL, " \t\n")) ||
+			!bgpq_cache_serial_valid(serial)) {
+			sx_report(SX_ERROR, "Invalid line %u in cache %s, ignored\n",
+				lineno, b->cache);
+			continue;
+		};
+		c=bgpq_cache_entry(b, name);
+		c->source=sx_arena_strdup(&b->arena, source);
+		c->serial=sx_arena_strdup(&b->arena, serial);
+		STAILQ_INIT(&c->members);
+		while((member=strtok(NULL, " \t\n")))
+			bgpq_cache_add_member(b, c, member);
+	};
+	free(line);
+	fclose(f);
+	SX_DEBUG(debug_expander, "loaded %u as-sets from cache %s\n",
+		b->cached.count, b->cache);
+	return 1;
+};
+
+/* opens a new file of a unique name next to file, to be renamed over it
+ * once written, so concurrent runs never write into the same one. The
+ * name goes to tmp. */
+FILE*
+bgpq_tmpfile(const char* file, char* tmp, size_t size)
+{
+	mode_t mask;
+	FILE* f;
+	int fd;
+
+	if((size_t)snprintf(tmp, size, "%s.XXXXXX", file)>=size) {
+		errno=ENAMETOOLONG;
+		return NULL;
+	};
+	if((fd=mkstemp(tmp))==-1)
+		return NULL;
+	/* as fopen would have created it */
+	mask=umask(0);
+	umask(mask);
+	fchmod(fd, 0666&~mask);
+	if(!(f=fdopen(fd, "w"))) {
+		close(fd);
+		unlink(tmp);
+	};
+	return f;
+};
+
+int
+bgpq_cache_save(struct bgpq_expander* b)
+{
+	char tmp[PATH_MAX];
+	unsigned i;
+	FILE* f;
+	struct sx_slentry* m;
+
+	if(!(f=bgpq_tmpfile(b->cache, tmp, sizeof(tmp)))) {
+		sx_report(SX_ERROR, "Unable to write cache %s: %s\n", b->cache,
+			strerror(errno));
+		return 0;
+	};
+	for(i=0;i<b->cached.size;i++) {
+		struct sx_tentry* te=b->cached.slots+i;
+		struct bgpq_cached* c=te->data;
+		if(!te->text || !c->source || !c->serial)
+			continue;
+		fprintf(f, "%s %s %s", te->text, c->source, c->serial);
+		STAILQ_FOREACH(m, &c->members, next)
+			fprintf(f, " %s", m->text);
+		fprintf(f, "\n");
+	};
+	if(fclose(f) || rename(tmp, b->cache)) {
+		sx_report(SX_ERROR, "Unable to write cache %s: %s\n", b->cache,
+			strerror(errno));
+		unlink(tmp);
+		return 0;
+	};
+	return 1;
+};
+
+/* "!j-*" reply, one token per source: SOURCE:MIRRORABLE:OLDEST-NEWEST */
+int
+bgpq_cache_serial(char* token, struct bgpq_expander* b,
+	struct bgpq_request* req __attribute__((unused)))
+{
+	char* c=strchr(token, ':'), *serial;
+	struct sx_tentry* te;
+	if(!c || !(serial=strchr(c+1, ':')) || !(serial=strchr(serial, '-')))
+		return 0;
+	*c=0;
+	serial++;
+	serial[strcspn(serial, ":")]=0;
+	if(!bgpq_cache_serial_valid(serial)) {
+		/* nothing to tell changes by: sets of this source are neither
+		 * reused nor cached */
+		SX_DEBUG(debug_expander, "source %s has no valid serial\n", token);
+		return 1;
+	};
+	if(!(te=sx_tset_insert(&b->serials, token)) ||
+		!(te->data=sx_arena_strdup(&b->arena, serial))) {
+		sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+			strerror(errno));
+		exit(1);
+	};
+	SX_DEBUG(debug_expander, "source %s serial %s\n", token, serial);
+	return 1;
+};
+
+/* "!mas-set," reply: object text, only its source: attribute matters,
+ * the first one starting a line */
+int
+bgpq_cache_source(char* token, struct bgpq_expander* b,
+	struct bgpq_request* req)
+{
+	struct bgpq_cached* c=req->udata;
+	struct sx_tentry* te;
+	if(!*token || isspace((unsigned char)*token))
+		return 0;
+	if(c->source)
+		return 1;
+	if(req->linestart && !strcasecmp(token, "source:")) {
+		c->sourcenext=1;
+		return 1;
+	};
+	if(!c->sourcenext)
+		return 1;
+	c->sourcenext=0;
+	c->source=sx_arena_strdup(&b->arena, token);
+	c->serial=NULL;
+	if((te=sx_tset_find(&b->serials, token, sx_tset_hash(token))))
+		c->serial=te->data;
+	return 1;
+};
+
+/* feeds members of an unchanged cached set straight into the expansion.
+ * Returns 0 when the set has to be queried, *entry then collects the
+ * fresh reply. */
+int
+bgpq_cache_expand(struct bgpq_expander* b, char* name,
+	struct bgpq_cached** entry)
+{
+	struct bgpq_cached* c=bgpq_cache_entry(b, name);
+	struct sx_tentry* te;
+	struct sx_slentry* m;
+
+	if(c->source && c->serial && (te=sx_tset_find(&b->serials, c->source,
+		sx_tset_hash(c->source))) && !strcmp(te->data, c->serial)) {
+		SX_DEBUG(debug_expander, "%s unchanged in %s at serial %s, cached\n",
+			name, c->source, c->serial);
+		STAILQ_FOREACH(m, &c->members, next)
+			bgpq_expanded_macro_limit(m->text, b, NULL);
+		return 1;
+	};
+	c->source=c->serial=NULL;
+	STAILQ_INIT(&c->members);
+	*entry=c;
+	return 0;
+};
@@ -0,0 +1,449 @@
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bgpq3.h"
+#include "sx_report.h"
+
+/* Route check (-k): announced prefixes, one per line (anything after the
+ * first word is ignored, so most route dumps do), are matched against the
+ * trees exactly as they would be printed and reported as
+ *   <prefix> exact
+ *   <prefix> range <entry>^<low>-<high>
+ *   <prefix> rejected
+ * Lines are parsed in place and looked up in batches.
+ *
+ * MRT TABLE_DUMP_V2 files (RFC 6396, RFC 8050 add-path) are recognized by
+ * their first record and mapped instead. Every RIB entry is counted
+ * against its peer, only rejected ones are listed:
+ *   <prefix> rejected peer <address> AS<peer-as> origin AS<origin>[ member]
+ * member meaning the origin is in the expanded AS set, followed by
+ *   peer <address> AS<peer-as>: <n> accepted, <n> rejected (<n> member)
+ * for each peer that has entries. */
+
+#define BGPQ_CHECK_BUFSIZE (1024*1024)
+#define BGPQ_CHECK_BATCH   1024
+
+#define MRT_TABLE_DUMP_V2            13
+#define MRT_PEER_INDEX_TABLE         1
+#define MRT_RIB_IPV4_UNICAST         2
+#define MRT_RIB_IPV6_UNICAST         4
+#define MRT_RIB_IPV4_UNICAST_ADDPATH 8
+#define MRT_RIB_IPV6_UNICAST_ADDPATH 10
+
+struct bgpq_mrt_peer {
+	uint32_t as;
+	char addr[INET6_ADDRSTRLEN];
+	unsigned long accepted, rejected, member;
+};
+
+struct bgpq_check {
+	FILE* f;
+	struct bgpq_expander* b;
+	struct sx_prefix p[BGPQ_CHECK_BATCH];
+	struct sx_radix_node* found[BGPQ_CHECK_BATCH];
+	const char* text[BGPQ_CHECK_BATCH];
+	int len[BGPQ_CHECK_BATCH];
+	int n;
+	unsigned long exact, range, rejected, invalid;
+	/* MRT: entries of each batched RIB record, straight from the map */
+	const unsigned char* rib[BGPQ_CHECK_BATCH], *ribend[BGPQ_CHECK_BATCH];
+	int addpath[BGPQ_CHECK_BATCH];
+	struct bgpq_mrt_peer* peers;
+	int npeers;
+};
+
+static void
+bgpq_check_match(struct bgpq_check* c)
+{
+	int i;
+	sx_radix_tree_match_batch(c->b->tree, c->p, c->n, c->found);
+	if(!c->b->treex)
+		return;
+	for(i=0; i<c->n; i++) {
+		if(!c->found[i] && c->p[i].family==AF_INET6)
+			c->found[i]=sx_radix_tree_match(c->b->treex, &c->p[i]);
+	};
+};
+
+static void
+bgpq_check_flush(struct bgpq_check* c)
+{
+	struct sx_radix_node* e;
+	char entry[128];
+	int i;
+
+	bgpq_check_match(c);
+	for(i=0; i<c->n; i++) {
+		e=c->found[i];
+		fwrite(c->text[i], 1, c->len[i], c->f);
+		if(!e) {
+			fputs(" rejected\n", c->f);
+			c->rejected++;
+		} else if(e->prefix.masklen==c->p[i].masklen) {
+			fputs(" exact\n", c->f);
+			c->exact++;
+		} else {
+			sx_prefix_snprintf(&e->prefix, entry, sizeof(entry));
+			fprintf(c->f, " range %s^%u-%u\n", entry, e->aggregateLow,
+				e->aggregateHi);
+			c->range++;
+		};
+	};
+	c->n=0;
+};
+
+/* parses complete lines of buf[0..len), returns bytes consumed */
+static size_t
+bgpq_check_lines(struct bgpq_check* c, const char* buf, size_t len)
+{
+	const char* s=buf, *end=buf+len, *eol, *w;
+
+	while(s<end && (eol=memchr(s, '\n', end-s))) {
+		while(s<eol && isspace((unsigned char)*s))
+			s++;
+		for(w=s; w<eol && !isspace((unsigned char)*w); w++);
+		if(w>s && *s!='#') {
+			if(sx_prefix_parsen(&c->p[c->n], 0, s, w-s)) {
+				c->text[c->n]=s;
+				c->len[c->n]=w-s;
+				if(++c->n==BGPQ_CHECK_BATCH)
+					bgpq_check_flush(c);
+			} else {
+				c->invalid++;
+			};
+		};
+		s=eol+1;
+	};
+	/* lines in the batch point into buf, which is about to be reused */
+	if(c->n)
+		bgpq_check_flush(c);
+	return s-buf;
+};
+
+static void
+bgpq_check_text(struct bgpq_check* c, int fd, char* filename)
+{
+	char* buf, *eol;
+	size_t have=0, used;
+	ssize_t got;
+	int skip=0;
+
+	if(!(buf=malloc(BGPQ_CHECK_BUFSIZE+1))) {
+		sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+			strerror(errno));
+		exit(1);
+	};
+	for(;;) {
+		got=read(fd, buf+have, BGPQ_CHECK_BUFSIZE-have);
+		if(got==-1) {
+			if(errno==EINTR)
+				continue;
+			sx_report(SX_FATAL, "Unable to read %s: %s\n", filename,
+				strerror(errno));
+			exit(1);
+		};
+		if(got==0) {
+			if(have) {
+				/* last line without newline */
+				buf[have++]='\n';
+				bgpq_check_lines(c, buf, have);
+			};
+			break;
+		};
+		have+=got;
+		if(skip) {
+			if(!(eol=memchr(buf, '\n', have))) {
+				have=0;
+				continue;
+			};
+			used=eol+1-buf;
+			memmove(buf, buf+used, have-used);
+			have-=used;
+			skip=0;
+		};
+		used=bgpq_check_lines(c, buf, have);
+		if(used==0 && have==BGPQ_CHECK_BUFSIZE) {
+			sx_report(SX_ERROR, "Line too long in %s, skipped\n", filename);
+			c->invalid++;
+			have=0;
+			skip=1;
+			continue;
+		};
+		memmove(buf, buf+used, have-used);
+		have-=used;
+	};
+	free(buf);
+};
+
+static inline uint32_t
+bgpq_mrt_get16(const unsigned char* p)
+{
+	return (p[0]<<8)|p[1];
+};
+
+static inline uint32_t
+bgpq_mrt_get32(const unsigned char* p)
+{
+	return ((uint32_t)p[0]<<24)|(p[1]<<16)|(p[2]<<8)|p[3];
+};
+
+static int
+bgpq_mrt_peers(struct bgpq_check* c, const unsigned char* p,
+	const unsigned char* end)
+{
+	struct sx_prefix a;
+	int i, type, alen;
+
+	if(end-p<6 || end-p<6+(int)bgpq_mrt_get16(p+4))
+		return 0;
+	p+=6+bgpq_mrt_get16(p+4);	/* collector id, view name */
+	if(end-p<2)
+		return 0;
+	free(c->peers);
+	c->npeers=bgpq_mrt_get16(p);
+	if(!(c->peers=calloc(c->npeers+1, sizeof(struct bgpq_mrt_peer)))) {
+		sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+			strerror(errno));
+		exit(1);
+	};
+	for(p+=2, i=0; i<c->npeers; i++) {
+		if(end-p<1)
+			return 0;
+		type=*p;
+		alen=(type&1)?16:4;
+		if(end-p<1+4+alen+((type&2)?4:2))
+			return 0;
+		memset(&a, 0, sizeof(a));
+		a.family=(type&1)?AF_INET6:AF_INET;
+		a.masklen=alen*8;
+		memcpy(a.addr.addrs, p+5, alen);
+		sx_prefix_ntop(&a, c->peers[i].addr);
+		p+=5+alen;
+		c->peers[i].as=(type&2)?bgpq_mrt_get32(p):bgpq_mrt_get16(p);
+		p+=(type&2)?4:2;
+	};
+	return 1;
+};
+
+/* last AS of the final AS_SEQUENCE, 0 when the path ends with an AS_SET,
+ * peer AS for an empty path. AS numbers are always 4 bytes in MRT. */
+static uint32_t
+bgpq_mrt_origin(const unsigned char* a, const unsigned char* end,
+	uint32_t peeras)
+{
+	const unsigned char* s, *vend;
+	uint32_t origin=peeras, len;
+	int hdr;
+
+	while(end-a>=3) {
+		hdr=(a[0]&0x10)?4:3;
+		if(end-a<hdr)
+			break;
+		len=(hdr==4)?bgpq_mrt_get16(a+2):a[2];
+		if((uint32_t)(end-a-hdr)<len)
+			break;
+		if(a[1]==2) {
+			for(s=a+hdr, vend=s+len; vend-s>=2; s+=2+4*s[1]) {
+				if(vend-s-2<4*s[1])
+					break;
+				if(s[0]==2 && s[1])
+					origin=bgpq_mrt_get32(s+2+4*(s[1]-1));
+				else if(s[0]==1)
+					origin=0;
+			};
+			break;
+		};
+		a+=hdr+len;
+	};
+	return origin;
+};
+
+static void
+bgpq_mrt_flush(struct bgpq_check* c)
+{
+	struct bgpq_mrt_peer* peer;
+	const unsigned char* e, *end;
+	char prefix[128];
+	uint32_t origin, alen;
+	int i, idx, member;
+
+	bgpq_check_match(c);
+	for(i=0; i<c->n; i++) {
+		prefix[0]=0;
+		for(e=c->rib[i], end=c->ribend[i]; end-e>=8+c->addpath[i]*4; ) {
+			idx=bgpq_mrt_get16(e);
+			e+=6+c->addpath[i]*4;	/* peer index, time, path id */
+			alen=bgpq_mrt_get16(e);
+			e+=2;
+			if((uint32_t)(end-e)<alen || idx>=c->npeers) {
+				c->invalid++;
+				break;
+			};
+			peer=&c->peers[idx];
+			if(c->found[i]) {
+				peer->accepted++;
+				if(c->found[i]->prefix.masklen==c->p[i].masklen)
+					c->exact++;
+				else
+					c->range++;
+			} else {
+				origin=bgpq_mrt_origin(e, e+alen, peer->as);
+				member=origin && bgpq_expander_asn_isset(c->b, origin);
+				if(!prefix[0])
+					sx_prefix_snprintf(&c->p[i], prefix, sizeof(prefix));
+				fprintf(c->f, "%s rejected peer %s AS%u origin AS%u%s\n",
+					prefix, peer->addr, peer->as, origin,
+					member?" member":"");
+				peer->rejected++;
+				peer->member+=member;
+				c->rejected++;
+			};
+			e+=alen;
+		};
+	};
+	c->n=0;
+};
+
+static void
+bgpq_check_mrt(struct bgpq_check* c, const unsigned char* map, size_t size)
+{
+	const unsigned char* r=map, *end=map+size, *body, *bend;
+	struct sx_prefix* p;
+	uint32_t type, subtype, len;
+	int i, af, plen;
+
+	while(end-r>=12) {
+		type=bgpq_mrt_get16(r+4);
+		subtype=bgpq_mrt_get16(r+6);
+		len=bgpq_mrt_get32(r+8);
+		body=r+12;
+		if((size_t)(end-body)<len) {
+			sx_report(SX_ERROR, "Truncated MRT record at offset %lu\n",
+				(unsigned long)(r-map));
+			break;
+		};
+		bend=body+len;
+		r=bend;
+		if(type!=MRT_TABLE_DUMP_V2)
+			continue;
+		if(subtype==MRT_PEER_INDEX_TABLE) {
+			if(c->n)
+				bgpq_mrt_flush(c);
+			if(!bgpq_mrt_peers(c, body, bend)) {
+				sx_report(SX_ERROR, "Invalid MRT peer index table\n");
+				break;
+			};
+			continue;
+		};
+		if(subtype==MRT_RIB_IPV4_UNICAST ||
+			subtype==MRT_RIB_IPV4_UNICAST_ADDPATH) {
+			af=AF_INET;
+		} else if(subtype==MRT_RIB_IPV6_UNICAST ||
+			subtype==MRT_RIB_IPV6_UNICAST_ADDPATH) {
+			af=AF_INET6;
+		} else {
+			continue;
+		};
+		/* other address family is not what the filter is about */
+		if(af!=c->b->family && !(af==AF_INET6 && c->b->treex))
+			continue;
+		if(len<5 || (plen=body[4])>(af==AF_INET?32:128) ||
+			len<5+(plen+7)/8+2u) {
+			c->invalid++;
+			continue;
+		};
+		p=&c->p[c->n];
+		memset(p, 0, sizeof(*p));
+		p->family=af;
+		p->masklen=plen;
+		memcpy(p->addr.addrs, body+5, (plen+7)/8);
+		sx_prefix_adjust_masklen(p);
+		/* entry count is implied by the record length */
+		c->rib[c->n]=body+5+(plen+7)/8+2;
+		c->ribend[c->n]=bend;
+		c->addpath[c->n]=(subtype==MRT_RIB_IPV4_UNICAST_ADDPATH ||
+			subtype==MRT_RIB_IPV6_UNICAST_ADDPATH);
+		if(++c->n==BGPQ_CHECK_BATCH)
+			bgpq_mrt_flush(c);
+	};
+	if(c->n)
+		bgpq_mrt_flush(c);
+
+	for(i=0; i<c->npeers; i++) {
+		if(!c->peers[i].accepted && !c->peers[i].rejected)
+			continue;
+		fprintf(c->f, "peer %s AS%u: %lu accepted, %lu rejected (%lu "
+			"member)\n", c->peers[i].addr, c->peers[i].as,
+			c->peers[i].accepted, c->peers[i].rejected, c->peers[i].member);
+	};
+};
+
+/* MRT records start with a timestamp and type, text does not */
+static int
+bgpq_check_is_mrt(const unsigned char* map, size_t size)
+{
+	return size>=12 && bgpq_mrt_get16(map+4)==MRT_TABLE_DUMP_V2 &&
+		bgpq_mrt_get16(map+6)==MRT_PEER_INDEX_TABLE;
+};
+
+int
+bgpq_check_routes(FILE* f, struct bgpq_expander* b, char* filename)
+{
+	struct bgpq_check* c;
+	struct stat st;
+	void* map=MAP_FAILED;
+	int fd;
+
+	if(!strcmp(filename, "-")) {
+		fd=0;
+	} else if((fd=open(filename, O_RDONLY))==-1) {
+		sx_report(SX_FATAL, "Unable to open %s: %s\n", filename,
+			strerror(errno));
+		exit(1);
+	};
+	if(!(c=calloc(1, sizeof(struct bgpq_check)))) {
+		sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+			strerror(errno));
+		exit(1);
+	};
+	c->f=f;
+	c->b=b;
+
+	if(!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size>=12)
+		map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map!=MAP_FAILED && bgpq_check_is_mrt(map, st.st_size)) {
+#ifdef MADV_SEQUENTIAL
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+		bgpq_check_mrt(c, map, st.st_size);
+	} else {
+		bgpq_check_text(c, fd, filename);
+	};
+	if(map!=MAP_FAILED)
+		munmap(map, st.st_size);
+	if(fd)
+		close(fd);
+
+	fflush(f);
+	fprintf(stderr, "%lu exact, %lu in range, %lu rejected", c->exact,
+		c->range, c->rejected);
+	if(c->invalid)
+		fprintf(stderr, ", %lu invalid", c->invalid);
+	fprintf(stderr, "\n");
+	free(c->peers);
+	free(c);
+	return 1;
+};
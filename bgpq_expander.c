@@ -31,13 +31,11 @@ int pipelining=1;
 int expand_as23456=0;
 int expand_special_asn=0;
 
-static inline int
-tentry_cmp(struct sx_tentry* a, struct sx_tentry* b)
-{
-	return strcasecmp(a->text, b->text);
-};
-
-RB_GENERATE(tentree, sx_tentry, entry, tentry_cmp);
+/* longest IRRd query we ever send */
+#define BGPQ_REQUEST_SIZE 128
+/* queries up to this size (all !gas/!6as ones) are kept inside the
+ * request itself, longer ones get their own copy in the arena */
+#define BGPQ_REQUEST_INLINE 32
 
 int
 bgpq_expander_init(struct bgpq_expander* b, int af)
@@ -54,7 +52,7 @@ bgpq_expander_init(struct bgpq_expander* b, int af)
 	b->sources="";
 	b->name="NN";
 	b->aswidth=8;
-	b->asn32s[0]=malloc(8192);
+	b->asn32s[0]=sx_arena_alloc(&b->arena,8192);
 	if(!b->asn32s[0]) {
 		sx_report(SX_FATAL,"Unable to allocate 8192 bytes: %s\n",
 			strerror(errno));
@@ -64,15 +62,20 @@ bgpq_expander_init(struct bgpq_expander* b, int af)
 	b->identify=1;
 	b->server="whois.radb.net";
 	b->port="43";
+	b->already.arena=&b->arena;
+	b->stoplist.arena=&b->arena;
+	b->stopasns.arena=&b->arena;
 
 	STAILQ_INIT(&b->wq);
 	STAILQ_INIT(&b->rq);
+	STAILQ_INIT(&b->freeq);
 	STAILQ_INIT(&b->rsets);
 	STAILQ_INIT(&b->macroses);
+	STAILQ_INIT(&b->levelq);
 
 	return 1;
 fixups:
-	/* if(b->tree) XXXXXXXXXXXXX sx_radix_tree_destroy(b->tree); */
+	if(b->tree) sx_radix_tree_destroy(b->tree);
 	b->tree=NULL;
 	free(b);
 	return 0;
@@ -83,7 +86,7 @@ bgpq_expander_add_asset(struct bgpq_expander* b, char* as)
 {
 	struct sx_slentry* le;
 	if(!b || !as) return 0;
-	le=sx_slentry_new(as);
+	le=sx_slentry_arena_new(&b->arena,as);
 	STAILQ_INSERT_TAIL(&b->macroses, le, next);
 	return 1;
 };
@@ -93,7 +96,7 @@ bgpq_expander_add_rset(struct bgpq_expander* b, char* rs)
 {
 	struct sx_slentry* le;
 	if(!b || !rs) return 0;
-	le=sx_slentry_new(rs);
+	le=sx_slentry_arena_new(&b->arena,rs);
 	if(!le) return 0;
 	STAILQ_INSERT_TAIL(&b->rsets, le, next);
 	return 1;
@@ -102,25 +105,13 @@ bgpq_expander_add_rset(struct bgpq_expander* b, char* rs)
 int
 bgpq_expander_add_already(struct bgpq_expander* b, char* rs)
 {
-	struct sx_tentry* le, lkey;
-	lkey.text = rs;
-	if (RB_FIND(tentree, &b->already, &lkey))
-		return 1;
-	le = sx_tentry_new(rs);
-	RB_INSERT(tentree, &b->already, le);
-	return 1;
+	return sx_tset_add(&b->already, rs);
 };
 
 int
 bgpq_expander_add_stop(struct bgpq_expander* b, char* rs)
 {
-	struct sx_tentry* le, lkey;
-	lkey.text = rs;
-	if (RB_FIND(tentree, &b->stoplist, &lkey))
-		return 1;
-	le = sx_tentry_new(rs);
-	RB_INSERT(tentree, &b->stoplist, le);
-	return 1;
+	return sx_tset_add(&b->stoplist, rs);
 };
 
 int
@@ -165,7 +156,7 @@ bgpq_expander_add_as(struct bgpq_expander* b, char* as)
 				return 0;
 			};
 			if(!b->asn32s[asno]) {
-				b->asn32s[asno]=malloc(8192);
+				b->asn32s[asno]=sx_arena_alloc(&b->arena,8192);
 				if(!b->asn32s[asno]) {
 					sx_report(SX_FATAL, "Unable to allocate 8192 bytes: %s."
 						" Unable to add asn32 %s to future expansion\n",
@@ -197,6 +188,186 @@ bgpq_expander_add_as(struct bgpq_expander* b, char* as)
 	return 1;
 };
 
+/* asn32s pages keep the lowest ASN in the most significant bit of each
+ * byte, so loading 8 bytes big-endian gives a word where clz is offset */
+static inline uint64_t
+bgpq_asn_word(const unsigned char* p)
+{
+	return ((uint64_t)p[0]<<56) | ((uint64_t)p[1]<<48) |
+		((uint64_t)p[2]<<40) | ((uint64_t)p[3]<<32) |
+		((uint64_t)p[4]<<24) | ((uint64_t)p[5]<<16) |
+		((uint64_t)p[6]<<8) | (uint64_t)p[7];
+};
+
+static inline int
+bgpq_asn_block_empty(const unsigned char* p)
+{
+	uint64_t w[8], acc=0;
+	int i;
+	memcpy(w, p, sizeof(w));
+	for(i=0;i<8;i++)
+		acc|=w[i];
+	return acc==0;
+};
+
+int
+bgpq_expander_asn_isset(struct bgpq_expander* b, uint32_t asn)
+{
+	unsigned char* page=b->asn32s[asn>>16];
+	return page && (page[(asn&0xffff)/8]&(0x80>>(asn%8)));
+};
+
+int
+bgpq_expander_asn_find(struct bgpq_expander* b, uint32_t from, uint32_t* asn)
+{
+	uint32_t k, w;
+	uint64_t word=0;
+
+	k=from>>16;
+	w=(from&0xffff)>>6;
+	if(b->asn32s[k])
+		word=bgpq_asn_word(b->asn32s[k]+w*8) & (~0ULL>>(from&63));
+
+	for(;;) {
+		if(word) {
+			*asn=(k<<16)+(w<<6)+__builtin_clzll(word);
+			return 1;
+		};
+		if(++w==1024) {
+			w=0;
+			do {
+				if(++k==65536)
+					return 0;
+			} while(!b->asn32s[k]);
+		} else if(!b->asn32s[k]) {
+			w=1023;
+			continue;
+		};
+		/* skip empty 64-byte spans at once */
+		while(!(w%8) && bgpq_asn_block_empty(b->asn32s[k]+w*8)) {
+			w+=8;
+			if(w==1024)
+				break;
+		};
+		if(w==1024) {
+			w=1023;
+			continue;
+		};
+		word=bgpq_asn_word(b->asn32s[k]+w*8);
+	};
+};
+
+int
+bgpq_expander_asn_next(struct bgpq_expander* b, uint32_t* asn)
+{
+	if(*asn==UINT32_MAX)
+		return 0;
+	return bgpq_expander_asn_find(b, *asn+1, asn);
+};
+
+uint32_t
+bgpq_expander_asn_run(struct bgpq_expander* b, uint32_t asn)
+{
+	uint32_t k=asn>>16, w=(asn&0xffff)>>6;
+	uint64_t word;
+
+	/* asn itself is in the set, so its page is allocated */
+	word=~bgpq_asn_word(b->asn32s[k]+w*8) & (~0ULL>>(asn&63));
+	for(;;) {
+		if(word)
+			return (k<<16)+(w<<6)+__builtin_clzll(word)-1;
+		if(++w==1024) {
+			w=0;
+			if(++k==65536)
+				return UINT32_MAX;
+			if(!b->asn32s[k])
+				return (k<<16)-1;
+		};
+		word=~bgpq_asn_word(b->asn32s[k]+w*8);
+	};
+};
+
+/* a&=b (or a&=~b when minus is set) over a whole 8KiB asn32s page */
+static void
+bgpq_asn_page_combine(unsigned char* a, const unsigned char* b, int minus)
+{
+	uint64_t wa, wb;
+	int i;
+	for(i=0;i<8192;i+=8) {
+		memcpy(&wa, a+i, 8);
+		memcpy(&wb, b+i, 8);
+		wa&=minus?~wb:wb;
+		memcpy(a+i, &wa, 8);
+	};
+};
+
+int
+bgpq_expander_and(struct bgpq_expander* b, struct bgpq_expander* o)
+{
+	int k;
+	for(k=0;k<65536;k++) {
+		if(!b->asn32s[k])
+			continue;
+		if(!o->asn32s[k]) {
+			memset(b->asn32s[k],0,8192);
+			continue;
+		};
+		bgpq_asn_page_combine(b->asn32s[k], o->asn32s[k], 0);
+	};
+	sx_radix_tree_intersect(b->tree, o->tree);
+	if(b->treex && o->treex)
+		sx_radix_tree_intersect(b->treex, o->treex);
+	return 1;
+};
+
+int
+bgpq_expander_minus(struct bgpq_expander* b, struct bgpq_expander* o)
+{
+	int k;
+	for(k=0;k<65536;k++) {
+		if(!b->asn32s[k] || !o->asn32s[k])
+			continue;
+		bgpq_asn_page_combine(b->asn32s[k], o->asn32s[k], 1);
+	};
+	sx_radix_tree_subtract(b->tree, o->tree);
+	if(b->treex && o->treex)
+		sx_radix_tree_subtract(b->treex, o->treex);
+	return 1;
+};
+
+/* prefixes are collected and built into the trees in one go once the
+ * expansion is over, see bgpq_expander_load */
+static int
+bgpq_expander_queue_prefix(struct bgpq_expander* b, struct sx_prefix* p)
+{
+	if(b->nloadq==b->sloadq) {
+		int size=b->sloadq?b->sloadq*2:1024;
+		struct sx_prefix* q=realloc(b->loadq, size*sizeof(struct sx_prefix));
+		if(!q) {
+			sx_report(SX_FATAL,"Unable to allocate %lu bytes: %s\n",
+				(unsigned long)(size*sizeof(struct sx_prefix)), strerror(errno));
+			exit(1);
+		};
+		b->loadq=q;
+		b->sloadq=size;
+	};
+	b->loadq[b->nloadq++]=*p;
+	return 1;
+};
+
+static void
+bgpq_expander_load(struct bgpq_expander* b)
+{
+	if(!b->nloadq) return;
+	b->nloadq=sx_prefix_sort(b->loadq, b->nloadq);
+	sx_radix_tree_load(b->tree, b->loadq, b->nloadq);
+	if(b->treex)
+		sx_radix_tree_load(b->treex, b->loadq, b->nloadq);
+	free(b->loadq);
+	b->loadq=NULL;
+	b->nloadq=b->sloadq=0;
+};
+
 int
 bgpq_expander_add_prefix(struct bgpq_expander* b, char* prefix)
 {
@@ -205,10 +376,8 @@ bgpq_expander_add_prefix(struct bgpq_expander* b, char* prefix)
 		sx_report(SX_ERROR,"Unable to parse prefix %s\n", prefix);
 		return 0;
 	} else if(p.family!=b->family) {
-		if (p.family == AF_INET6 && b->treex != NULL) {
-			sx_radix_tree_insert(b->treex, &p);
-			return 1;
-		};
+		if (p.family == AF_INET6 && b->treex != NULL)
+			return bgpq_expander_queue_prefix(b, &p);
 		SX_DEBUG(debug_expander,"Ignoring prefix %s with wrong address family\n"
 			,prefix);
 		return 0;
@@ -218,8 +387,7 @@ bgpq_expander_add_prefix(struct bgpq_expander* b, char* prefix)
 			"masklen %u\n", prefix, p.masklen, b->maxlen);
 		return 0;
 	};
-	sx_radix_tree_insert(b->tree,&p);
-	return 1;
+	return bgpq_expander_queue_prefix(b, &p);
 };
 
 int
@@ -257,40 +425,44 @@ int bgpq_expand_irrd(struct bgpq_expander* b,
 	int (*callback)(char*, struct bgpq_expander* b, struct bgpq_request* req),
 	void* udata, char* fmt, ...);
 
+/* queues as-set for expansion at the next level (b->cdepth+1) */
+static void
+bgpq_expander_add_level(struct bgpq_expander* b, char* as)
+{
+	struct sx_slentry* le=sx_slentry_arena_new(&b->arena, as);
+	if(!le) {
+		sx_report(SX_FATAL, "Unable to allocate memory for %s: %s\n", as,
+			strerror(errno));
+		exit(1);
+	};
+	STAILQ_INSERT_TAIL(&b->levelq, le, next);
+};
+
 int
 bgpq_expanded_macro_limit(char* as, struct bgpq_expander* b,
 	struct bgpq_request* req)
 {
+	if (req && req->udata)
+		bgpq_cache_add_member(b, req->udata, as);
 	if (!strncasecmp(as, "AS-", 3) || strchr(as, '-') || strchr(as, ':')) {
-		struct sx_tentry tkey = { .text = as };
-		if (RB_FIND(tentree, &b->already, &tkey)) {
+		unsigned hash = sx_tset_hash(as);
+		if (sx_tset_find(&b->already, as, hash)) {
 			SX_DEBUG(debug_expander>2,"%s is already expanding, ignore\n", as);
 			return 0;
 		};
-		if (RB_FIND(tentree, &b->stoplist, &tkey)) {
+		if (sx_tset_find(&b->stoplist, as, hash)) {
 			SX_DEBUG(debug_expander>2,"%s is in the stoplist, ignore\n", as);
 			return 0;
 		};
-		if(!b->maxdepth ||
-			(b->cdepth + 1 < b->maxdepth && req->depth + 1 < b->maxdepth)) {
+		if(!b->maxdepth || b->cdepth + 1 < b->maxdepth) {
 			bgpq_expander_add_already(b,as);
-			if (pipelining) {
-				struct bgpq_request* req1 = bgpq_pipeline(b,
-					bgpq_expanded_macro_limit, NULL, "!i%s\n", as);
-				req1->depth = req->depth+1;
-			} else {
-				b->cdepth++;
-				bgpq_expand_irrd(b, bgpq_expanded_macro_limit, NULL, "!i%s\n",
-					as);
-				b->cdepth--;
-			};
+			bgpq_expander_add_level(b,as);
 		} else {
 			SX_DEBUG(debug_expander>2, "ignoring %s at depth %i\n", as,
-				b->cdepth?(b->cdepth+1):(req->depth+1));
+				b->cdepth+1);
 		};
 	} else if(!strncasecmp(as, "AS", 2)) {
-		struct sx_tentry tkey = { .text = as };
-		if (RB_FIND(tentree, &b->stoplist, &tkey)) {
+		if (sx_tset_find(&b->stoplist, as, sx_tset_hash(as))) {
 			SX_DEBUG(debug_expander>2,"%s is in the stoplist, ignore\n", as);
 			return 0;
 		};
@@ -298,13 +470,13 @@ bgpq_expanded_macro_limit(char* as, struct bgpq_expander* b,
 			SX_DEBUG(debug_expander>2, ".. added asn %s\n", as);
 		} else {
 			SX_DEBUG(debug_expander, ".. some error adding as %s (in "
-				"response to %s)\n", as, req->request);
+				"response to %s)\n", as, req ? req->request : "cache");
 		};
 	} else if (!strcasecmp(as, "ANY")) {
 		return 0;
 	} else {
 		sx_report(SX_ERROR, "unexpected object '%s' in expanded_macro_limit "
-			"(in response to %s)\n", as, req->request);
+			"(in response to %s)\n", as, req ? req->request : "cache");
 	};
 	return 1;
 };
@@ -336,26 +508,37 @@ bgpq_expanded_v6prefix(char* prefix, struct bgpq_expander* ex,
 int bgpq_pipeline_dequeue(int fd, struct bgpq_expander* b);
 
 static struct bgpq_request*
-bgpq_request_alloc(char* request, int (*callback)(char*, struct bgpq_expander*,
-	struct bgpq_request*), void* udata)
+bgpq_request_alloc(struct bgpq_expander* b, char* request,
+	int (*callback)(char*, struct bgpq_expander*, struct bgpq_request*),
+	void* udata)
 {
-	struct bgpq_request* bp = malloc(sizeof(struct bgpq_request));
-	if (!bp)
+	/* requests are recycled through freeq, short texts are kept right
+	 * after the struct in the same arena slot */
+	struct bgpq_request* bp = STAILQ_FIRST(&b->freeq);
+	int size = strlen(request);
+	if (bp)
+		STAILQ_REMOVE_HEAD(&b->freeq, next);
+	else if (!(bp = sx_arena_alloc(&b->arena,
+		sizeof(struct bgpq_request) + BGPQ_REQUEST_INLINE)))
 		return NULL;
 	memset(bp, 0, sizeof(struct bgpq_request));
-	bp->request = strdup(request);
+	if (size < BGPQ_REQUEST_INLINE) {
+		bp->request = (char*)(bp + 1);
+		memcpy(bp->request, request, size + 1);
+	} else if (!(bp->request = sx_arena_strdup(&b->arena, request))) {
+		return NULL;
+	};
 	bp->offset = 0;
-	bp->size = strlen(bp->request);
+	bp->size = size;
 	bp->callback = callback;
 	bp->udata = udata;
 	return bp;
 };
 
 static void
-bgpq_request_free(struct bgpq_request* req)
+bgpq_request_free(struct bgpq_expander* b, struct bgpq_request* req)
 {
-	if (req->request) free(req->request);
-	free(req);
+	STAILQ_INSERT_HEAD(&b->freeq, req, next);
 };
 
 struct bgpq_request*
@@ -363,7 +546,7 @@ bgpq_pipeline(struct bgpq_expander* b,
 	int (*callback)(char*, struct bgpq_expander*, struct bgpq_request*),
 	void* udata, char* fmt, ...)
 {
-	char request[128];
+	char request[BGPQ_REQUEST_SIZE];
 	int ret;
 	struct bgpq_request* bp=NULL;
 	va_list ap;
@@ -373,7 +556,7 @@ bgpq_pipeline(struct bgpq_expander* b,
 
 	SX_DEBUG(debug_expander,"expander: sending %s", request);
 
-	bp = bgpq_request_alloc(request, callback, udata);
+	bp = bgpq_request_alloc(b, request, callback, udata);
 	if(!bp) {
 		sx_report(SX_FATAL,"Unable to allocate %lu bytes: %s\n",
 			(unsigned long)sizeof(struct bgpq_request),strerror(errno));
@@ -591,11 +774,14 @@ have3:
 				"to %sfinal code: %.*s",recvbuffer,strlen(recvbuffer),togot,
 				req->request,off,response);
 
+			req->linestart=1;
 			for(c=recvbuffer; c<recvbuffer+togot;) {
 				size_t spn=strcspn(c," \n");
+				int eol=c[spn]=='\n';
 				if(spn) c[spn]=0;
 				if(c[0]==0) break;
 				req->callback(c, b, req);
+				req->linestart=eol;
 				c+=spn+1;
 			};
 			assert(c == recvbuffer+togot);
@@ -629,7 +815,7 @@ have3:
 
 		STAILQ_REMOVE_HEAD(&b->rq, next);
 		b->piped--;
-		bgpq_request_free(req);
+		bgpq_request_free(b, req);
 	};
 	return 0;
 };
@@ -639,7 +825,7 @@ bgpq_expand_irrd(struct bgpq_expander* b,
 	int (*callback)(char*, struct bgpq_expander*, struct bgpq_request* ),
 	void* udata, char* fmt, ...)
 {
-	char request[128], response[128];
+	char request[BGPQ_REQUEST_SIZE], response[128];
 	va_list ap;
 	int ret, off = 0;
 	struct bgpq_request *req;
@@ -648,7 +834,7 @@ bgpq_expand_irrd(struct bgpq_expander* b,
 	vsnprintf(request,sizeof(request),fmt,ap);
 	va_end(ap);
 
-	req = bgpq_request_alloc(request, callback, udata);
+	req = bgpq_request_alloc(b, request, callback, udata);
 
 	SX_DEBUG(debug_expander,"expander: sending '%s'\n", request);
 
@@ -741,11 +927,14 @@ have3:
 			(unsigned long)strlen(recvbuffer), offset, recvbuffer, off,
 			response);
 
+		req->linestart=1;
 		for(c=recvbuffer; c<recvbuffer+togot;) {
 			size_t spn=strcspn(c," \n");
+			int eol=c[spn]=='\n';
 			if(spn) c[spn]=0;
 			if(c[0]==0) break;
 			if(callback) callback(c, b, req);
+			req->linestart=eol;
 			c+=spn+1;
 		};
 		memset(recvbuffer, 0, togot+2);
@@ -764,14 +953,140 @@ have3:
 		sx_report(SX_ERROR,"Wrong reply: %s\n", response);
 		exit(0);
 	};
-	bgpq_request_free(req);
+	bgpq_request_free(b, req);
 	return 0;
 };
 
+/* Hybrid EXCEPT handling. Set X can be flattened server-side (!iX,1)
+ * unless a stoplisted set or ASN is reachable from it. Any reachable
+ * stoplisted set S has its flattening inside X's one, so it is enough to
+ * check X's flattened ASNs against stopasns: ASNs of flattened stoplisted
+ * sets plus stoplisted ASNs. Sets with empty flattening add nothing either
+ * way. */
+struct bgpq_flattened {
+	STAILQ_ENTRY(bgpq_flattened) next;
+	struct sx_slentry* set;
+	int tainted;
+	struct sx_slentries asns;
+};
+
+static int
+bgpq_expanded_stopasn(char* as, struct bgpq_expander* b,
+	struct bgpq_request* req __attribute__((unused)))
+{
+	if(!sx_tset_add(&b->stopasns, as)) {
+		sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+			strerror(errno));
+		exit(1);
+	};
+	return 1;
+};
+
+static int
+bgpq_expanded_flat(char* as, struct bgpq_expander* b,
+	struct bgpq_request* req)
+{
+	struct bgpq_flattened* fl = req->udata;
+	struct sx_slentry* le;
+	if (fl->tainted)
+		return 1;
+	if (sx_tset_find(&b->stopasns, as, sx_tset_hash(as))) {
+		SX_DEBUG(debug_expander>2, "%s reaches stoplisted %s, walking it\n",
+			fl->set->text, as);
+		fl->tainted = 1;
+		return 1;
+	};
+	if (!(le = sx_slentry_arena_new(&b->arena, as))) {
+		sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+			strerror(errno));
+		exit(1);
+	};
+	STAILQ_INSERT_TAIL(&fl->asns, le, next);
+	return 1;
+};
+
+static void
+bgpq_expand_stopasns(struct bgpq_expander* b)
+{
+	unsigned i;
+	for (i = 0; i < b->stoplist.size; i++) {
+		char* name = b->stoplist.slots[i].text;
+		if (!name)
+			continue;
+		if (!strncasecmp(name, "AS-", 3) || strchr(name, '-') ||
+			strchr(name, ':')) {
+			if (pipelining) {
+				bgpq_pipeline(b, bgpq_expanded_stopasn, NULL, "!i%s,1\n",
+					name);
+			} else {
+				bgpq_expand_irrd(b, bgpq_expanded_stopasn, NULL, "!i%s,1\n",
+					name);
+			};
+		} else if (!strncasecmp(name, "AS", 2)) {
+			bgpq_expanded_stopasn(name, b, NULL);
+		};
+	};
+	if (pipelining) {
+		if (!STAILQ_EMPTY(&b->wq))
+			bgpq_write(b);
+		if (!STAILQ_EMPTY(&b->rq))
+			bgpq_read(b);
+	};
+	SX_DEBUG(debug_expander, "%u stoplisted ASNs\n", b->stopasns.count);
+};
+
+/* flattens every set of the level in one burst. Sets clear of the
+ * stoplist are done, tainted ones stay in level to be walked one step. */
+static void
+bgpq_expand_flattened(struct bgpq_expander* b, struct sx_slentries* level)
+{
+	STAILQ_HEAD(, bgpq_flattened) flats = STAILQ_HEAD_INITIALIZER(flats);
+	struct bgpq_flattened* fl;
+	struct sx_slentry* mc, *as;
+	int total = 0, tainted = 0;
+
+	STAILQ_FOREACH(mc, level, next) {
+		if (!(fl = sx_arena_alloc(&b->arena, sizeof(struct bgpq_flattened)))) {
+			sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+				strerror(errno));
+			exit(1);
+		};
+		memset(fl, 0, sizeof(struct bgpq_flattened));
+		fl->set = mc;
+		STAILQ_INIT(&fl->asns);
+		STAILQ_INSERT_TAIL(&flats, fl, next);
+		total++;
+		if (pipelining) {
+			bgpq_pipeline(b, bgpq_expanded_flat, fl, "!i%s,1\n", mc->text);
+		} else {
+			bgpq_expand_irrd(b, bgpq_expanded_flat, fl, "!i%s,1\n", mc->text);
+		};
+	};
+	if (pipelining) {
+		if (!STAILQ_EMPTY(&b->wq))
+			bgpq_write(b);
+		if (!STAILQ_EMPTY(&b->rq))
+			bgpq_read(b);
+	};
+
+	STAILQ_INIT(level);
+	STAILQ_FOREACH(fl, &flats, next) {
+		if (fl->tainted) {
+			STAILQ_INSERT_TAIL(level, fl->set, next);
+			tainted++;
+			continue;
+		};
+		STAILQ_FOREACH(as, &fl->asns, next)
+			bgpq_expander_add_as(b, as->text);
+	};
+	SX_DEBUG(debug_expander, "level %i: %i of %i sets flattened\n",
+		b->cdepth, total - tainted, total);
+};
+
 int
 bgpq_expand(struct bgpq_expander* b)
 {
-	int fd=-1, err, ret;
+	int fd=-1, err, ret, hybrid;
 	struct sx_slentry* mc;
 	struct addrinfo hints, *res=NULL, *rp;
 	struct linger sl;
@@ -863,33 +1178,70 @@ bgpq_expand(struct bgpq_expander* b)
 		read(fd, ident, sizeof(ident));
 	};
 
+	if(b->cache) {
+		bgpq_cache_load(b);
+		bgpq_expand_irrd(b, bgpq_cache_serial, NULL, "!j-*\n");
+	};
+
 	if (pipelining)
 		fcntl(fd, F_SETFL, O_NONBLOCK|(fcntl(fd, F_GETFL)));
 
 	STAILQ_FOREACH(mc, &b->macroses, next) {
-		if (!b->maxdepth && RB_EMPTY(&b->stoplist)) {
+		if (!b->maxdepth && !b->stoplist.count && !b->cache) {
 			bgpq_expand_irrd(b, bgpq_expanded_macro, b, "!i%s,1\n", mc->text);
 		} else {
 			bgpq_expander_add_already(b,mc->text);
+			bgpq_expander_add_level(b,mc->text);
+		};
+	};
+
+	hybrid = !b->maxdepth && !b->cache && b->stoplist.count;
+	if (hybrid && !STAILQ_EMPTY(&b->levelq))
+		bgpq_expand_stopasns(b);
+
+	/* breadth-first: the whole level is sent in one burst and answered
+	 * before the next one starts, so every set is first reached (and
+	 * marked already) at its minimal depth */
+	for(b->cdepth=0; !STAILQ_EMPTY(&b->levelq); b->cdepth++) {
+		struct sx_slentries level;
+		STAILQ_INIT(&level);
+		STAILQ_CONCAT(&level, &b->levelq);
+		if (hybrid)
+			bgpq_expand_flattened(b, &level);
+		SX_DEBUG(debug_expander, "expanding level %i\n", b->cdepth);
+		STAILQ_FOREACH(mc, &level, next) {
+			struct bgpq_cached* cached = NULL;
+			if (b->cache && bgpq_cache_expand(b, mc->text, &cached))
+				continue;
 			if (pipelining) {
-				bgpq_pipeline(b, bgpq_expanded_macro_limit, NULL, "!i%s\n",
+				bgpq_pipeline(b, bgpq_expanded_macro_limit, cached, "!i%s\n",
 					mc->text);
+				if (cached)
+					bgpq_pipeline(b, bgpq_cache_source, cached,
+						"!mas-set,%s\n", mc->text);
 			} else {
-				bgpq_expand_irrd(b, bgpq_expanded_macro_limit, NULL, "!i%s\n",
+				bgpq_expand_irrd(b, bgpq_expanded_macro_limit, cached, "!i%s\n",
 					mc->text);
+				if (cached)
+					bgpq_expand_irrd(b, bgpq_cache_source, cached,
+						"!mas-set,%s\n", mc->text);
 			};
 		};
+		if(pipelining) {
+			if(!STAILQ_EMPTY(&b->wq))
+				bgpq_write(b);
+			if (!STAILQ_EMPTY(&b->rq))
+				bgpq_read(b);
+		};
 	};
+	b->cdepth=0;
 
-	if(pipelining) {
-		if(!STAILQ_EMPTY(&b->wq))
-			bgpq_write(b);
-		if (!STAILQ_EMPTY(&b->rq))
-			bgpq_read(b);
-	};
+	if(b->cache)
+		bgpq_cache_save(b);
 
 	if(b->generation>=T_PREFIXLIST || b->validate_asns) {
-		uint32_t i, j, k;
+		uint32_t asn;
+		int more;
 		STAILQ_FOREACH(mc, &b->rsets, next) {
 			if(b->family==AF_INET) {
 				bgpq_expand_irrd(b, bgpq_expanded_prefix, NULL, "!i%s,1\n",
@@ -899,41 +1251,34 @@ bgpq_expand(struct bgpq_expander* b)
 					mc->text);
 			};
 		};
-		for(k=0;k<sizeof(b->asn32s)/sizeof(unsigned char*);k++) {
-			if(!b->asn32s[k]) continue;
-			for(i=0;i<8192;i++) {
-				for(j=0;j<8;j++) {
-					if(b->asn32s[k][i]&(0x80>>j)) {
-						if(b->family==AF_INET6) {
-							if(!pipelining) {
-								bgpq_expand_irrd(b, bgpq_expanded_v6prefix,
-									b, "!6as%" PRIu32 "\n", (k<<16)+i*8+j);
-							} else {
-								bgpq_pipeline(b, bgpq_expanded_v6prefix,
-									b, "!6as%" PRIu32 "\n", (k<<16)+i*8+j);
-							};
-						} else if (b->treex != NULL) {
-							if (!pipelining) {
-								bgpq_expand_irrd(b, bgpq_expanded_prefix,
-									b, "!gas%" PRIu32 "\n", (k<<16)+i*8+j);
-								bgpq_expand_irrd(b, bgpq_expanded_v6prefix,
-									b, "!6as%" PRIu32 "\n", (k<<16)+i*8+j);
-							} else {
-								bgpq_pipeline(b, bgpq_expanded_prefix,
-									b, "!gas%" PRIu32 "\n", (k<<16)+i*8+j);
-								bgpq_pipeline(b, bgpq_expanded_v6prefix,
-									b, "!6as%" PRIu32 "\n", (k<<16)+i*8+j);
-							};
-						} else {
-							if(!pipelining) {
-								bgpq_expand_irrd(b, bgpq_expanded_prefix,
-									b, "!gas%" PRIu32 "\n", (k<<16)+i*8+j);
-							} else {
-								bgpq_pipeline(b, bgpq_expanded_prefix,
-									b, "!gas%" PRIu32 "\n", (k<<16)+i*8+j);
-							};
-						};
-					};
+		BGPQ_ASN_FOREACH(asn, more, b) {
+			if(b->family==AF_INET6) {
+				if(!pipelining) {
+					bgpq_expand_irrd(b, bgpq_expanded_v6prefix, b,
+						"!6as%" PRIu32 "\n", asn);
+				} else {
+					bgpq_pipeline(b, bgpq_expanded_v6prefix, b,
+						"!6as%" PRIu32 "\n", asn);
+				};
+			} else if (b->treex != NULL) {
+				if (!pipelining) {
+					bgpq_expand_irrd(b, bgpq_expanded_prefix, b,
+						"!gas%" PRIu32 "\n", asn);
+					bgpq_expand_irrd(b, bgpq_expanded_v6prefix, b,
+						"!6as%" PRIu32 "\n", asn);
+				} else {
+					bgpq_pipeline(b, bgpq_expanded_prefix, b,
+						"!gas%" PRIu32 "\n", asn);
+					bgpq_pipeline(b, bgpq_expanded_v6prefix, b,
+						"!6as%" PRIu32 "\n", asn);
+				};
+			} else {
+				if(!pipelining) {
+					bgpq_expand_irrd(b, bgpq_expanded_prefix, b,
+						"!gas%" PRIu32 "\n", asn);
+				} else {
+					bgpq_pipeline(b, bgpq_expanded_prefix, b,
+						"!gas%" PRIu32 "\n", asn);
 				};
 			};
 		};
@@ -945,6 +1290,8 @@ bgpq_expand(struct bgpq_expander* b)
 		};
 	};
 
+	bgpq_expander_load(b);
+
 	write(fd, "!q\n",3);
 	if (pipelining) {
 		int fl = fcntl(fd, F_GETFL);
@@ -0,0 +1,388 @@
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bgpq3.h"
+#include "sx_report.h"
+
+extern int debug_expander;
+
+/* State file (-i) keeps the entries of the last filter printed, in tree
+ * order (family, address, masklen, then range):
+ *   "BGPQ3ST1" vendor:8 generation:8 namelen:16 name count:32
+ *   per entry: family:8 (4 or 6) masklen:8 low:8 high:8 address bytes
+ * with address bytes covering masklen only, multi-byte fields big-endian.
+ * Entries of the new trees come in the same order from a pre-order walk,
+ * so both sequences are merged in one pass to get the changes. */
+
+#define BGPQ_STATE_MAGIC "BGPQ3ST1"
+
+struct bgpq_entries {
+	struct bgpq_entry* v;
+	int n, size;
+};
+
+static int
+bgpq_entry_cmp(const struct bgpq_entry* a, const struct bgpq_entry* b)
+{
+	int r;
+	if(a->prefix.family!=b->prefix.family)
+		return a->prefix.family<b->prefix.family?-1:1;
+	if((r=memcmp(a->prefix.addr.addrs, b->prefix.addr.addrs,
+		a->prefix.family==AF_INET?4:16)))
+		return r;
+	if(a->prefix.masklen!=b->prefix.masklen)
+		return a->prefix.masklen<b->prefix.masklen?-1:1;
+	if(a->lo!=b->lo)
+		return a->lo<b->lo?-1:1;
+	if(a->hi!=b->hi)
+		return a->hi<b->hi?-1:1;
+	return 0;
+};
+
+static struct bgpq_entry*
+bgpq_entries_add(struct bgpq_entries* es)
+{
+	struct bgpq_entry* nv;
+	if(es->n==es->size) {
+		es->size=es->size?es->size*2:1024;
+		if(!(nv=realloc(es->v, es->size*sizeof(struct bgpq_entry)))) {
+			sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+				strerror(errno));
+			exit(1);
+		};
+		es->v=nv;
+	};
+	memset(es->v+es->n, 0, sizeof(struct bgpq_entry));
+	return es->v+es->n++;
+};
+
+/* entries as printers see them: the node unless glue, then its sons */
+static void
+bgpq_entries_collect(struct bgpq_entries* es, struct sx_radix_tree* t)
+{
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* node, *n;
+	struct bgpq_entry* e, tmp;
+	int first, i, j;
+
+	if(!t)
+		return;
+	SX_RADIX_FOREACH(node, &cur, t) {
+		first=es->n;
+		for(n=node; n; n=sx_radix_son(n)) {
+			if(n->isGlue)
+				continue;
+			e=bgpq_entries_add(es);
+			e->prefix=node->prefix;
+			e->lo=n->isAggregate?n->aggregateLow:node->prefix.masklen;
+			e->hi=n->isAggregate?n->aggregateHi:node->prefix.masklen;
+		};
+		/* a node has a handful of entries at most: insertion sort, and
+		 * drop duplicates */
+		for(i=first+1; i<es->n; i++) {
+			tmp=es->v[i];
+			for(j=i; j>first && bgpq_entry_cmp(es->v+j-1, &tmp)>0; j--)
+				es->v[j]=es->v[j-1];
+			es->v[j]=tmp;
+		};
+		for(i=j=first; i<es->n; i++) {
+			if(j>first && !bgpq_entry_cmp(es->v+j-1, es->v+i))
+				continue;
+			es->v[j++]=es->v[i];
+		};
+		es->n=j;
+	};
+};
+
+static void
+bgpq_state_entries(struct bgpq_entries* es, struct bgpq_expander* b)
+{
+	memset(es, 0, sizeof(struct bgpq_entries));
+	bgpq_entries_collect(es, b->tree);
+	bgpq_entries_collect(es, b->treex);
+};
+
+/* entries of a state file made for the same filter, 0 if there is none */
+static int
+bgpq_state_load(struct bgpq_entries* es, struct bgpq_expander* b, char* file)
+{
+	const char* name=b->name?b->name:"NN";
+	unsigned char* buf, *p, *end;
+	struct bgpq_entry* e;
+	struct stat st;
+	uint32_t count, i, nlen, alen;
+	FILE* f;
+
+	memset(es, 0, sizeof(struct bgpq_entries));
+	if(!(f=fopen(file, "r"))) {
+		if(errno!=ENOENT)
+			sx_report(SX_ERROR, "Unable to open state %s: %s\n", file,
+				strerror(errno));
+		return 0;
+	};
+	if(fstat(fileno(f), &st) || !(buf=malloc(st.st_size+1))) {
+		sx_report(SX_ERROR, "Unable to read state %s: %s\n", file,
+			strerror(errno));
+		fclose(f);
+		return 0;
+	};
+	if(fread(buf, 1, st.st_size, f)!=(size_t)st.st_size) {
+		sx_report(SX_ERROR, "Unable to read state %s: %s\n", file,
+			strerror(errno));
+		goto fail;
+	};
+	p=buf;
+	end=buf+st.st_size;
+	if(end-p<12 || memcmp(p, BGPQ_STATE_MAGIC, 8))
+		goto invalid;
+	nlen=(p[10]<<8)|p[11];
+	if(p[8]!=b->vendor || p[9]!=b->generation || (uint32_t)(end-p)<12+nlen+4
+		|| nlen!=strlen(name) || memcmp(p+12, name, nlen)) {
+		sx_report(SX_ERROR, "State %s was made for another filter, printing "
+			"it whole\n", file);
+		goto fail;
+	};
+	p+=12+nlen;
+	count=((uint32_t)p[0]<<24)|(p[1]<<16)|(p[2]<<8)|p[3];
+	p+=4;
+	for(i=0; i<count; i++) {
+		if(end-p<4 || (p[0]!=4 && p[0]!=6))
+			goto invalid;
+		e=bgpq_entries_add(es);
+		e->prefix.family=p[0]==4?AF_INET:AF_INET6;
+		e->prefix.masklen=p[1];
+		e->lo=p[2];
+		e->hi=p[3];
+		alen=(p[1]+7)/8;
+		if(p[1]>(p[0]==4?32:128) || (uint32_t)(end-p-4)<alen)
+			goto invalid;
+		memcpy(e->prefix.addr.addrs, p+4, alen);
+		p+=4+alen;
+		if(es->n>1 && bgpq_entry_cmp(e-1, e)>=0)
+			goto invalid;
+	};
+	if(p!=end)
+		goto invalid;
+	SX_DEBUG(debug_expander, "State %s: %u entries\n", file, count);
+	free(buf);
+	fclose(f);
+	return 1;
+
+invalid:
+	sx_report(SX_ERROR, "State %s is corrupted, printing filter whole\n",
+		file);
+fail:
+	free(es->v);
+	memset(es, 0, sizeof(struct bgpq_entries));
+	free(buf);
+	fclose(f);
+	return 0;
+};
+
+int
+bgpq_state_delta(FILE* f, struct bgpq_expander* b, char* file)
+{
+	struct bgpq_entries old, new, added, removed;
+	int i=0, j=0, r;
+
+	if(!bgpq_state_load(&old, b, file))
+		return 0;
+	bgpq_state_entries(&new, b);
+	/* empty lists are printed as explicit deny entries, which deltas
+	 * do not track */
+	if(!old.n || !new.n) {
+		free(old.v);
+		free(new.v);
+		return 0;
+	};
+	memset(&added, 0, sizeof(added));
+	memset(&removed, 0, sizeof(removed));
+	while(i<old.n || j<new.n) {
+		if(i==old.n)
+			r=1;
+		else if(j==new.n)
+			r=-1;
+		else
+			r=bgpq_entry_cmp(old.v+i, new.v+j);
+		if(r<0)
+			*bgpq_entries_add(&removed)=old.v[i++];
+		else if(r>0)
+			*bgpq_entries_add(&added)=new.v[j++];
+		else
+			i++, j++;
+	};
+	SX_DEBUG(debug_expander, "State %s: %i removed, %i added\n", file,
+		removed.n, added.n);
+	bgpq3_print_prefixlist_delta(f, b, removed.v, removed.n, added.v,
+		added.n);
+	free(old.v);
+	free(new.v);
+	free(added.v);
+	free(removed.v);
+	return 1;
+};
+
+int
+bgpq_state_save(struct bgpq_expander* b, char* file)
+{
+	const char* name=b->name?b->name:"NN";
+	struct bgpq_entries es;
+	unsigned char hdr[12];
+	char tmp[PATH_MAX];
+	size_t nlen=strlen(name);
+	FILE* f;
+	int i, err;
+
+	if(nlen>65535) {
+		sx_report(SX_ERROR, "Name too long to save state\n");
+		return 0;
+	};
+	if(!(f=bgpq_tmpfile(file, tmp, sizeof(tmp)))) {
+		sx_report(SX_ERROR, "Unable to write state %s: %s\n", file,
+			strerror(errno));
+		return 0;
+	};
+	bgpq_state_entries(&es, b);
+	memcpy(hdr, BGPQ_STATE_MAGIC, 8);
+	hdr[8]=b->vendor;
+	hdr[9]=b->generation;
+	hdr[10]=nlen>>8;
+	hdr[11]=nlen&0xff;
+	fwrite(hdr, 1, 12, f);
+	fwrite(name, 1, nlen, f);
+	hdr[0]=(uint32_t)es.n>>24;
+	hdr[1]=(es.n>>16)&0xff;
+	hdr[2]=(es.n>>8)&0xff;
+	hdr[3]=es.n&0xff;
+	fwrite(hdr, 1, 4, f);
+	for(i=0; i<es.n; i++) {
+		hdr[0]=es.v[i].prefix.family==AF_INET?4:6;
+		hdr[1]=es.v[i].prefix.masklen;
+		hdr[2]=es.v[i].lo;
+		hdr[3]=es.v[i].hi;
+		fwrite(hdr, 1, 4, f);
+		fwrite(es.v[i].prefix.addr.addrs, 1, (hdr[1]+7)/8, f);
+	};
+	free(es.v);
+	err=ferror(f);
+	if(fclose(f) || err || rename(tmp, file)) {
+		sx_report(SX_ERROR, "Unable to write state %s: %s\n", file,
+			strerror(errno));
+		unlink(tmp);
+		return 0;
+	};
+	return 1;
+};
+
+/* Tree file (-O/-I) is the expanded trees themselves:
+ *   "BGPQ3TR1" family:8 (4 or 6) mixed:8 tree [treex]
+ * with trees in sx_radix_tree_write form, so they are loaded back in one
+ * pass without a single insert. */
+
+#define BGPQ_TREE_MAGIC "BGPQ3TR1"
+
+int
+bgpq_tree_save(struct bgpq_expander* b, char* file)
+{
+	char tmp[PATH_MAX];
+	int ok, err;
+	FILE* f;
+
+	if(!(f=bgpq_tmpfile(file, tmp, sizeof(tmp)))) {
+		sx_report(SX_ERROR, "Unable to write trees %s: %s\n", file,
+			strerror(errno));
+		return 0;
+	};
+	fwrite(BGPQ_TREE_MAGIC, 1, 8, f);
+	putc(b->family==AF_INET?4:6, f);
+	putc(b->treex?1:0, f);
+	ok=sx_radix_tree_write(b->tree, f);
+	if(ok && b->treex)
+		ok=sx_radix_tree_write(b->treex, f);
+	err=ferror(f);
+	if(fclose(f) || err || !ok || rename(tmp, file)) {
+		sx_report(SX_ERROR, "Unable to write trees %s: %s\n", file,
+			strerror(errno));
+		unlink(tmp);
+		return 0;
+	};
+	return 1;
+};
+
+int
+bgpq_tree_load(struct bgpq_expander* b, char* file)
+{
+	const unsigned char* p, *end;
+	unsigned char* buf;
+	struct stat st;
+	void* map=MAP_FAILED;
+	int fd, ret=0;
+
+	if((fd=open(file, O_RDONLY))==-1) {
+		sx_report(SX_ERROR, "Unable to open trees %s: %s\n", file,
+			strerror(errno));
+		return 0;
+	};
+	if(fstat(fd, &st)) {
+		sx_report(SX_ERROR, "Unable to read trees %s: %s\n", file,
+			strerror(errno));
+		close(fd);
+		return 0;
+	};
+	if(S_ISREG(st.st_mode) && st.st_size>0)
+		map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map!=MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+		buf=map;
+	} else if(!(buf=malloc(st.st_size+1)) ||
+		read(fd, buf, st.st_size)!=st.st_size) {
+		sx_report(SX_ERROR, "Unable to read trees %s: %s\n", file,
+			strerror(errno));
+		free(buf);
+		close(fd);
+		return 0;
+	};
+	p=buf;
+	end=buf+st.st_size;
+
+	if(end-p<10 || memcmp(p, BGPQ_TREE_MAGIC, 8) || (p[8]!=4 && p[8]!=6)) {
+		sx_report(SX_ERROR, "%s is not a trees file\n", file);
+		goto done;
+	};
+	if((p[8]==4)!=(b->family==AF_INET) || (p[9]?1:0)!=(b->treex?1:0)) {
+		sx_report(SX_ERROR, "Trees %s were saved for %s prefixes\n", file,
+			p[9]?"mixed-family (-x)":p[8]==4?"IPv4":"IPv6");
+		goto done;
+	};
+	p+=10;
+	if(!(p=sx_radix_tree_read(b->tree, p, end)) ||
+		(b->treex && !(p=sx_radix_tree_read(b->treex, p, end))) || p!=end) {
+		sx_report(SX_ERROR, "Trees %s are corrupted\n", file);
+		goto done;
+	};
+	SX_DEBUG(debug_expander, "Trees loaded from %s\n", file);
+	ret=1;
+
+done:
+	if(map!=MAP_FAILED)
+		munmap(map, st.st_size);
+	else
+		free(buf);
+	close(fd);
+	return ret;
+};
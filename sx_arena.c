@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sx_arena.h"
+
+#ifndef SX_ARENA_CHUNK
+#define SX_ARENA_CHUNK (64*1024)
+#endif
+
+#define SX_ARENA_ALIGN(x) (((x)+sizeof(void*)-1)&~(sizeof(void*)-1))
+
+struct sx_arena_chunk {
+	struct sx_arena_chunk* next;
+	size_t size, used;
+	void* data[];
+};
+
+void*
+sx_arena_alloc(struct sx_arena* a, size_t size)
+{
+	struct sx_arena_chunk* c=a->chunks;
+	void* ret;
+	size=SX_ARENA_ALIGN(size);
+	if(!c || c->size-c->used<size) {
+		size_t csize=size>SX_ARENA_CHUNK?size:SX_ARENA_CHUNK;
+		if(!(c=malloc(sizeof(struct sx_arena_chunk)+csize)))
+			return NULL;
+		c->size=csize;
+		c->used=0;
+		if(a->chunks && csize>SX_ARENA_CHUNK) {
+			/* oversized allocation, keep filling the current chunk */
+			c->next=a->chunks->next;
+			a->chunks->next=c;
+		} else {
+			c->next=a->chunks;
+			a->chunks=c;
+		};
+	};
+	ret=(char*)c->data+c->used;
+	c->used+=size;
+	return ret;
+};
+
+char*
+sx_arena_strdup(struct sx_arena* a, const char* text)
+{
+	size_t len=strlen(text)+1;
+	char* ret=sx_arena_alloc(a, len);
+	if(ret)
+		memcpy(ret, text, len);
+	return ret;
+};
+
+void
+sx_arena_free(struct sx_arena* a)
+{
+	struct sx_arena_chunk* c, *next;
+	for(c=a->chunks;c;c=next) {
+		next=c->next;
+		free(c);
+	};
+	a->chunks=NULL;
+};
@@ -0,0 +1,18 @@
+#ifndef SX_ARENA_H_
+#define SX_ARENA_H_
+
+#include <stddef.h>
+
+/* bump allocator: memory comes from large chunks and is released all at
+ * once by sx_arena_free. Zero-initialized struct is an empty arena. */
+struct sx_arena_chunk;
+
+struct sx_arena {
+	struct sx_arena_chunk* chunks;
+};
+
+void* sx_arena_alloc(struct sx_arena* a, size_t size);
+char* sx_arena_strdup(struct sx_arena* a, const char* text);
+void sx_arena_free(struct sx_arena* a);
+
+#endif
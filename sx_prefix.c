@@ -4,15 +4,22 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#if HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
+#include "sx_arena.h"
 #include "sx_prefix.h"
 #include "sx_report.h"
 
 int debug_aggregation=0;
+/* threads for aggregation (-Y), above 1 trees are aggregated in parallel */
+int aggregation_threads=1;
 extern int debug_expander;
 
 struct sx_prefix*
@@ -37,14 +44,10 @@ void
 sx_prefix_adjust_masklen(struct sx_prefix* p)
 {
 	int nbytes=(p->family==AF_INET?4:16);
-	int i;
+	int i=p->masklen/8;
 	if(p->masklen==nbytes*8) return ; /* mask is all ones */
-	for(i=nbytes-1;i>p->masklen/8;i--) {
-		p->addr.addrs[i]=0;
-	};
-	for(i=1;i<=8-p->masklen%8;i++) {
-		p->addr.addrs[p->masklen/8]&=(0xff<<i);
-	};
+	p->addr.addrs[i]&=0xff<<(8-p->masklen%8);
+	memset(p->addr.addrs+i+1, 0, nbytes-i-1);
 };
 
 void
@@ -74,13 +77,16 @@ sx_prefix_imask(struct sx_prefix* p, struct sx_prefix* q)
 };
 
 
-int
-sx_prefix_parse(struct sx_prefix* p, int af, char* text)
+/* the general parser below, used for anything the fast one rejects */
+static int
+sx_prefix_parse_slow(struct sx_prefix* p, int af, const char* text, size_t len)
 {
 	char* c=NULL;
 	int masklen, ret;
 	char mtext[INET6_ADDRSTRLEN+5];
-	strlcpy(mtext, text, sizeof(mtext));
+	if(len>=sizeof(mtext)) len=sizeof(mtext)-1;
+	memcpy(mtext, text, len);
+	mtext[len]=0;
 
 	c=strchr(mtext,'/');
 	if(c) {
@@ -89,7 +95,7 @@ sx_prefix_parse(struct sx_prefix* p, int af, char* text)
 		masklen=strtol(c+1,&eod,10);
 		if(eod && eod[0] && !isspace(eod[0])) {
 			*c='/';
-			sx_report(SX_ERROR,"Invalid masklen in prefix %s\n", text);
+			sx_report(SX_ERROR,"Invalid masklen in prefix %s\n", mtext);
 			goto fixups;
 		};
 	} else {
@@ -113,7 +119,7 @@ sx_prefix_parse(struct sx_prefix* p, int af, char* text)
 			aparts[0]<256 && aparts[1]>=0 && aparts[1]<256 &&
 			aparts[2]>=0 && aparts[2]<256 && aparts[3]>=0 &&
 			aparts[3]<256) {
-			p->addr.addr.s_addr = htonl((aparts[0]<<24) +
+			p->addr.addr.s_addr = htonl(((uint32_t)aparts[0]<<24) +
 				(aparts[1]<<16) + (aparts[2]<<8) + aparts[3]);
 		} else {
 			if(c) *c='/';
@@ -155,15 +161,160 @@ fixups:
 	return 0;
 };
 
+/* dotted quad, strict: 1-3 digits per part, no leading zeros */
+static int
+sx_prefix_parse_v4(const char** sp, const char* end, unsigned char* out)
+{
+	const char* s=*sp;
+	unsigned v;
+	int i, k;
+	for(i=0; i<4; i++) {
+		if(i) {
+			if(s==end || *s!='.') return 0;
+			s++;
+		};
+		for(v=0, k=0; s<end && k<4 && *s>='0' && *s<='9'; s++, k++)
+			v=v*10+(*s-'0');
+		if(k==0 || k>3 || v>255 || (k>1 && s[-k]=='0')) return 0;
+		out[i]=v;
+	};
+	*sp=s;
+	return 1;
+};
+
+static int
+sx_hexdigit(char c)
+{
+	if(c>='0' && c<='9') return c-'0';
+	if(c>='a' && c<='f') return c-'a'+10;
+	if(c>='A' && c<='F') return c-'A'+10;
+	return -1;
+};
+
+/* groups of up to 4 hex digits, one '::', optional trailing dotted quad */
+static int
+sx_prefix_parse_v6(const char** sp, const char* end, unsigned char* out)
+{
+	const char* s=*sp, *g;
+	unsigned words[8], v;
+	int n=0, dc=-1, k, d, i;
+
+	if(s<end && *s==':') {
+		if(s+1==end || s[1]!=':') return 0;
+		dc=0;
+		s+=2;
+	};
+	while(s<end && *s!='/') {
+		g=s;
+		for(v=0, k=0; s<end && k<5 && (d=sx_hexdigit(*s))>=0; s++, k++)
+			v=v*16+d;
+		if(k==0) return 0;
+		if(s<end && *s=='.') {
+			unsigned char q[4];
+			s=g;
+			if(n>6 || !sx_prefix_parse_v4(&s, end, q)) return 0;
+			words[n++]=(q[0]<<8)|q[1];
+			words[n++]=(q[2]<<8)|q[3];
+			break;
+		};
+		if(k>4 || n==8) return 0;
+		words[n++]=v;
+		if(s==end || *s=='/') break;
+		if(*s!=':') return 0;
+		s++;
+		if(s<end && *s==':') {
+			if(dc>=0) return 0;
+			dc=n;
+			s++;
+		} else if(s==end || *s=='/') {
+			return 0;
+		};
+	};
+	if(dc>=0 ? n==8 : n!=8) return 0;
+
+	memset(out, 0, 16);
+	for(i=0; i<n; i++) {
+		/* groups after '::' are aligned to the end */
+		int pos=(dc>=0 && i>=dc) ? 8-n+i : i;
+		out[2*pos]=words[i]>>8;
+		out[2*pos+1]=words[i]&0xff;
+	};
+	*sp=s;
+	return 1;
+};
+
+/* Single pass over text[0..len) without copying. Handles the canonical
+ * forms IRRd returns; anything else (leading zeros in a quad, odd
+ * masklens, overlong tokens) is left to sx_prefix_parse_slow so the
+ * results and error reports stay the same. */
+int
+sx_prefix_parsen(struct sx_prefix* p, int af, const char* text, size_t len)
+{
+	const char* s=text, *end=text+len;
+	unsigned char addr[16];
+	int masklen=-1, k, maxlen;
+
+	if(len>=INET6_ADDRSTRLEN+5)
+		goto slow;
+	if(!af)
+		af=memchr(text, ':', len) ? AF_INET6 : AF_INET;
+	if(af==AF_INET) {
+		if(!sx_prefix_parse_v4(&s, end, addr)) goto slow;
+		maxlen=32;
+	} else if(af==AF_INET6) {
+		if(!sx_prefix_parse_v6(&s, end, addr)) goto slow;
+		maxlen=128;
+	} else {
+		goto slow;
+	};
+	if(s<end) {
+		if(*s!='/') goto slow;
+		for(s++, masklen=0, k=0; s<end && k<4 && *s>='0' && *s<='9'; s++, k++)
+			masklen=masklen*10+(*s-'0');
+		if(k==0 || k>3 || (s<end && !isspace((unsigned char)*s)))
+			goto slow;
+	};
+
+	p->family=af;
+	memcpy(p->addr.addrs, addr, af==AF_INET?4:16);
+	p->masklen=(masklen==-1 || masklen>maxlen) ? maxlen : masklen;
+	sx_prefix_adjust_masklen(p);
+	return 1;
+slow:
+	return sx_prefix_parse_slow(p, af, text, len);
+};
+
+int
+sx_prefix_parse(struct sx_prefix* p, int af, char* text)
+{
+	return sx_prefix_parsen(p, af, text, strlen(text));
+};
+
+/* leading zero bits of non-zero x */
+static inline int
+sx_clz32(uint32_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_clz(x);
+#else
+	int n=0;
+	while(!(x&0x80000000u)) {
+		x<<=1;
+		n++;
+	};
+	return n;
+#endif
+};
+
 int
 sx_prefix_isbitset(struct sx_prefix* p, int n)
 {
-	unsigned char s;
-	/* bits outside the prefix considered unset */
-	if(p->family==AF_INET && (n<0 || n>32)) return 0;
-	else if(p->family==AF_INET6 && (n<0 || n>128)) return 0;
-	s=p->addr.addrs[(n-1)/8];
-	return (s&(0x80>>((n-1)%8)))?1:0;
+	/* bits outside the prefix considered unset, n counts from 1 */
+	if(p->family==AF_INET) {
+		if(n<1 || n>32) return 0;
+		return (ntohl(p->addr.addr.s_addr)>>(32-n))&1;
+	} else if(p->family==AF_INET6 && (n<1 || n>128)) return 0;
+	return (p->addr.addrs[(n-1)>>3]>>(7-((n-1)&7)))&1;
 };
 
 void
@@ -218,6 +369,8 @@ sx_prefix_range_parse(struct sx_radix_tree* tree, int af, int maxlen,
 			"masklen %u\n", text, p.masklen, maxlen);
 		return 0;
 	};
+	if (!maxlen)
+		maxlen = p.family == AF_INET ? 32 : 128;
 	if (d[1] == '-') {
 		min=p.masklen+1;
 		max=maxlen;
@@ -227,6 +380,7 @@ sx_prefix_range_parse(struct sx_radix_tree* tree, int af, int maxlen,
 	} else if (isdigit(d[1])) {
 		char* dm = NULL;
 		min = strtoul(d+1, &dm, 10);
+		max = min;
 		if (dm && *dm == '-' && isdigit(dm[1])) {
 			max = strtoul(dm+1, NULL, 10);
 		} else if (dm && *dm) {
@@ -255,7 +409,8 @@ sx_prefix_range_parse(struct sx_radix_tree* tree, int af, int maxlen,
 		max = maxlen;
 	SX_DEBUG(debug_expander, "parsed prefix-range %s as %lu-%lu (maxlen: %u)\n",
 		text, min, max, maxlen);
-	sx_radix_tree_insert_specifics(tree, p, min, max);
+	if (min <= max)
+		sx_radix_tree_insert_range(tree, &p, min, max);
 	return 1;
 };
 
@@ -276,29 +431,125 @@ sx_prefix_new(int af, char* text)
 	return p;
 };
 
+static int
+sx_ntop4(const unsigned char* a, char* out)
+{
+	char* o=out;
+	int i;
+	for(i=0; i<4; i++) {
+		unsigned v=a[i];
+		if(i) *o++='.';
+		if(v>=100) {
+			*o++='0'+v/100;
+			v%=100;
+			*o++='0'+v/10;
+		} else if(v>=10) {
+			*o++='0'+v/10;
+		};
+		*o++='0'+v%10;
+	};
+	*o=0;
+	return o-out;
+};
+
+/* same text as inet_ntop: longest run of two or more zero groups (the
+ * first one on a tie) becomes '::', ::a.b.c.d and ::ffff:a.b.c.d keep
+ * the dotted quad */
+static int
+sx_ntop6(const unsigned char* a, char* out)
+{
+	static const char hex[]="0123456789abcdef";
+	unsigned words[8];
+	int i, base=-1, len=0, cbase=-1, clen=0;
+	char* o=out;
+
+	for(i=0; i<8; i++) {
+		words[i]=(a[2*i]<<8)|a[2*i+1];
+		if(!words[i]) {
+			if(cbase==-1) {
+				cbase=i;
+				clen=0;
+			};
+			if(++clen>len) {
+				base=cbase;
+				len=clen;
+			};
+		} else {
+			cbase=-1;
+		};
+	};
+	if(len<2) base=-1;
+
+	for(i=0; i<8; i++) {
+		unsigned w=words[i];
+		if(base!=-1 && i>=base && i<base+len) {
+			if(i==base) *o++=':';
+			continue;
+		};
+		if(i) *o++=':';
+		if(i==6 && base==0 && (len==6 || (len==5 && words[5]==0xffff)))
+			return o-out+sx_ntop4(a+12, o);
+		if(w>=0x1000) *o++=hex[w>>12];
+		if(w>=0x100) *o++=hex[(w>>8)&0xf];
+		if(w>=0x10) *o++=hex[(w>>4)&0xf];
+		*o++=hex[w&0xf];
+	};
+	if(base!=-1 && base+len==8) *o++=':';
+	*o=0;
+	return o-out;
+};
+
+/* address text of p into out (INET6_ADDRSTRLEN bytes), returns length */
+int
+sx_prefix_ntop(struct sx_prefix* p, char* out)
+{
+	if(p->family==AF_INET)
+		return sx_ntop4(p->addr.addrs, out);
+	return sx_ntop6(p->addr.addrs, out);
+};
+
+static int
+sx_utoa(unsigned v, char* out)
+{
+	char* o=out;
+	if(v>=100) *o++='0'+v/100;
+	if(v>=10) *o++='0'+(v/10)%10;
+	*o++='0'+v%10;
+	*o=0;
+	return o-out;
+};
+
 int
 sx_prefix_fprint(FILE* f, struct sx_prefix* p)
 {
-	char buffer[128];
+	char buffer[INET6_ADDRSTRLEN];
 	if(!p) {
 		fprintf(f?f:stdout,"(null)");
 		return 0;
 	};
-	inet_ntop(p->family,&p->addr,buffer,sizeof(buffer));
+	sx_prefix_ntop(p, buffer);
 	return fprintf(f?f:stdout,"%s/%i",buffer,p->masklen);
 };
 
 int
 sx_prefix_snprintf_sep(struct sx_prefix* p, char* rbuffer, int srb, char* sep)
 {
-	char buffer[128];
+	int len, slen;
 	if(!sep) sep="/";
 	if(!p) {
 		snprintf(rbuffer,srb,"(null)");
 		return 0;
 	};
-	inet_ntop(p->family,&p->addr,buffer,sizeof(buffer));
-	return snprintf(rbuffer,srb,"%s%s%i",buffer,sep,p->masklen);
+	slen=strlen(sep);
+	if(srb<INET6_ADDRSTRLEN+slen+4) {
+		char buffer[INET6_ADDRSTRLEN];
+		sx_prefix_ntop(p, buffer);
+		return snprintf(rbuffer,srb,"%s%s%i",buffer,sep,p->masklen);
+	};
+	len=sx_prefix_ntop(p, rbuffer);
+	memcpy(rbuffer+len, sep, slen);
+	len+=slen;
+	return len+sx_utoa(p->masklen, rbuffer+len);
 };
 
 int
@@ -307,6 +558,16 @@ sx_prefix_snprintf(struct sx_prefix* p, char* rbuffer, int srb)
 	return sx_prefix_snprintf_sep(p, rbuffer, srb, "/");
 };
 
+/* address text at buffer+off, returns the new offset */
+static unsigned
+sx_prefix_fmt_addr(struct sx_prefix* p, char* buffer, unsigned off, int size)
+{
+	if(size-off>=INET6_ADDRSTRLEN)
+		return off+sx_prefix_ntop(p, buffer+off);
+	inet_ntop(p->family,&p->addr,buffer+off,size-off);
+	return strlen(buffer);
+};
+
 int
 sx_prefix_snprintf_fmt(struct sx_prefix* p, char* buffer, int size,
 	const char* name, const char* format)
@@ -319,8 +580,7 @@ sx_prefix_snprintf_fmt(struct sx_prefix* p, char* buffer, int size,
 			switch(*(c+1)) {
 				case 'r':
 				case 'n':
-					inet_ntop(p->family,&p->addr,buffer+off,size-off);
-					off=strlen(buffer);
+					off=sx_prefix_fmt_addr(p, buffer, off, size);
 					break;
 				case 'l':
 					off+=snprintf(buffer+off,size-off,"%i",p->masklen);
@@ -333,13 +593,11 @@ sx_prefix_snprintf_fmt(struct sx_prefix* p, char* buffer, int size,
 					break;
 				case 'm':
 					sx_prefix_mask(p, &q);
-					inet_ntop(p->family,&q.addr,buffer+off,size-off);
-					off=strlen(buffer);
+					off=sx_prefix_fmt_addr(&q, buffer, off, size);
 					break;
 				case 'i':
 					sx_prefix_imask(p, &q);
-					inet_ntop(p->family,&q.addr,buffer+off,size-off);
-					off=strlen(buffer);
+					off=sx_prefix_fmt_addr(&q, buffer, off, size);
 					break;
 				default :
 					sx_report(SX_ERROR, "Unknown format char '%c'\n", *(c+1));
@@ -370,13 +628,58 @@ sx_prefix_snprintf_fmt(struct sx_prefix* p, char* buffer, int size,
 int
 sx_prefix_jsnprintf(struct sx_prefix* p, char* rbuffer, int srb)
 {
-	char buffer[128];
-	if(!p) {
-		snprintf(rbuffer,srb,"(null)");
+	return sx_prefix_snprintf_sep(p, rbuffer, srb, "\\/");
+};
+
+#if HAVE_LIBPTHREAD
+/* aggregation workers add segments to the tree they work on together */
+static pthread_mutex_t sx_radix_grow_lock=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* one more segment to allocate nodes of t from, slot 0 is its header */
+static int
+sx_radix_tree_grow(struct sx_radix_tree* t)
+{
+	struct sx_radix_tree* o=t->owner?t->owner:t;
+	struct sx_radix_segment* seg;
+	unsigned index;
+	void* p;
+	int ok=0;
+
+	if(posix_memalign(&p, SX_RADIX_SEGMENT, SX_RADIX_SEGMENT)) {
+		errno=ENOMEM;
+		return 0;
+	};
+	seg=p;
+#if HAVE_LIBPTHREAD
+	if(t->owner)
+		pthread_mutex_lock(&sx_radix_grow_lock);
+#endif
+	index=o->nsegments;
+	if(index==SX_RADIX_DIR*SX_RADIX_LEAF) {
+		errno=ENOMEM;
+	} else if(!o->dir[index/SX_RADIX_LEAF] &&
+		!(o->dir[index/SX_RADIX_LEAF]=calloc(SX_RADIX_LEAF,
+		sizeof(struct sx_radix_segment*)))) {
+		errno=ENOMEM;
+	} else {
+		o->dir[index/SX_RADIX_LEAF][index%SX_RADIX_LEAF]=seg;
+		o->nsegments++;
+		ok=1;
+	};
+#if HAVE_LIBPTHREAD
+	if(t->owner)
+		pthread_mutex_unlock(&sx_radix_grow_lock);
+#endif
+	if(!ok) {
+		free(p);
 		return 0;
 	};
-	inet_ntop(p->family,&p->addr,buffer,sizeof(buffer));
-	return snprintf(rbuffer,srb,"%s\\/%i",buffer,p->masklen);
+	seg->tree=o;
+	seg->index=index;
+	t->next=(struct sx_radix_node*)seg+1;
+	t->end=(struct sx_radix_node*)seg+SX_RADIX_SEGMENT_NODES;
+	return 1;
 };
 
 struct sx_radix_tree*
@@ -391,6 +694,32 @@ sx_radix_tree_new(int af)
 	return rt;
 };
 
+void
+sx_radix_tree_destroy(struct sx_radix_tree* t)
+{
+	unsigned i;
+	if(!t) return;
+	for(i=0; i<t->nsegments; i++)
+		free(t->dir[i/SX_RADIX_LEAF][i%SX_RADIX_LEAF]);
+	for(i=0; i<SX_RADIX_DIR && t->dir[i]; i++)
+		free(t->dir[i]);
+	free(t);
+};
+
+/* exchange contents of a and b, segments follow their nodes */
+static void
+sx_radix_tree_swap(struct sx_radix_tree* a, struct sx_radix_tree* b)
+{
+	struct sx_radix_tree tmp=*a;
+	unsigned i;
+	*a=*b;
+	*b=tmp;
+	for(i=0; i<a->nsegments; i++)
+		a->dir[i/SX_RADIX_LEAF][i%SX_RADIX_LEAF]->tree=a;
+	for(i=0; i<b->nsegments; i++)
+		b->dir[i/SX_RADIX_LEAF][i%SX_RADIX_LEAF]->tree=b;
+};
+
 int
 sx_radix_tree_empty(struct sx_radix_tree* t)
 {
@@ -398,10 +727,17 @@ sx_radix_tree_empty(struct sx_radix_tree* t)
 };
 
 struct sx_radix_node*
-sx_radix_node_new(struct sx_prefix* prefix)
+sx_radix_node_new(struct sx_radix_tree* t, struct sx_prefix* prefix)
 {
-	struct sx_radix_node* rn=malloc(sizeof(struct sx_radix_node));
-	if(!rn) return NULL;
+	struct sx_radix_node* rn;
+	if(t->freelist) {
+		rn=t->freelist;
+		t->freelist=sx_radix_parent(rn);
+	} else if(t->next<t->end || sx_radix_tree_grow(t)) {
+		rn=t->next++;
+	} else {
+		return NULL;
+	};
 	memset(rn,0,sizeof(struct sx_radix_node));
 	if(prefix) {
 		rn->prefix=*prefix; /* structure copy */
@@ -409,23 +745,35 @@ sx_radix_node_new(struct sx_prefix* prefix)
 	return rn;
 };
 
+/* number of leading bits a and b share, capped by the shorter masklen */
 int
 sx_prefix_eqbits(struct sx_prefix* a, struct sx_prefix* b)
 {
-	int i;
-	int nbytes=(a->family==AF_INET?4:16);
-	for(i=0;i<nbytes;i++) {
-		if(a->addr.addrs[i]==b->addr.addrs[i]) continue;
-		else {
-			int j;
-			for(j=0;j<8 && i*8+j<=a->masklen && i*8+j<=b->masklen;j++) {
-				if((a->addr.addrs[i]&(0x80>>j))!=(b->addr.addrs[i]&(0x80>>j)))
-					return i*8+j;
+	int eq, minlen=(a->masklen<b->masklen)?a->masklen:b->masklen;
+	uint32_t x;
+
+	if(a->family==AF_INET) {
+		x=ntohl(a->addr.addr.s_addr^b->addr.addr.s_addr);
+		eq=x?sx_clz32(x):32;
+	} else {
+		uint64_t qa, qb;
+		uint32_t w[2];
+		int i;
+		for(eq=0, i=0; i<16; i+=8, eq+=64) {
+			memcpy(&qa, a->addr.addrs+i, 8);
+			memcpy(&qb, b->addr.addrs+i, 8);
+			if(qa==qb) continue;
+			qa^=qb;
+			memcpy(w, &qa, 8);	/* network order: w[0] is the high half */
+			if((x=ntohl(w[0]))==0) {
+				eq+=32;
+				x=ntohl(w[1]);
 			};
+			eq+=sx_clz32(x);
+			break;
 		};
 	};
-	if(a->masklen<b->masklen) return a->masklen;
-	return b->masklen;
+	return eq<minlen?eq:minlen;
 };
 
 struct sx_prefix*
@@ -437,66 +785,87 @@ sx_prefix_overlay(struct sx_prefix* p, int n)
 	return sp;
 };
 
+/* hand node (and aggregation sons hanging off it) back to the tree */
+static void
+sx_radix_node_release(struct sx_radix_tree* tree, struct sx_radix_node* node)
+{
+	struct sx_radix_node* son;
+	while(node) {
+		son=sx_radix_son(node);
+		node->parent=sx_radix_link(tree->freelist);
+		tree->freelist=node;
+		node=son;
+	};
+};
+
 void
 sx_radix_tree_unlink(struct sx_radix_tree* tree, struct sx_radix_node* node)
 {
+	struct sx_radix_node* parent;
 next:
 	if(node->r && node->l) {
 		node->isGlue=1;
 	} else if(node->r) {
-		if(node->parent) {
-			if(node->parent->r==node) {
-				node->parent->r=node->r;
-				node->r->parent=node->parent;
-			} else if(node->parent->l==node) {
-				node->parent->l=node->r;
-				node->r->parent=node->parent;
+		if((parent=sx_radix_parent(node))) {
+			if(parent->r==sx_radix_link(node)) {
+				parent->r=node->r;
+				sx_radix_right(node)->parent=node->parent;
+			} else if(parent->l==sx_radix_link(node)) {
+				parent->l=node->r;
+				sx_radix_right(node)->parent=node->parent;
 			} else {
 				sx_report(SX_ERROR,"Unlinking node which is not descendant "
 					"of its parent\n");
 			};
 		} else if(tree->head==node) {
 			/* only one case, really */
-			tree->head=node->r;
-			node->r->parent=NULL;
+			tree->head=sx_radix_right(node);
+			sx_radix_right(node)->parent=0;
 		} else {
 			sx_report(SX_ERROR,"Unlinking node with no parent and not root\n");
+			return;
 		};
+		sx_radix_node_release(tree, node);
 		return;
 	} else if(node->l) {
-		if(node->parent) {
-			if(node->parent->r==node) {
-				node->parent->r=node->l;
-				node->l->parent=node->parent;
-			} else if(node->parent->l==node) {
-				node->parent->l=node->l;
-				node->l->parent=node->parent;
+		if((parent=sx_radix_parent(node))) {
+			if(parent->r==sx_radix_link(node)) {
+				parent->r=node->l;
+				sx_radix_left(node)->parent=node->parent;
+			} else if(parent->l==sx_radix_link(node)) {
+				parent->l=node->l;
+				sx_radix_left(node)->parent=node->parent;
 			} else {
 				sx_report(SX_ERROR,"Unlinking node which is not descendant "
 					"of its parent\n");
 			};
 		} else if(tree->head==node) {
-			tree->head=node->l;
-			node->l->parent=NULL;
+			tree->head=sx_radix_left(node);
+			sx_radix_left(node)->parent=0;
 		} else {
 			sx_report(SX_ERROR,"Unlinking node with no parent and not root\n");
+			return;
 		};
+		sx_radix_node_release(tree, node);
 		return;
 	} else {
 		/* the only case - node does not have descendants */
-		if(node->parent) {
-			if(node->parent->l==node) node->parent->l=NULL;
-			else if(node->parent->r==node) node->parent->r=NULL;
+		if((parent=sx_radix_parent(node))) {
+			if(sx_radix_left(parent)==node) parent->l=0;
+			else if(sx_radix_right(parent)==node) parent->r=0;
 			else {
 				sx_report(SX_ERROR,"Unlinking node which is not descendant "
 					"of its parent\n");
+				return;
 			};
-			if(node->parent->isGlue) {
-				node=node->parent;
+			sx_radix_node_release(tree, node);
+			if(parent->isGlue) {
+				node=parent;
 				goto next;
 			};
 		} else if(tree->head==node) {
 			tree->head=NULL;
+			sx_radix_node_release(tree, node);
 		} else {
 			sx_report(SX_ERROR,"Unlinking node with no parent and not root\n");
 		};
@@ -532,7 +901,7 @@ next:
 				if(!chead->isGlue) {
 					candidate=chead;
 				};
-				chead=chead->r;
+				chead=sx_radix_right(chead);
 				goto next;
 			} else {
 				if(chead->isGlue) return candidate;
@@ -543,7 +912,7 @@ next:
 				if(!chead->isGlue) {
 					candidate=chead;
 				};
-				chead=chead->l;
+				chead=sx_radix_left(chead);
 				goto next;
 			} else {
 				if(chead->isGlue) return candidate;
@@ -560,86 +929,169 @@ next:
 	};
 };
 
+struct sx_radix_node*
+sx_radix_tree_lookup_exact(struct sx_radix_tree* tree, struct sx_prefix* prefix)
+{
+	struct sx_radix_node* node=sx_radix_tree_lookup(tree, prefix);
+	if(node && node->prefix.masklen==prefix->masklen)
+		return node;
+	return NULL;
+};
+
+/* prefix-ranges live on the node of their base prefix: the node itself
+ * holds one length range (aggregateLow-aggregateHi when isAggregate, its
+ * own masklen otherwise, nothing when glue), further disjoint ranges hang
+ * off it as aggregate sons, the same shape aggregation produces */
+static struct sx_radix_node*
+sx_radix_node_add_son(struct sx_radix_tree* tree, struct sx_radix_node* node,
+	unsigned lo, unsigned hi)
+{
+	struct sx_radix_node* son=sx_radix_node_new(tree, &node->prefix);
+	if(!son) {
+		sx_report(SX_ERROR,"Unable to create node: %s\n", strerror(errno));
+		return NULL;
+	};
+	son->isAggregate=1;
+	son->aggregateLow=lo;
+	son->aggregateHi=hi;
+	while(node->son)
+		node=sx_radix_son(node);
+	node->son=sx_radix_link(son);
+	return son;
+};
+
+static int
+sx_radix_node_add_range(struct sx_radix_tree* tree, struct sx_radix_node* node,
+	unsigned lo, unsigned hi)
+{
+	struct sx_radix_node* n;
+	unsigned m=node->prefix.masklen, nlo, nhi;
+
+	for(n=node; n; n=sx_radix_son(n)) {
+		if(n->isGlue)
+			continue;
+		nlo=n->isAggregate?n->aggregateLow:m;
+		nhi=n->isAggregate?n->aggregateHi:m;
+		if(lo>nhi+1 || hi+1<nlo)
+			continue;
+		/* overlapping or adjacent, widen in place */
+		if(lo<nlo) nlo=lo;
+		if(hi>nhi) nhi=hi;
+		n->isAggregate=(nlo!=m || nhi!=m);
+		n->aggregateLow=n->isAggregate?nlo:0;
+		n->aggregateHi=n->isAggregate?nhi:0;
+		return 1;
+	};
+	if(!node->isGlue) {
+		if(lo!=m)
+			return sx_radix_node_add_son(tree, node, lo, hi)?1:0;
+		/* range starting at masklen belongs to the node itself, so the
+		 * one it holds now moves down */
+		if(!sx_radix_node_add_son(tree, node, node->aggregateLow,
+			node->aggregateHi))
+			return 0;
+	};
+	node->isGlue=0;
+	node->isAggregate=(lo!=m || hi!=m);
+	node->aggregateLow=node->isAggregate?lo:0;
+	node->aggregateHi=node->isAggregate?hi:0;
+	return 1;
+};
+
+
+/* other takes the place of node under node's parent */
+static void
+sx_radix_node_replace(struct sx_radix_tree* tree, struct sx_radix_node* node,
+	struct sx_radix_node* other)
+{
+	struct sx_radix_node* parent=sx_radix_parent(node);
+	if(!parent)
+		tree->head=other;
+	else if(sx_radix_left(parent)==node)
+		parent->l=sx_radix_link(other);
+	else
+		parent->r=sx_radix_link(other);
+};
 
 struct sx_radix_node*
 sx_radix_tree_insert(struct sx_radix_tree* tree, struct sx_prefix* prefix)
 {
 	int eb;
-	struct sx_radix_node** candidate=NULL, *chead;
+	struct sx_radix_node* chead;
 
 	if(!tree || !prefix) return NULL;
 	if(tree->family!=prefix->family) {
 		return NULL;
 	};
 	if(!tree->head) {
-		tree->head=sx_radix_node_new(prefix);
+		tree->head=sx_radix_node_new(tree,prefix);
 		return tree->head;
 	};
-	candidate=&tree->head;
 	chead=tree->head;
 
 next:
 	eb=sx_prefix_eqbits(prefix,&chead->prefix);
 	if(eb<prefix->masklen && eb<chead->prefix.masklen) {
 		struct sx_prefix neoRoot=*prefix;
-		struct sx_radix_node* rn, *ret=sx_radix_node_new(prefix);
+		struct sx_radix_node* rn, *ret=sx_radix_node_new(tree,prefix);
 		neoRoot.masklen=eb;
 		sx_prefix_adjust_masklen(&neoRoot);
-		rn=sx_radix_node_new(&neoRoot);
+		rn=sx_radix_node_new(tree,&neoRoot);
 		if(!rn) {
 			sx_report(SX_ERROR,"Unable to create node: %s\n", strerror(errno));
 			return NULL;
 		};
 		if(sx_prefix_isbitset(prefix,eb+1)) {
-			rn->l=chead;
-			rn->r=ret;
+			rn->l=sx_radix_link(chead);
+			rn->r=sx_radix_link(ret);
 		} else {
-			rn->l=ret;
-			rn->r=chead;
+			rn->l=sx_radix_link(ret);
+			rn->r=sx_radix_link(chead);
 		};
+		sx_radix_node_replace(tree, chead, rn);
 		rn->parent=chead->parent;
-		chead->parent=rn;
-		ret->parent=rn;
+		chead->parent=sx_radix_link(rn);
+		ret->parent=sx_radix_link(rn);
 		rn->isGlue=1;
-		*candidate=rn;
 		return ret;
 	} else if(eb==prefix->masklen && eb<chead->prefix.masklen) {
-		struct sx_radix_node* ret=sx_radix_node_new(prefix);
+		struct sx_radix_node* ret=sx_radix_node_new(tree,prefix);
 		if(sx_prefix_isbitset(&chead->prefix,eb+1)) {
-			ret->r=chead;
+			ret->r=sx_radix_link(chead);
 		} else {
-			ret->l=chead;
+			ret->l=sx_radix_link(chead);
 		};
+		sx_radix_node_replace(tree, chead, ret);
 		ret->parent=chead->parent;
-		chead->parent=ret;
-		*candidate=ret;
+		chead->parent=sx_radix_link(ret);
 		return ret;
 	} else if(eb==chead->prefix.masklen && eb<prefix->masklen) {
 		if(sx_prefix_isbitset(prefix,eb+1)) {
 			if(chead->r) {
-				candidate=&chead->r;
-				chead=chead->r;
+				chead=sx_radix_right(chead);
 				goto next;
 			} else {
-				chead->r=sx_radix_node_new(prefix);
-				chead->r->parent=chead;
-				return chead->r;
+				chead->r=sx_radix_link(sx_radix_node_new(tree,prefix));
+				sx_radix_right(chead)->parent=sx_radix_link(chead);
+				return sx_radix_right(chead);
 			};
 		} else {
 			if(chead->l) {
-				candidate=&chead->l;
-				chead=chead->l;
+				chead=sx_radix_left(chead);
 				goto next;
 			} else {
-				chead->l=sx_radix_node_new(prefix);
-				chead->l->parent=chead;
-				return chead->l;
+				chead->l=sx_radix_link(sx_radix_node_new(tree,prefix));
+				sx_radix_left(chead)->parent=sx_radix_link(chead);
+				return sx_radix_left(chead);
 			};
 		};
 	} else if(eb==chead->prefix.masklen && eb==prefix->masklen) {
 		/* equal routes... */
 		if(chead->isGlue) {
 			chead->isGlue=0;
+			chead->isAggregate=0;
+		} else if(chead->isAggregate) {
+			sx_radix_node_add_range(tree, chead, eb, eb);
 		};
 		return chead;
 	} else {
@@ -652,345 +1104,2170 @@ next:
 	};
 };
 
-void
-sx_radix_node_fprintf(struct sx_radix_node* node, void* udata)
+/* prefix with all its more-specifics of lengths lo-hi, as one entry */
+struct sx_radix_node*
+sx_radix_tree_insert_range(struct sx_radix_tree* tree, struct sx_prefix* prefix,
+	unsigned lo, unsigned hi)
 {
-	FILE* out=(udata?udata:stdout);
-	char buffer[128];
-	if(!node) {
-		fprintf(out,"(null)\n");
-	} else {
-		sx_prefix_snprintf(&node->prefix,buffer,sizeof(buffer));
-		fprintf(out,"%s %s\n", buffer, node->isGlue?"(glue)":"");
+	struct sx_radix_node* node;
+
+	if(!tree || !prefix || lo>hi || lo<(unsigned)prefix->masklen)
+		return NULL;
+	if((node=sx_radix_tree_lookup_exact(tree, prefix))) {
+		if(!sx_radix_node_add_range(tree, node, lo, hi))
+			return NULL;
+		return node;
+	};
+	if(!(node=sx_radix_tree_insert(tree, prefix)))
+		return NULL;
+	if(lo!=hi || lo!=(unsigned)prefix->masklen) {
+		node->isAggregate=1;
+		node->aggregateLow=lo;
+		node->aggregateHi=hi;
 	};
+	return node;
 };
 
-int
-sx_radix_node_foreach(struct sx_radix_node* node,
-	void (*func)(struct sx_radix_node*, void*), void* udata)
+/* one step of a match: notes the entry of chead accepting prefix, if any,
+ * returns the next node to visit or NULL when the walk is over */
+static inline struct sx_radix_node*
+sx_radix_match_step(struct sx_radix_node* chead, struct sx_prefix* prefix,
+	struct sx_radix_node** found)
 {
-	func(node,udata);
-	if(node->l) sx_radix_node_foreach(node->l,func,udata);
-	if(node->r) sx_radix_node_foreach(node->r,func,udata);
-	return 0;
+	struct sx_radix_node* n;
+	unsigned m=prefix->masklen;
+
+	if(sx_prefix_eqbits(&chead->prefix, prefix)<chead->prefix.masklen)
+		return NULL;
+	for(n=chead; n; n=sx_radix_son(n)) {
+		if(n->isGlue)
+			continue;
+		if(n->isAggregate?(m>=n->aggregateLow && m<=n->aggregateHi):
+			m==(unsigned)n->prefix.masklen) {
+			*found=n;
+			break;
+		};
+	};
+	if((unsigned)chead->prefix.masklen>=m)
+		return NULL;
+	return sx_prefix_isbitset(prefix, chead->prefix.masklen+1)?
+		sx_radix_right(chead):sx_radix_left(chead);
 };
 
-int
-sx_radix_tree_foreach(struct sx_radix_tree* tree,
-	void (*func)(struct sx_radix_node*, void*), void* udata)
+/* entry accepting prefix: the deepest covering node whose own range or one
+ * of its sons includes prefix's masklen, NULL when nothing does */
+struct sx_radix_node*
+sx_radix_tree_match(struct sx_radix_tree* tree, struct sx_prefix* prefix)
 {
-	if(!func || !tree || !tree->head) return 0;
-	sx_radix_node_foreach(tree->head,func,udata);
-	return 0;
+	struct sx_radix_node* chead, *found=NULL;
+
+	if(!tree || !prefix || tree->family!=prefix->family)
+		return NULL;
+	for(chead=tree->head; chead; )
+		chead=sx_radix_match_step(chead, prefix, &found);
+	return found;
 };
 
+#if defined(__GNUC__)
+#define SX_PREFETCH(a) __builtin_prefetch(a)
+#else
+#define SX_PREFETCH(a)
+#endif
+
+/* lookups run SX_MATCH_LANES at a time, one step each in turn, so the
+ * cache miss on one lane's next node overlaps the work on the others */
+#define SX_MATCH_LANES 16
+
 int
-sx_radix_node_aggregate(struct sx_radix_node* node)
+sx_radix_tree_match_batch(struct sx_radix_tree* tree, struct sx_prefix* p,
+	int n, struct sx_radix_node** found)
 {
-	if(node->l)
-		sx_radix_node_aggregate(node->l);
-	if(node->r)
-		sx_radix_node_aggregate(node->r);
+	struct sx_radix_node* cur[SX_MATCH_LANES];
+	int base, i, k, active;
 
-	if(debug_aggregation) {
-		printf("Aggregating on node: ");
-		sx_prefix_fprint(stdout,&node->prefix);
-		printf(" %s%s%u,%u\n", node->isGlue?"Glue ":"",
-			node->isAggregate?"Aggregate ":"",node->aggregateLow,
-			node->aggregateHi);
-		if(node->r) {
-			printf("R-Tree: ");
-			sx_prefix_fprint(stdout,&node->r->prefix);
-			printf(" %s%s%u,%u\n", (node->r->isGlue)?"Glue ":"",
-				(node->r->isAggregate)?"Aggregate ":"",
-				node->r->aggregateLow,node->r->aggregateHi);
-			if(node->r->son) {
-			printf("R-Son: ");
-			sx_prefix_fprint(stdout,&node->r->son->prefix);
-			printf(" %s%s%u,%u\n",node->r->son->isGlue?"Glue ":"",
-				node->r->son->isAggregate?"Aggregate ":"",
-				node->r->son->aggregateLow,node->r->son->aggregateHi);
-			};
+	if(!tree)
+		return 0;
+	for(base=0; base<n; base+=SX_MATCH_LANES) {
+		k=n-base<SX_MATCH_LANES?n-base:SX_MATCH_LANES;
+		for(i=0; i<k; i++) {
+			found[base+i]=NULL;
+			cur[i]=(tree->family==p[base+i].family)?tree->head:NULL;
 		};
-		if(node->l) {
-			printf("L-Tree: ");
-			sx_prefix_fprint(stdout,&node->l->prefix);
-			printf(" %s%s%u,%u\n",node->l->isGlue?"Glue ":"",
-				node->l->isAggregate?"Aggregate ":"",
-				node->l->aggregateLow,node->l->aggregateHi);
-			if(node->l->son) {
-			printf("L-Son: ");
-			sx_prefix_fprint(stdout,&node->l->son->prefix);
-			printf(" %s%s%u,%u\n",node->l->son->isGlue?"Glue ":"",
-				node->l->son->isAggregate?"Aggregate ":"",
-				node->l->son->aggregateLow,node->l->son->aggregateHi);
+		do {
+			active=0;
+			for(i=0; i<k; i++) {
+				if(!cur[i])
+					continue;
+				cur[i]=sx_radix_match_step(cur[i], p+base+i, found+base+i);
+				if(cur[i]) {
+					SX_PREFETCH(cur[i]);
+					active=1;
+				};
 			};
-		};
+		} while(active);
 	};
+	return n;
+};
 
-	if(node->r && node->l) {
-		if(!node->r->isAggregate && !node->l->isAggregate &&
-			!node->r->isGlue && !node->l->isGlue &&
-			node->r->prefix.masklen==node->l->prefix.masklen) {
-			if(node->r->prefix.masklen==node->prefix.masklen+1) {
-				node->isAggregate=1;
-				node->r->isGlue=1;
-				node->l->isGlue=1;
-				node->aggregateHi=node->r->prefix.masklen;
-				if(node->isGlue) {
-					node->isGlue=0;
-					node->aggregateLow=node->r->prefix.masklen;
-				} else {
-					node->aggregateLow=node->prefix.masklen;
-				};
-			};
-			if(node->r->son && node->l->son &&
-				node->r->son->isAggregate && node->l->son->isAggregate &&
-				node->r->son->aggregateHi==node->l->son->aggregateHi &&
-				node->r->son->aggregateLow==node->l->son->aggregateLow &&
-				node->r->prefix.masklen==node->prefix.masklen+1 &&
-				node->l->prefix.masklen==node->prefix.masklen+1)
-			{
-				node->son=sx_radix_node_new(&node->prefix);
-				node->son->isGlue=0;
-				node->son->isAggregate=1;
-				node->son->aggregateHi=node->r->son->aggregateHi;
-				node->son->aggregateLow=node->r->son->aggregateLow;
-				node->r->son->isGlue=1;
-				node->l->son->isGlue=1;
-			};
-		} else if(node->r->isAggregate && node->l->isAggregate &&
-			node->r->aggregateHi==node->l->aggregateHi &&
-			node->r->aggregateLow==node->l->aggregateLow) {
-			if(node->r->prefix.masklen==node->prefix.masklen+1 &&
-				node->l->prefix.masklen==node->prefix.masklen+1) {
-				if(node->isGlue) {
-					node->r->isGlue=1;
-					node->l->isGlue=1;
-					node->isAggregate=1;
-					node->isGlue=0;
-					node->aggregateHi=node->r->aggregateHi;
-					node->aggregateLow=node->r->aggregateLow;
-				} else if(node->r->prefix.masklen==node->r->aggregateLow) {
-					node->r->isGlue=1;
-					node->l->isGlue=1;
-					node->isAggregate=1;
-					node->aggregateHi=node->r->aggregateHi;
-					node->aggregateLow=node->prefix.masklen;
-				} else {
-					node->son=sx_radix_node_new(&node->prefix);
-					node->son->isGlue=0;
-					node->son->isAggregate=1;
-					node->son->aggregateHi=node->r->aggregateHi;
-					node->son->aggregateLow=node->r->aggregateLow;
-					node->r->isGlue=1;
-					node->l->isGlue=1;
-					if(node->r->son && node->l->son &&
-						node->r->son->aggregateHi==node->l->son->aggregateHi &&
-						node->r->son->aggregateLow==node->l->son->aggregateLow)
-					{
-						node->son->son=sx_radix_node_new(&node->prefix);
-						node->son->son->isGlue=0;
-						node->son->son->isAggregate=1;
-						node->son->son->aggregateHi=node->r->son->aggregateHi;
-						node->son->son->aggregateLow=node->r->son->aggregateLow;
-						node->r->son->isGlue=1;
-						node->l->son->isGlue=1;
-					};
-				};
-			};
-		} else if(node->l->son &&
-			node->r->isAggregate && node->l->son->isAggregate &&
-			node->r->aggregateHi==node->l->son->aggregateHi &&
-			node->r->aggregateLow==node->l->son->aggregateLow) {
-			if(node->r->prefix.masklen==node->prefix.masklen+1 &&
-				node->l->prefix.masklen==node->prefix.masklen+1) {
-				if(node->isGlue) {
-					node->r->isGlue=1;
-					node->l->son->isGlue=1;
-					node->isAggregate=1;
-					node->isGlue=0;
-					node->aggregateHi=node->r->aggregateHi;
-					node->aggregateLow=node->r->aggregateLow;
-				} else {
-					node->son=sx_radix_node_new(&node->prefix);
-					node->son->isGlue=0;
-					node->son->isAggregate=1;
-					node->son->aggregateHi=node->r->aggregateHi;
-					node->son->aggregateLow=node->r->aggregateLow;
-					node->r->isGlue=1;
-					node->l->son->isGlue=1;
-				};
-			};
-		} else if(node->r->son &&
-			node->l->isAggregate && node->r->son->isAggregate &&
-			node->l->aggregateHi==node->r->son->aggregateHi &&
-			node->l->aggregateLow==node->r->son->aggregateLow) {
-			if(node->l->prefix.masklen==node->prefix.masklen+1 &&
-				node->r->prefix.masklen==node->prefix.masklen+1) {
-				if(node->isGlue) {
-					node->l->isGlue=1;
-					node->r->son->isGlue=1;
-					node->isAggregate=1;
-					node->isGlue=0;
-					node->aggregateHi=node->l->aggregateHi;
-					node->aggregateLow=node->l->aggregateLow;
-				} else {
-					node->son=sx_radix_node_new(&node->prefix);
-					node->son->isGlue=0;
-					node->son->isAggregate=1;
-					node->son->aggregateHi=node->l->aggregateHi;
-					node->son->aggregateLow=node->l->aggregateLow;
-					node->l->isGlue=1;
-					node->r->son->isGlue=1;
+/* native ranges back into plain routes, for printers with no way to
+ * express a range */
+int
+sx_radix_tree_expand_ranges(struct sx_radix_tree* tree)
+{
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* node, *n;
+	struct sx_range { struct sx_prefix p; unsigned char lo, hi; } *rv=NULL, *nv;
+	int i, nr=0, sr=0;
+
+	if(!tree || !tree->head)
+		return 0;
+	SX_RADIX_FOREACH(node, &cur, tree) {
+		for(n=node; n; n=sx_radix_son(n)) {
+			if(n->isGlue || !n->isAggregate)
+				continue;
+			if(nr==sr) {
+				sr=sr?sr*2:64;
+				if(!(nv=realloc(rv, sr*sizeof(struct sx_range)))) {
+					sx_report(SX_ERROR,"Unable to allocate %u bytes: %s\n",
+						(unsigned)(sr*sizeof(struct sx_range)), strerror(errno));
+					free(rv);
+					return -1;
 				};
+				rv=nv;
 			};
+			rv[nr].p=node->prefix;
+			rv[nr].lo=n->aggregateLow;
+			rv[nr].hi=n->aggregateHi;
+			nr++;
+		};
+		if(node->son) {
+			sx_radix_node_release(tree, sx_radix_son(node));
+			node->son=0;
+		};
+		if(!node->isGlue && node->isAggregate) {
+			if(node->aggregateLow>node->prefix.masklen)
+				node->isGlue=1;
+			node->isAggregate=0;
 		};
 	};
-	return 0;
+	for(i=0; i<nr; i++)
+		sx_radix_tree_insert_specifics(tree, rv[i].p, rv[i].lo, rv[i].hi);
+	free(rv);
+	return nr;
 };
 
-int
-sx_radix_tree_aggregate(struct sx_radix_tree* tree)
+static int
+sx_prefix_cmp(const void* va, const void* vb)
 {
-	if(tree && tree->head) return sx_radix_node_aggregate(tree->head);
-	return 0;
+	const struct sx_prefix* a=va, *b=vb;
+	int r;
+	if(a->family!=b->family)
+		return a->family<b->family?-1:1;
+	if((r=memcmp(a->addr.addrs, b->addr.addrs, a->family==AF_INET?4:16)))
+		return r;
+	return a->masklen-b->masklen;
 };
 
-static void
-setGlueUpTo(struct sx_radix_node* node, void* udata)
+/* sorts by (family, address, masklen) and drops duplicates, returns the
+ * number of distinct prefixes left at the start of the array */
+int
+sx_prefix_sort(struct sx_prefix* p, int n)
 {
-	unsigned refine=*(unsigned*)udata;
-	if(node && node->prefix.masklen <= refine) {
-		node->isGlue=1;
+	int i, j;
+	if(n<2) return n;
+	qsort(p, n, sizeof(struct sx_prefix), sx_prefix_cmp);
+	for(i=0, j=1; j<n; j++) {
+		if(sx_prefix_cmp(p+i, p+j))
+			p[++i]=p[j];
 	};
+	return i+1;
 };
 
-static void
-sx_radix_node_hyperaggregate(struct sx_radix_node* node, unsigned max)
+/* Builds the tree from prefixes sorted by sx_prefix_sort in one pass.
+ * In that order every prefix comes right after the path to the previous
+ * one, so only that path is kept on a stack instead of descending from
+ * the root each time. Prefixes of other families are skipped, a tree
+ * that is not empty gets them by plain inserts. */
+int
+sx_radix_tree_load(struct sx_radix_tree* tree, struct sx_prefix* p, int n)
 {
-	if(!node->isGlue) {
-		node->isAggregate=0;
-		if(node->l)
-			sx_radix_node_foreach(node->l, setGlueUpTo, &max);
-		if(node->r)
-			sx_radix_node_foreach(node->r, setGlueUpTo, &max);
-	} else {
-		if(node->l)
-			sx_radix_node_hyperaggregate(node->l, max);
-		if(node->r)
-			sx_radix_node_hyperaggregate(node->r, max);
+	/* path from the root, masklens strictly grow along it */
+	struct sx_radix_node* stack[129], *last, *node, *glue, *up;
+	int i, depth=0, eb, loaded=0, right;
+
+	if(!tree) return 0;
+	if(tree->head) {
+		for(i=0; i<n; i++) {
+			if(p[i].family==tree->family && sx_radix_tree_insert(tree, p+i))
+				loaded++;
+		};
+		return loaded;
 	};
-};
+
+	for(i=0; i<n; i++) {
+		if(p[i].family!=tree->family)
+			continue;
+		if(!(node=sx_radix_node_new(tree, p+i))) {
+			sx_report(SX_ERROR,"Unable to create node: %s\n", strerror(errno));
+			return loaded;
+		};
+		loaded++;
+
+		/* unwind to the deepest node covering the new prefix */
+		last=NULL;
+		while(depth>0) {
+			eb=sx_prefix_eqbits(&stack[depth-1]->prefix, p+i);
+			if(eb>=stack[depth-1]->prefix.masklen)
+				break;
+			last=stack[--depth];
+		};
+
+		up=depth?stack[depth-1]:NULL;
+		right=up && sx_prefix_isbitset(p+i, up->prefix.masklen+1);
+		last=up?sx_radix_at(up, right?up->r:up->l):tree->head;
+
+		if(last) {
+			/* sorted order: the new prefix is to the right of the
+			 * subtree we just left and does not cover it */
+			struct sx_prefix neoRoot=p[i];
+			neoRoot.masklen=sx_prefix_eqbits(&last->prefix, p+i);
+			sx_prefix_adjust_masklen(&neoRoot);
+			if(!(glue=sx_radix_node_new(tree, &neoRoot))) {
+				sx_report(SX_ERROR,"Unable to create node: %s\n",
+					strerror(errno));
+				return loaded;
+			};
+			glue->isGlue=1;
+			glue->l=sx_radix_link(last);
+			glue->r=sx_radix_link(node);
+			sx_radix_node_replace(tree, last, glue);
+			glue->parent=last->parent;
+			last->parent=sx_radix_link(glue);
+			node->parent=sx_radix_link(glue);
+			stack[depth++]=glue;
+		} else {
+			node->parent=sx_radix_link(up);
+			if(!up)
+				tree->head=node;
+			else if(right)
+				up->r=sx_radix_link(node);
+			else
+				up->l=sx_radix_link(node);
+		};
+		stack[depth++]=node;
+	};
+	return loaded;
+};
+
+/* Serialized trees: nodes in pre-order, each as
+ *   flags:8 masklen:8 low:8 high:8 address bytes covering masklen
+ * followed by its sons as flags:8 low:8 high:8 (sons share the prefix of
+ * their node), then its left and right subtrees. An empty tree is a
+ * single zero byte. Pointers are rebuilt on reading, nothing is inserted
+ * or searched for. */
+#define SX_RADIX_F_LEFT		0x01
+#define SX_RADIX_F_RIGHT	0x02
+#define SX_RADIX_F_GLUE		0x04
+#define SX_RADIX_F_AGGREGATED	0x08
+#define SX_RADIX_F_AGGREGATE	0x10
+#define SX_RADIX_F_SON		0x20
+#define SX_RADIX_F_NODE		0x40
+
+static unsigned
+sx_radix_node_flags(struct sx_radix_node* node)
+{
+	return (node->isGlue?SX_RADIX_F_GLUE:0) |
+		(node->isAggregated?SX_RADIX_F_AGGREGATED:0) |
+		(node->isAggregate?SX_RADIX_F_AGGREGATE:0) |
+		(sx_radix_son(node)?SX_RADIX_F_SON:0);
+};
+
+static void
+sx_radix_node_set_flags(struct sx_radix_node* node, unsigned flags)
+{
+	node->isGlue=(flags&SX_RADIX_F_GLUE)?1:0;
+	node->isAggregated=(flags&SX_RADIX_F_AGGREGATED)?1:0;
+	node->isAggregate=(flags&SX_RADIX_F_AGGREGATE)?1:0;
+};
+
+static void
+sx_radix_node_write(struct sx_radix_node* node, FILE* f)
+{
+	struct sx_radix_node* son;
+	unsigned char rec[4+16];
+
+	rec[0]=SX_RADIX_F_NODE|sx_radix_node_flags(node)|
+		(sx_radix_left(node)?SX_RADIX_F_LEFT:0)|(node->r?SX_RADIX_F_RIGHT:0);
+	rec[1]=node->prefix.masklen;
+	rec[2]=node->aggregateLow;
+	rec[3]=node->aggregateHi;
+	memcpy(rec+4, node->prefix.addr.addrs, (rec[1]+7)/8);
+	fwrite(rec, 1, 4+(rec[1]+7)/8, f);
+	for(son=sx_radix_son(node); son; son=sx_radix_son(son)) {
+		rec[0]=sx_radix_node_flags(son);
+		rec[1]=son->aggregateLow;
+		rec[2]=son->aggregateHi;
+		fwrite(rec, 1, 3, f);
+	};
+	if(node->l)
+		sx_radix_node_write(sx_radix_left(node), f);
+	if(node->r)
+		sx_radix_node_write(sx_radix_right(node), f);
+};
+
+int
+sx_radix_tree_write(struct sx_radix_tree* tree, FILE* f)
+{
+	if(!tree->head)
+		putc(0, f);
+	else
+		sx_radix_node_write(tree->head, f);
+	return ferror(f)?0:1;
+};
+
+/* length bounds as printers and refinement take them for granted */
+static int
+sx_radix_entry_valid(unsigned flags, unsigned lo, unsigned hi,
+	unsigned masklen, unsigned max)
+{
+	if(lo>hi || hi>max)
+		return 0;
+	if((flags&SX_RADIX_F_AGGREGATE) && lo<masklen)
+		return 0;
+	return 1;
+};
+
+/* a node must lie within its parent, on the side its next bit tells, and
+ * every entry within the lengths of its prefix and family, so whatever is
+ * read is a valid tree. Masklens grow on every level, which bounds the
+ * recursion. */
+static const unsigned char*
+sx_radix_node_read(struct sx_radix_tree* tree, struct sx_radix_node* parent,
+	int right, const unsigned char* p, const unsigned char* end)
+{
+	struct sx_radix_node* node, *son, *last;
+	unsigned flags, sflags, alen, max=tree->family==AF_INET?32:128;
+
+	if(end-p<4 || (p[0]&~0x7f) || !(p[0]&SX_RADIX_F_NODE) || p[1]>max ||
+		!sx_radix_entry_valid(p[0], p[2], p[3], p[1], max))
+		return NULL;
+	alen=(p[1]+7)/8;
+	if((unsigned)(end-p-4)<alen)
+		return NULL;
+	if(!(node=sx_radix_node_new(tree, NULL))) {
+		sx_report(SX_ERROR,"Unable to create node: %s\n", strerror(errno));
+		return NULL;
+	};
+	node->prefix.family=tree->family;
+	node->prefix.masklen=p[1];
+	memcpy(node->prefix.addr.addrs, p+4, alen);
+	sx_prefix_adjust_masklen(&node->prefix);
+	if(parent && (node->prefix.masklen<=parent->prefix.masklen ||
+		sx_prefix_eqbits(&node->prefix, &parent->prefix)<
+		parent->prefix.masklen || sx_prefix_isbitset(&node->prefix,
+		parent->prefix.masklen+1)!=right))
+		return NULL;
+	flags=p[0];
+	sx_radix_node_set_flags(node, flags);
+	node->aggregateLow=p[2];
+	node->aggregateHi=p[3];
+	node->parent=sx_radix_link(parent);
+	if(!parent)
+		tree->head=node;
+	else if(right)
+		parent->r=sx_radix_link(node);
+	else
+		parent->l=sx_radix_link(node);
+	p+=4+alen;
+
+	for(last=node, sflags=flags; sflags&SX_RADIX_F_SON; last=son) {
+		/* a son is there for an aggregate range only */
+		if(end-p<3 || (p[0]&~(SX_RADIX_F_GLUE|SX_RADIX_F_AGGREGATED|
+			SX_RADIX_F_AGGREGATE|SX_RADIX_F_SON)) ||
+			!(p[0]&(SX_RADIX_F_GLUE|SX_RADIX_F_AGGREGATE)) ||
+			!sx_radix_entry_valid(p[0], p[1], p[2],
+			node->prefix.masklen, max))
+			return NULL;
+		if(!(son=sx_radix_node_new(tree, &node->prefix))) {
+			sx_report(SX_ERROR,"Unable to create node: %s\n", strerror(errno));
+			return NULL;
+		};
+		last->son=sx_radix_link(son);
+		sflags=p[0];
+		sx_radix_node_set_flags(son, sflags);
+		son->aggregateLow=p[1];
+		son->aggregateHi=p[2];
+		p+=3;
+	};
+
+	if((flags&SX_RADIX_F_LEFT) &&
+		!(p=sx_radix_node_read(tree, node, 0, p, end)))
+		return NULL;
+	if((flags&SX_RADIX_F_RIGHT) &&
+		!(p=sx_radix_node_read(tree, node, 1, p, end)))
+		return NULL;
+	return p;
+};
+
+/* into an empty tree, returns the end of the tree read or NULL when data
+ * is malformed (what was read so far stays in the tree) */
+const unsigned char*
+sx_radix_tree_read(struct sx_radix_tree* tree, const unsigned char* p,
+	const unsigned char* end)
+{
+	if(!tree || tree->head || p>=end)
+		return NULL;
+	if(!p[0])
+		return p+1;
+	return sx_radix_node_read(tree, NULL, 0, p, end);
+};
+
+void
+sx_radix_node_fprintf(struct sx_radix_node* node, void* udata)
+{
+	FILE* out=(udata?udata:stdout);
+	char buffer[128];
+	if(!node) {
+		fprintf(out,"(null)\n");
+	} else {
+		sx_prefix_snprintf(&node->prefix,buffer,sizeof(buffer));
+		fprintf(out,"%s %s\n", buffer, node->isGlue?"(glue)":"");
+	};
+};
+
+struct sx_radix_node*
+sx_radix_cursor_first(struct sx_radix_cursor* cur, struct sx_radix_node* node)
+{
+	cur->depth=0;
+	return node;
+};
+
+/* pre-order successor of node: right children still to be visited wait
+ * on the cursor stack, there are at most one per level */
+struct sx_radix_node*
+sx_radix_cursor_next(struct sx_radix_cursor* cur, struct sx_radix_node* node)
+{
+	if(node->l) {
+		if(node->r)
+			cur->stack[cur->depth++]=sx_radix_right(node);
+		return sx_radix_left(node);
+	};
+	if(node->r)
+		return sx_radix_right(node);
+	return cur->depth?cur->stack[--cur->depth]:NULL;
+};
+
+/* same, but without descending below node */
+struct sx_radix_node*
+sx_radix_cursor_skip(struct sx_radix_cursor* cur, struct sx_radix_node* node)
+{
+	return cur->depth?cur->stack[--cur->depth]:NULL;
+};
+
+int
+sx_radix_node_foreach(struct sx_radix_node* node,
+	void (*func)(struct sx_radix_node*, void*), void* udata)
+{
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n;
+	for(n=sx_radix_cursor_first(&cur, node); n; n=sx_radix_cursor_next(&cur, n))
+		func(n,udata);
+	return 0;
+};
+
+int
+sx_radix_tree_foreach(struct sx_radix_tree* tree,
+	void (*func)(struct sx_radix_node*, void*), void* udata)
+{
+	if(!func || !tree || !tree->head) return 0;
+	sx_radix_node_foreach(tree->head,func,udata);
+	return 0;
+};
+
+/* sets of masklens 0-128, one bit each */
+
+#define SX_LEVELS_WORDS 3
+
+struct sx_levels {
+	uint64_t w[SX_LEVELS_WORDS];
+};
+
+static void
+sx_levels_set(struct sx_levels* l, unsigned lo, unsigned hi)
+{
+	for(; lo<=hi; lo++)
+		l->w[lo>>6]|=(uint64_t)1<<(lo&63);
+};
+
+static int
+sx_levels_isset(const struct sx_levels* l, unsigned n)
+{
+	return (l->w[n>>6]>>(n&63))&1;
+};
+
+static int
+sx_levels_empty(const struct sx_levels* l)
+{
+	return !(l->w[0]|l->w[1]|l->w[2]);
+};
+
+static int
+sx_levels_eq(const struct sx_levels* a, const struct sx_levels* b)
+{
+	return a->w[0]==b->w[0] && a->w[1]==b->w[1] && a->w[2]==b->w[2];
+};
+
+static int
+sx_levels_meet(const struct sx_levels* a, const struct sx_levels* b)
+{
+	return (a->w[0]&b->w[0]) || (a->w[1]&b->w[1]) || (a->w[2]&b->w[2]);
+};
+
+static struct sx_levels
+sx_levels_and(struct sx_levels a, const struct sx_levels* b)
+{
+	int i;
+	for(i=0; i<SX_LEVELS_WORDS; i++)
+		a.w[i]&=b->w[i];
+	return a;
+};
+
+static struct sx_levels
+sx_levels_or(struct sx_levels a, const struct sx_levels* b)
+{
+	int i;
+	for(i=0; i<SX_LEVELS_WORDS; i++)
+		a.w[i]|=b->w[i];
+	return a;
+};
+
+static struct sx_levels
+sx_levels_andnot(struct sx_levels a, const struct sx_levels* b)
+{
+	int i;
+	for(i=0; i<SX_LEVELS_WORDS; i++)
+		a.w[i]&=~b->w[i];
+	return a;
+};
+
+/* maximal runs of l, as [lo[i], hi[i]] */
+static int
+sx_levels_runs(const struct sx_levels* l, unsigned char* lo, unsigned char* hi)
+{
+	int n=0;
+	unsigned i;
+	for(i=0; i<=128; i++) {
+		if(!sx_levels_isset(l, i))
+			continue;
+		lo[n]=i;
+		while(i<128 && sx_levels_isset(l, i+1))
+			i++;
+		hi[n++]=i;
+	};
+	return n;
+};
+
+/* highest masklen in l, -1 when l is empty */
+static int
+sx_levels_last(const struct sx_levels* l)
+{
+	int i;
+	for(i=SX_LEVELS_WORDS-1; i>=0; i--)
+		if(l->w[i])
+			return i*64+63-__builtin_clzll(l->w[i]);
+	return -1;
+};
+
+/* lengths accepted by the entries (node and sons) of node */
+static struct sx_levels
+sx_radix_node_levels(struct sx_radix_node* node)
+{
+	struct sx_levels l;
+	struct sx_radix_node* n;
+	memset(&l, 0, sizeof(l));
+	for(n=node; n; n=sx_radix_son(n)) {
+		if(n->isGlue)
+			continue;
+		if(n->isAggregate)
+			sx_levels_set(&l, n->aggregateLow, n->aggregateHi);
+		else
+			sx_levels_set(&l, node->prefix.masklen, node->prefix.masklen);
+	};
+	return l;
+};
+
+/* set algebra works on entries as (prefix, lengths) and builds the result
+ * as a new tree, so native ranges never have to be expanded */
+struct sx_ranges {
+	struct sx_range {
+		struct sx_prefix p;
+		unsigned char lo, hi;
+	} *v;
+	int n, size;
+};
+
+static int
+sx_ranges_add(struct sx_ranges* r, struct sx_prefix* p, unsigned lo,
+	unsigned hi)
+{
+	if(r->n==r->size) {
+		int size=r->size?r->size*2:64;
+		struct sx_range* v=realloc(r->v, size*sizeof(struct sx_range));
+		if(!v) {
+			sx_report(SX_ERROR,"Unable to allocate %lu bytes: %s\n",
+				(unsigned long)(size*sizeof(struct sx_range)), strerror(errno));
+			return 0;
+		};
+		r->v=v;
+		r->size=size;
+	};
+	r->v[r->n].p=*p;
+	r->v[r->n].lo=lo;
+	r->v[r->n].hi=hi;
+	r->n++;
+	return 1;
+};
+
+/* every run of l as an entry on p */
+static int
+sx_ranges_add_levels(struct sx_ranges* r, struct sx_prefix* p,
+	const struct sx_levels* l)
+{
+	unsigned char lo[65], hi[65];
+	int i, n=sx_levels_runs(l, lo, hi);
+	for(i=0; i<n; i++)
+		if(!sx_ranges_add(r, p, lo[i], hi[i]))
+			return 0;
+	return 1;
+};
+
+/* replaces contents of tree with the entries in r */
+static int
+sx_radix_tree_rebuild(struct sx_radix_tree* tree, struct sx_ranges* r)
+{
+	struct sx_radix_tree* res=sx_radix_tree_new(tree->family);
+	int i;
+	if(!res) {
+		sx_report(SX_ERROR,"Unable to allocate tree: %s\n", strerror(errno));
+		return 0;
+	};
+	for(i=0; i<r->n; i++) {
+		if(!sx_radix_tree_insert_range(res, &r->v[i].p, r->v[i].lo,
+			r->v[i].hi)) {
+			sx_report(SX_ERROR,"Unable to insert entry: %s\n",
+				strerror(errno));
+			sx_radix_tree_destroy(res);
+			return 0;
+		};
+	};
+	sx_radix_tree_swap(tree, res);
+	sx_radix_tree_destroy(res);
+	return 1;
+};
+
+/* node of other where entries inside p start: the one at p itself or the
+ * topmost one below it, NULL when there is none. Entries of other on
+ * nodes above p are or-ed into *above. */
+static struct sx_radix_node*
+sx_radix_tree_descend(struct sx_radix_tree* other, struct sx_prefix* p,
+	struct sx_levels* above)
+{
+	struct sx_radix_node* o=other->head;
+	while(o) {
+		unsigned eb=sx_prefix_eqbits(&o->prefix, p);
+		if(o->prefix.masklen>=p->masklen)
+			return eb>=(unsigned)p->masklen?o:NULL;
+		if(eb<(unsigned)o->prefix.masklen)
+			return NULL;
+		if(above) {
+			struct sx_levels l=sx_radix_node_levels(o);
+			*above=sx_levels_or(*above, &l);
+		};
+		o=sx_radix_at(o, sx_prefix_isbitset(p, o->prefix.masklen+1)?o->r:o->l);
+	};
+	return NULL;
+};
+
+/* entries (p, lengths l) shares with other: p's covering entries clip
+ * l in place, entries below p are clipped by l. Subtrees deeper than
+ * the longest length in l cannot share anything. */
+static int
+sx_radix_entry_intersect(struct sx_ranges* out, struct sx_prefix* p,
+	struct sx_levels l, struct sx_radix_tree* other)
+{
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* o, *n;
+	struct sx_levels above, own;
+	int last=sx_levels_last(&l);
+
+	memset(&above, 0, sizeof(above));
+	o=sx_radix_tree_descend(other, p, &above);
+	above=sx_levels_and(above, &l);
+	if(!sx_levels_empty(&above) && !sx_ranges_add_levels(out, p, &above))
+		return 0;
+	if(!o)
+		return 1;
+	for(n=sx_radix_cursor_first(&cur, o); n; ) {
+		if(n->prefix.masklen>last) {
+			n=sx_radix_cursor_skip(&cur, n);
+			continue;
+		};
+		own=sx_radix_node_levels(n);
+		own=sx_levels_and(own, &l);
+		if(!sx_levels_empty(&own) && !sx_ranges_add_levels(out, &n->prefix,
+			&own))
+			return 0;
+		n=sx_radix_cursor_next(&cur, n);
+	};
+	return 1;
+};
+
+int
+sx_radix_tree_intersect(struct sx_radix_tree* tree, struct sx_radix_tree* other)
+{
+	struct sx_ranges out={NULL, 0, 0};
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* node;
+	int ret;
+
+	if(!tree || !other || !tree->head) return 0;
+	SX_RADIX_FOREACH(node, &cur, tree) {
+		if(node->isGlue && !node->son)
+			continue;
+		if(!sx_radix_entry_intersect(&out, &node->prefix,
+			sx_radix_node_levels(node), other)) {
+			free(out.v);
+			return -1;
+		};
+	};
+	ret=sx_radix_tree_rebuild(tree, &out)?0:-1;
+	free(out.v);
+	return ret;
+};
+
+static int sx_radix_entry_split(struct sx_ranges* out, struct sx_prefix* p,
+	struct sx_levels l, struct sx_radix_node* cl, struct sx_radix_node* cr);
+
+/* what is left of (p, lengths l) when entries of the subtree at o, which
+ * is at p or below it, are taken out of it */
+static int
+sx_radix_entry_subtract(struct sx_ranges* out, struct sx_prefix* p,
+	struct sx_levels l, struct sx_radix_node* o)
+{
+	if(sx_levels_empty(&l))
+		return 1;
+	if(!o || o->prefix.masklen>sx_levels_last(&l))
+		return sx_ranges_add_levels(out, p, &l);
+	if(o->prefix.masklen==p->masklen) {
+		struct sx_levels own=sx_radix_node_levels(o);
+		l=sx_levels_andnot(l, &own);
+		return sx_radix_entry_split(out, p, l, sx_radix_left(o),
+			sx_radix_right(o));
+	};
+	if(sx_prefix_isbitset(&o->prefix, p->masklen+1))
+		return sx_radix_entry_split(out, p, l, NULL, o);
+	return sx_radix_entry_split(out, p, l, o, NULL);
+};
+
+/* (p, l) with subtrees cl and cr below its halves still to take out: p
+ * keeps its own length, the rest goes to the halves, unless neither
+ * subtree reaches the lengths in l */
+static int
+sx_radix_entry_split(struct sx_ranges* out, struct sx_prefix* p,
+	struct sx_levels l, struct sx_radix_node* cl, struct sx_radix_node* cr)
+{
+	struct sx_prefix h;
+	struct sx_levels own;
+	int last=sx_levels_last(&l);
+
+	if(last<0)
+		return 1;
+	if((!cl || cl->prefix.masklen>last) && (!cr || cr->prefix.masklen>last))
+		return sx_ranges_add_levels(out, p, &l);
+	if(sx_levels_isset(&l, p->masklen)) {
+		memset(&own, 0, sizeof(own));
+		sx_levels_set(&own, p->masklen, p->masklen);
+		if(!sx_ranges_add(out, p, p->masklen, p->masklen))
+			return 0;
+		l=sx_levels_andnot(l, &own);
+	};
+	h=*p;
+	h.masklen++;
+	if(!sx_radix_entry_subtract(out, &h, l, cl))
+		return 0;
+	sx_prefix_setbit(&h, h.masklen);
+	return sx_radix_entry_subtract(out, &h, l, cr);
+};
+
+int
+sx_radix_tree_subtract(struct sx_radix_tree* tree, struct sx_radix_tree* other)
+{
+	struct sx_ranges out={NULL, 0, 0};
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* node, *o;
+	struct sx_levels l, above;
+	int ret;
+
+	if(!tree || !other || !tree->head || !other->head) return 0;
+	SX_RADIX_FOREACH(node, &cur, tree) {
+		if(node->isGlue && !node->son)
+			continue;
+		memset(&above, 0, sizeof(above));
+		o=sx_radix_tree_descend(other, &node->prefix, &above);
+		l=sx_radix_node_levels(node);
+		l=sx_levels_andnot(l, &above);
+		if(!sx_radix_entry_subtract(&out, &node->prefix, l, o)) {
+			free(out.v);
+			return -1;
+		};
+	};
+	ret=sx_radix_tree_rebuild(tree, &out)?0:-1;
+	free(out.v);
+	return ret;
+};
+
+/* merging below owns isAggregate and son of the node it works on, so
+ * native ranges are taken off the node first and put back afterwards,
+ * a range-only node taking part as glue */
+static struct sx_radix_node*
+sx_radix_node_detach_ranges(struct sx_radix_tree* tree,
+	struct sx_radix_node* node)
+{
+	struct sx_radix_node* ranges=sx_radix_son(node), *own;
+	node->son=0;
+	if(node->isGlue || !node->isAggregate)
+		return ranges;
+	if(!(own=sx_radix_node_new(tree, &node->prefix))) {
+		sx_report(SX_ERROR,"Unable to create node: %s\n", strerror(errno));
+		return ranges;
+	};
+	own->isAggregate=1;
+	own->aggregateLow=node->aggregateLow;
+	own->aggregateHi=node->aggregateHi;
+	own->son=sx_radix_link(ranges);
+	if(node->aggregateLow>node->prefix.masklen)
+		node->isGlue=1;
+	node->isAggregate=0;
+	node->aggregateLow=node->aggregateHi=0;
+	return own;
+};
+
+static void
+sx_radix_node_attach_ranges(struct sx_radix_tree* tree,
+	struct sx_radix_node* node, struct sx_radix_node* ranges)
+{
+	struct sx_radix_node* n;
+	for(n=ranges; n; n=sx_radix_son(n)) {
+		if(!n->isGlue)
+			sx_radix_node_add_range(tree, node, n->aggregateLow,
+				n->aggregateHi);
+	};
+	sx_radix_node_release(tree, ranges);
+};
+
+static void
+sx_radix_node_merge(struct sx_radix_tree* tree, struct sx_radix_node* node)
+{
+	struct sx_radix_node* r=sx_radix_right(node), *l=sx_radix_left(node);
+	struct sx_radix_node* rs=r?sx_radix_son(r):NULL;
+	struct sx_radix_node* ls=l?sx_radix_son(l):NULL;
+	struct sx_radix_node* son;
+
+	if(debug_aggregation) {
+		printf("Aggregating on node: ");
+		sx_prefix_fprint(stdout,&node->prefix);
+		printf(" %s%s%u,%u\n", node->isGlue?"Glue ":"",
+			node->isAggregate?"Aggregate ":"",node->aggregateLow,
+			node->aggregateHi);
+		if(r) {
+			printf("R-Tree: ");
+			sx_prefix_fprint(stdout,&r->prefix);
+			printf(" %s%s%u,%u\n", (r->isGlue)?"Glue ":"",
+				(r->isAggregate)?"Aggregate ":"",
+				r->aggregateLow,r->aggregateHi);
+			if(rs) {
+			printf("R-Son: ");
+			sx_prefix_fprint(stdout,&rs->prefix);
+			printf(" %s%s%u,%u\n",rs->isGlue?"Glue ":"",
+				rs->isAggregate?"Aggregate ":"",
+				rs->aggregateLow,rs->aggregateHi);
+			};
+		};
+		if(l) {
+			printf("L-Tree: ");
+			sx_prefix_fprint(stdout,&l->prefix);
+			printf(" %s%s%u,%u\n",l->isGlue?"Glue ":"",
+				l->isAggregate?"Aggregate ":"",
+				l->aggregateLow,l->aggregateHi);
+			if(ls) {
+			printf("L-Son: ");
+			sx_prefix_fprint(stdout,&ls->prefix);
+			printf(" %s%s%u,%u\n",ls->isGlue?"Glue ":"",
+				ls->isAggregate?"Aggregate ":"",
+				ls->aggregateLow,ls->aggregateHi);
+			};
+		};
+	};
+
+	if(r && l) {
+		if(!r->isAggregate && !l->isAggregate &&
+			!r->isGlue && !l->isGlue &&
+			r->prefix.masklen==l->prefix.masklen) {
+			if(r->prefix.masklen==node->prefix.masklen+1) {
+				node->isAggregate=1;
+				r->isGlue=1;
+				l->isGlue=1;
+				node->aggregateHi=r->prefix.masklen;
+				if(node->isGlue) {
+					node->isGlue=0;
+					node->aggregateLow=r->prefix.masklen;
+				} else {
+					node->aggregateLow=node->prefix.masklen;
+				};
+			};
+			if(rs && ls &&
+				rs->isAggregate && ls->isAggregate &&
+				rs->aggregateHi==ls->aggregateHi &&
+				rs->aggregateLow==ls->aggregateLow &&
+				r->prefix.masklen==node->prefix.masklen+1 &&
+				l->prefix.masklen==node->prefix.masklen+1)
+			{
+				son=sx_radix_node_new(tree,&node->prefix);
+				node->son=sx_radix_link(son);
+				son->isGlue=0;
+				son->isAggregate=1;
+				son->aggregateHi=rs->aggregateHi;
+				son->aggregateLow=rs->aggregateLow;
+				rs->isGlue=1;
+				ls->isGlue=1;
+			};
+		} else if(r->isAggregate && l->isAggregate &&
+			r->aggregateHi==l->aggregateHi &&
+			r->aggregateLow==l->aggregateLow) {
+			if(r->prefix.masklen==node->prefix.masklen+1 &&
+				l->prefix.masklen==node->prefix.masklen+1) {
+				if(node->isGlue) {
+					r->isGlue=1;
+					l->isGlue=1;
+					node->isAggregate=1;
+					node->isGlue=0;
+					node->aggregateHi=r->aggregateHi;
+					node->aggregateLow=r->aggregateLow;
+				} else if(r->prefix.masklen==r->aggregateLow) {
+					r->isGlue=1;
+					l->isGlue=1;
+					node->isAggregate=1;
+					node->aggregateHi=r->aggregateHi;
+					node->aggregateLow=node->prefix.masklen;
+				} else {
+					son=sx_radix_node_new(tree,&node->prefix);
+					node->son=sx_radix_link(son);
+					son->isGlue=0;
+					son->isAggregate=1;
+					son->aggregateHi=r->aggregateHi;
+					son->aggregateLow=r->aggregateLow;
+					r->isGlue=1;
+					l->isGlue=1;
+					if(rs && ls &&
+						rs->aggregateHi==ls->aggregateHi &&
+						rs->aggregateLow==ls->aggregateLow)
+					{
+						son->son=sx_radix_link(sx_radix_node_new(tree,&node->prefix));
+						son=sx_radix_son(son);
+						son->isGlue=0;
+						son->isAggregate=1;
+						son->aggregateHi=rs->aggregateHi;
+						son->aggregateLow=rs->aggregateLow;
+						rs->isGlue=1;
+						ls->isGlue=1;
+					};
+				};
+			};
+		} else if(ls &&
+			r->isAggregate && ls->isAggregate &&
+			r->aggregateHi==ls->aggregateHi &&
+			r->aggregateLow==ls->aggregateLow) {
+			if(r->prefix.masklen==node->prefix.masklen+1 &&
+				l->prefix.masklen==node->prefix.masklen+1) {
+				if(node->isGlue) {
+					r->isGlue=1;
+					ls->isGlue=1;
+					node->isAggregate=1;
+					node->isGlue=0;
+					node->aggregateHi=r->aggregateHi;
+					node->aggregateLow=r->aggregateLow;
+				} else {
+					son=sx_radix_node_new(tree,&node->prefix);
+					node->son=sx_radix_link(son);
+					son->isGlue=0;
+					son->isAggregate=1;
+					son->aggregateHi=r->aggregateHi;
+					son->aggregateLow=r->aggregateLow;
+					r->isGlue=1;
+					ls->isGlue=1;
+				};
+			};
+		} else if(rs &&
+			l->isAggregate && rs->isAggregate &&
+			l->aggregateHi==rs->aggregateHi &&
+			l->aggregateLow==rs->aggregateLow) {
+			if(l->prefix.masklen==node->prefix.masklen+1 &&
+				r->prefix.masklen==node->prefix.masklen+1) {
+				if(node->isGlue) {
+					l->isGlue=1;
+					rs->isGlue=1;
+					node->isAggregate=1;
+					node->isGlue=0;
+					node->aggregateHi=l->aggregateHi;
+					node->aggregateLow=l->aggregateLow;
+				} else {
+					son=sx_radix_node_new(tree,&node->prefix);
+					node->son=sx_radix_link(son);
+					son->isGlue=0;
+					son->isAggregate=1;
+					son->aggregateHi=l->aggregateHi;
+					son->aggregateLow=l->aggregateLow;
+					l->isGlue=1;
+					rs->isGlue=1;
+				};
+			};
+		};
+	};
+};
+
+static int
+sx_radix_node_aggregate(struct sx_radix_tree* tree, struct sx_radix_node* node)
+{
+	struct sx_radix_node* ranges;
+
+	if(node->l)
+		sx_radix_node_aggregate(tree, sx_radix_left(node));
+	if(node->r)
+		sx_radix_node_aggregate(tree, sx_radix_right(node));
+
+	ranges=sx_radix_node_detach_ranges(tree, node);
+	sx_radix_node_merge(tree, node);
+	if(ranges)
+		sx_radix_node_attach_ranges(tree, node, ranges);
+	return 0;
+};
+
+#if HAVE_LIBPTHREAD
+/* Merging at a node touches the node, its children and their sons only, so
+ * disjoint subtrees aggregate independently. The tree is split into tasks
+ * of at most a share of its nodes each, so a skewed tree gives many tasks
+ * too. Tasks go to threads largest first, each thread allocating from
+ * segments of its own, and the nodes above the tasks are aggregated
+ * afterwards, bottom up. */
+
+#define SX_AGGREGATE_TASKS	16
+
+struct sx_aggregate_task {
+	struct sx_radix_node* node;
+	unsigned size;
+};
+
+struct sx_aggregate_pool {
+	struct sx_aggregate_task* tasks;
+	int ntasks, stasks, next;
+	struct sx_radix_node** upper;
+	int nupper, supper;
+	pthread_mutex_t lock;
+};
+
+struct sx_aggregate_worker {
+	pthread_t thread;
+	struct sx_aggregate_pool* pool;
+	struct sx_radix_tree tree;
+};
+
+static int
+sx_aggregate_add_task(struct sx_aggregate_pool* pool,
+	struct sx_radix_node* node, unsigned size)
+{
+	struct sx_aggregate_task* nt;
+	if(pool->ntasks==pool->stasks) {
+		pool->stasks=pool->stasks?pool->stasks*2:256;
+		if(!(nt=realloc(pool->tasks,
+			pool->stasks*sizeof(struct sx_aggregate_task))))
+			return 0;
+		pool->tasks=nt;
+	};
+	pool->tasks[pool->ntasks].node=node;
+	pool->tasks[pool->ntasks].size=size;
+	pool->ntasks++;
+	return 1;
+};
+
+static int
+sx_aggregate_add_upper(struct sx_aggregate_pool* pool,
+	struct sx_radix_node* node)
+{
+	struct sx_radix_node** nu;
+	if(pool->nupper==pool->supper) {
+		pool->supper=pool->supper?pool->supper*2:256;
+		if(!(nu=realloc(pool->upper,
+			pool->supper*sizeof(struct sx_radix_node*))))
+			return 0;
+		pool->upper=nu;
+	};
+	pool->upper[pool->nupper++]=node;
+	return 1;
+};
+
+/* subtrees of at most limit nodes become tasks, nodes of larger ones are
+ * queued on upper in post-order. Returns the subtree size, 0 when out of
+ * memory. */
+static unsigned
+sx_radix_node_split(struct sx_radix_node* node, unsigned limit,
+	struct sx_aggregate_pool* pool)
+{
+	unsigned l=0, r=0, size;
+	if(node->l && !(l=sx_radix_node_split(sx_radix_left(node), limit, pool)))
+		return 0;
+	if(node->r && !(r=sx_radix_node_split(sx_radix_right(node), limit,
+		pool)))
+		return 0;
+	size=1+l+r;
+	if(size<=limit)
+		return size;
+	if(l && l<=limit && !sx_aggregate_add_task(pool, sx_radix_left(node), l))
+		return 0;
+	if(r && r<=limit && !sx_aggregate_add_task(pool, sx_radix_right(node),
+		r))
+		return 0;
+	if(!sx_aggregate_add_upper(pool, node))
+		return 0;
+	return size;
+};
+
+static int
+sx_aggregate_task_cmp(const void* a, const void* b)
+{
+	unsigned sa=((const struct sx_aggregate_task*)a)->size;
+	unsigned sb=((const struct sx_aggregate_task*)b)->size;
+	return sa>sb?-1:sa<sb?1:0;
+};
+
+static void*
+sx_aggregate_worker_run(void* udata)
+{
+	struct sx_aggregate_worker* w=udata;
+	int i;
+	for(;;) {
+		pthread_mutex_lock(&w->pool->lock);
+		i=w->pool->next++;
+		pthread_mutex_unlock(&w->pool->lock);
+		if(i>=w->pool->ntasks)
+			break;
+		sx_radix_node_aggregate(&w->tree, w->pool->tasks[i].node);
+	};
+	return NULL;
+};
+
+static int
+sx_radix_tree_aggregate_parallel(struct sx_radix_tree* tree, int nthreads)
+{
+	struct sx_aggregate_pool pool;
+	struct sx_aggregate_worker* w;
+	struct sx_radix_node* last, *ranges;
+	struct sx_radix_cursor cur;
+	unsigned total=0, limit;
+	int i, started;
+
+	for(last=sx_radix_cursor_first(&cur, tree->head); last;
+		last=sx_radix_cursor_next(&cur, last))
+		total++;
+	limit=total/(nthreads*SX_AGGREGATE_TASKS);
+	if(limit<1)
+		limit=1;
+	memset(&pool, 0, sizeof(pool));
+	if(!(w=calloc(nthreads, sizeof(struct sx_aggregate_worker))) ||
+		!sx_radix_node_split(tree->head, limit, &pool) ||
+		(!pool.nupper && !sx_aggregate_add_task(&pool, tree->head, total))) {
+		free(w);
+		free(pool.tasks);
+		free(pool.upper);
+		return sx_radix_node_aggregate(tree, tree->head);
+	};
+	qsort(pool.tasks, pool.ntasks, sizeof(struct sx_aggregate_task),
+		sx_aggregate_task_cmp);
+	pthread_mutex_init(&pool.lock, NULL);
+
+	/* the calling thread is worker 0, so all tasks get done even when no
+	 * thread can be started */
+	for(i=0; i<nthreads; i++) {
+		w[i].pool=&pool;
+		w[i].tree.family=tree->family;
+		w[i].tree.owner=tree;
+	};
+	for(started=1; started<nthreads; started++) {
+		if(pthread_create(&w[started].thread, NULL, sx_aggregate_worker_run,
+			w+started))
+			break;
+	};
+	sx_aggregate_worker_run(w);
+	for(i=1; i<started; i++)
+		pthread_join(w[i].thread, NULL);
+	pthread_mutex_destroy(&pool.lock);
+
+	SX_DEBUG(debug_aggregation, "Aggregated %i subtrees of at most %u nodes "
+		"in %i threads, %i nodes above\n", pool.ntasks, limit, started,
+		pool.nupper);
+
+	/* nodes workers made are in segments of the tree already, nodes they
+	 * freed are not on its freelist yet */
+	for(i=0; i<nthreads; i++) {
+		if(w[i].tree.freelist) {
+			for(last=w[i].tree.freelist; last->parent;
+				last=sx_radix_parent(last));
+			last->parent=sx_radix_link(tree->freelist);
+			tree->freelist=w[i].tree.freelist;
+		};
+	};
+	free(w);
+	free(pool.tasks);
+
+	/* merging touches nothing above the node, so upper nodes queued
+	 * children first are all still there */
+	for(i=0; i<pool.nupper; i++) {
+		ranges=sx_radix_node_detach_ranges(tree, pool.upper[i]);
+		sx_radix_node_merge(tree, pool.upper[i]);
+		if(ranges)
+			sx_radix_node_attach_ranges(tree, pool.upper[i], ranges);
+	};
+	free(pool.upper);
+	return 0;
+};
+#endif
 
 int
-sx_radix_tree_hyperaggregate(struct sx_radix_tree* tree)
+sx_radix_tree_aggregate(struct sx_radix_tree* tree)
 {
-	if(tree && tree->head) {
-		unsigned max = tree->family == AF_INET ? 32 : 128;
-		sx_radix_node_hyperaggregate(tree->head, max);
+	if(!tree || !tree->head)
+		return 0;
+#if HAVE_LIBPTHREAD
+	if(aggregation_threads>1)
+		return sx_radix_tree_aggregate_parallel(tree, aggregation_threads);
+#endif
+	return sx_radix_node_aggregate(tree, tree->head);
+};
+
+/* Optimal aggregation: the fewest entries prefix^low-high, placed on nodes
+ * of the tree, accepting exactly what the tree accepts now.
+ *
+ * Levels are kept as bitmasks of prefix lengths. own(v) holds the lengths
+ * v's entries accept under v, full(v) the lengths accepted under all of v
+ * (own, or full under both halves, or inherited from an ancestor), rel(v)
+ * the lengths anything in v's subtree needs. An entry on v may take any
+ * interval of full(v), so whole runs of it are best. Lengths v needs are
+ * covered by entries above v, by a run taken on v, or left to both halves
+ * when both are children of v. The minimum is found over subsets of runs
+ * at each node, memoized on what is covered from above and what is left
+ * to the node. */
+
+struct sx_optimal_memo {
+	struct sx_levels covered, required, chosen;
+	unsigned cost;
+	struct sx_optimal_memo* next;
+};
+
+struct sx_optimal_node {
+	struct sx_radix_node* node;
+	struct sx_levels own, full, rel;
+	int l, r;
+	struct sx_optimal_memo* memo;
+};
+
+struct sx_optimal {
+	struct sx_optimal_node* v;
+	int n, size;
+	int inexact;
+	struct sx_arena arena;
+};
+
+/* more than that many runs on a node: only none or all of them, and the
+ * result is not proven minimal any more */
+#define SX_OPTIMAL_MAX_RUNS 16
+
+static int
+sx_optimal_build(struct sx_optimal* o, struct sx_radix_node* node)
+{
+	struct sx_optimal_node* v, *l, *r;
+	struct sx_radix_node* n;
+	int i, li=-1, ri=-1;
+
+	if(o->n==o->size) {
+		o->size=o->size?o->size*2:1024;
+		if(!(v=realloc(o->v, o->size*sizeof(struct sx_optimal_node)))) {
+			sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+				strerror(errno));
+			exit(1);
+		};
+		o->v=v;
 	};
-	return 0;
+	i=o->n++;
+	memset(o->v+i, 0, sizeof(struct sx_optimal_node));
+	o->v[i].node=node;
+	for(n=node; n; n=sx_radix_son(n)) {
+		if(n->isGlue)
+			continue;
+		if(n->isAggregate)
+			sx_levels_set(&o->v[i].own, n->aggregateLow, n->aggregateHi);
+		else
+			sx_levels_set(&o->v[i].own, node->prefix.masklen,
+				node->prefix.masklen);
+	};
+	if(node->l)
+		li=sx_optimal_build(o, sx_radix_left(node));
+	if(node->r)
+		ri=sx_optimal_build(o, sx_radix_right(node));
+
+	v=o->v+i;
+	v->l=li;
+	v->r=ri;
+	v->full=v->own;
+	v->rel=v->own;
+	l=li>=0?o->v+li:NULL;
+	r=ri>=0?o->v+ri:NULL;
+	if(l && r && l->node->prefix.masklen==node->prefix.masklen+1 &&
+		r->node->prefix.masklen==node->prefix.masklen+1) {
+		struct sx_levels both=sx_levels_and(l->full, &r->full);
+		v->full=sx_levels_or(v->full, &both);
+	};
+	if(l)
+		v->rel=sx_levels_or(v->rel, &l->rel);
+	if(r)
+		v->rel=sx_levels_or(v->rel, &r->rel);
+	return i;
+};
+
+/* lengths full under a node are full under every node below it */
+static void
+sx_optimal_inherit(struct sx_optimal* o, int i, const struct sx_levels* up)
+{
+	struct sx_optimal_node* v=o->v+i;
+	struct sx_levels below;
+	memset(&below, 0, sizeof(below));
+	sx_levels_set(&below, v->node->prefix.masklen,
+		v->node->prefix.family==AF_INET?32:128);
+	below=sx_levels_and(*up, &below);
+	v->full=sx_levels_or(v->full, &below);
+	if(v->l>=0)
+		sx_optimal_inherit(o, v->l, &v->full);
+	if(v->r>=0)
+		sx_optimal_inherit(o, v->r, &v->full);
+};
+
+static unsigned
+sx_optimal_solve(struct sx_optimal* o, int i, struct sx_levels covered,
+	struct sx_levels required)
+{
+	struct sx_optimal_node* v=o->v+i;
+	struct sx_optimal_memo* m;
+	struct sx_levels need, open, run, sel, down, cx, best;
+	struct sx_levels runs[65];
+	unsigned char lo[65], hi[65];
+	unsigned cost, bestcost=~0U, mask, nmask;
+	int nruns, n=0, k, split;
+
+	covered=sx_levels_and(covered, &v->rel);
+	required=sx_levels_andnot(required, &covered);
+	for(m=v->memo; m; m=m->next) {
+		if(sx_levels_eq(&m->covered, &covered) &&
+			sx_levels_eq(&m->required, &required))
+			return m->cost;
+	};
+
+	/* lengths needed here may be left to both halves instead */
+	split=v->l>=0 && v->r>=0 &&
+		o->v[v->l].node->prefix.masklen==v->node->prefix.masklen+1 &&
+		o->v[v->r].node->prefix.masklen==v->node->prefix.masklen+1;
+	need=sx_levels_andnot(sx_levels_or(v->own, &required), &covered);
+	open=sx_levels_andnot(v->rel, &covered);
+	nruns=sx_levels_runs(&v->full, lo, hi);
+	for(k=0; k<nruns; k++) {
+		memset(&run, 0, sizeof(run));
+		sx_levels_set(&run, lo[k], hi[k]);
+		if(sx_levels_meet(&run, &need) || sx_levels_meet(&run, &open))
+			runs[n++]=run;
+	};
+
+	if(n>SX_OPTIMAL_MAX_RUNS)
+		o->inexact=1;
+	nmask=n>SX_OPTIMAL_MAX_RUNS?2:1U<<n;
+	memset(&best, 0, sizeof(best));
+	for(mask=0; mask<nmask; mask++) {
+		memset(&sel, 0, sizeof(sel));
+		cost=0;
+		for(k=0; k<n; k++) {
+			if(n>SX_OPTIMAL_MAX_RUNS?mask:(mask>>k)&1) {
+				sel=sx_levels_or(sel, runs+k);
+				cost++;
+			};
+		};
+		if(cost>=bestcost)
+			continue;
+		down=sx_levels_andnot(need, &sel);
+		if(!sx_levels_empty(&down) && (!split ||
+			sx_levels_isset(&down, v->node->prefix.masklen)))
+			continue;
+		cx=sx_levels_or(sel, &covered);
+		if(v->l>=0)
+			cost+=sx_optimal_solve(o, v->l, cx, down);
+		if(cost<bestcost && v->r>=0)
+			cost+=sx_optimal_solve(o, v->r, cx, down);
+		if(cost<bestcost) {
+			bestcost=cost;
+			best=sel;
+		};
+	};
+
+	if(!(m=sx_arena_alloc(&o->arena, sizeof(struct sx_optimal_memo)))) {
+		sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+			strerror(errno));
+		exit(1);
+	};
+	m->covered=covered;
+	m->required=required;
+	m->chosen=best;
+	m->cost=bestcost;
+	m->next=v->memo;
+	v->memo=m;
+	return bestcost;
+};
+
+/* rewrite entries of the tree along the choices made by solve */
+static void
+sx_optimal_apply(struct sx_radix_tree* tree, struct sx_optimal* o, int i,
+	struct sx_levels covered, struct sx_levels required)
+{
+	struct sx_optimal_node* v=o->v+i;
+	struct sx_radix_node* node=v->node;
+	struct sx_optimal_memo* m;
+	unsigned char lo[65], hi[65];
+	int nruns, k;
+
+	covered=sx_levels_and(covered, &v->rel);
+	required=sx_levels_andnot(required, &covered);
+	for(m=v->memo; m && !(sx_levels_eq(&m->covered, &covered) &&
+		sx_levels_eq(&m->required, &required)); m=m->next);
+	if(!m) {
+		/* can't be: apply follows the calls solve made */
+		sx_report(SX_FATAL, "Optimal aggregation lost its way\n");
+		exit(1);
+	};
+
+	sx_radix_node_release(tree, sx_radix_son(node));
+	node->son=0;
+	node->isGlue=1;
+	node->isAggregate=0;
+	node->isAggregated=0;
+	nruns=sx_levels_runs(&m->chosen, lo, hi);
+	for(k=0; k<nruns; k++) {
+		if(lo[k]==node->prefix.masklen) {
+			node->isGlue=0;
+			if(hi[k]>lo[k]) {
+				node->isAggregate=1;
+				node->aggregateLow=lo[k];
+				node->aggregateHi=hi[k];
+			};
+		};
+	};
+	for(k=0; k<nruns; k++) {
+		if(lo[k]==node->prefix.masklen)
+			continue;
+		if(node->isGlue) {
+			node->isGlue=0;
+			node->isAggregate=1;
+			node->aggregateLow=lo[k];
+			node->aggregateHi=hi[k];
+		} else {
+			sx_radix_node_add_son(tree, node, lo[k], hi[k]);
+		};
+	};
+
+	required=sx_levels_andnot(sx_levels_or(v->own, &required), &covered);
+	required=sx_levels_andnot(required, &m->chosen);
+	covered=sx_levels_or(covered, &m->chosen);
+	if(v->l>=0)
+		sx_optimal_apply(tree, o, v->l, covered, required);
+	if(v->r>=0)
+		sx_optimal_apply(tree, o, v->r, covered, required);
 };
 
 int
-sx_radix_node_refine(struct sx_radix_node* node, unsigned refine)
+sx_radix_tree_optimize(struct sx_radix_tree* tree)
 {
-	if(!node->isGlue && node->prefix.masklen<refine) {
-		node->isAggregate=1;
-		node->aggregateLow=node->prefix.masklen;
-		node->aggregateHi=refine;
-		if(node->l) {
-			sx_radix_node_foreach(node->l, setGlueUpTo, &refine);
-			sx_radix_node_refine(node->l, refine);
+	struct sx_optimal o;
+	struct sx_levels none;
+	unsigned entries;
+
+	if(!tree || !tree->head)
+		return 0;
+	memset(&o, 0, sizeof(o));
+	memset(&none, 0, sizeof(none));
+	sx_optimal_build(&o, tree->head);
+	sx_optimal_inherit(&o, 0, &none);
+	entries=sx_optimal_solve(&o, 0, none, none);
+	sx_optimal_apply(tree, &o, 0, none, none);
+	SX_DEBUG(debug_aggregation, "Optimal aggregation: %u nodes, %u entries\n",
+		o.n, entries);
+	if(o.inexact)
+		sx_report(SX_NOTICE, "Optimal aggregation: some prefixes allow more "
+			"than %i separate runs of lengths, %u entries may not be the "
+			"fewest\n", SX_OPTIMAL_MAX_RUNS, entries);
+	free(o.v);
+	sx_arena_free(&o.arena);
+	return entries;
+};
+
+/* entries printers would output */
+int
+sx_radix_tree_entries(struct sx_radix_tree* tree)
+{
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* node, *n;
+	int entries=0;
+
+	if(!tree)
+		return 0;
+	SX_RADIX_FOREACH(node, &cur, tree) {
+		for(n=node; n; n=sx_radix_son(n)) {
+			if(!n->isGlue)
+				entries++;
+		};
+	};
+	return entries;
+};
+
+static double
+sx_pow2(unsigned n)
+{
+	double r=1;
+	for(; n>=32; n-=32)
+		r*=4294967296.0;
+	return r*(double)((uint64_t)1<<n);
+};
+
+/* prefix/length pairs and addresses the tree accepts, overlaps counted
+ * once: lengths accepted by entries above a node are passed down and not
+ * counted again */
+static void
+sx_radix_node_accepted(struct sx_radix_node* node, struct sx_levels covered,
+	int inside, double* pairs, double* addresses)
+{
+	struct sx_radix_node* n;
+	unsigned d, m=node->prefix.masklen;
+	unsigned max=node->prefix.family==AF_INET?32:128;
+	struct sx_levels own;
+	int entry=0;
+
+	memset(&own, 0, sizeof(own));
+	for(n=node; n; n=sx_radix_son(n)) {
+		if(n->isGlue)
+			continue;
+		entry=1;
+		if(n->isAggregate)
+			sx_levels_set(&own, n->aggregateLow, n->aggregateHi);
+		else
+			sx_levels_set(&own, m, m);
+	};
+	own=sx_levels_andnot(own, &covered);
+	for(d=m; d<=max; d++) {
+		if(sx_levels_isset(&own, d))
+			*pairs+=sx_pow2(d-m);
+	};
+	if(!inside && entry) {
+		*addresses+=sx_pow2(max-m);
+		inside=1;
+	};
+	covered=sx_levels_or(covered, &own);
+	if(node->l)
+		sx_radix_node_accepted(sx_radix_left(node), covered, inside, pairs,
+			addresses);
+	if(node->r)
+		sx_radix_node_accepted(sx_radix_right(node), covered, inside, pairs,
+			addresses);
+};
+
+void
+sx_radix_tree_accepted(struct sx_radix_tree* tree, double* pairs,
+	double* addresses)
+{
+	struct sx_levels none;
+	memset(&none, 0, sizeof(none));
+	*pairs=*addresses=0;
+	if(tree && tree->head)
+		sx_radix_node_accepted(tree->head, none, 0, pairs, addresses);
+};
+
+/* Entry budget: while there are more entries than allowed, the subtree
+ * whose entries are cheapest to replace by a single one is collapsed into
+ * its root, accepting lengths from the shortest to the longest of them.
+ * Cost is the prefix/length pairs gained per entry saved, with entries
+ * counted apart (overlaps are rare after aggregation). Candidates sit in
+ * a heap indexed by node, a collapse updates the nodes above it. */
+
+struct sx_budget_node {
+	struct sx_radix_node* node;
+	int parent, size, pos;
+	unsigned entries, lo, hi;
+	double pairs, cost;
+};
+
+struct sx_budget {
+	struct sx_budget_node* v;
+	int n, size;
+	int* heap;
+	int nheap;
+};
+
+static void
+sx_budget_stats(struct sx_budget* b, int i)
+{
+	struct sx_budget_node* v=b->v+i;
+	struct sx_radix_node* n, *node=v->node;
+	unsigned m=node->prefix.masklen, lo, hi;
+	int c;
+
+	v->entries=0;
+	v->pairs=0;
+	v->lo=~0U;
+	v->hi=0;
+	for(n=node; n; n=sx_radix_son(n)) {
+		if(n->isGlue)
+			continue;
+		lo=n->isAggregate?n->aggregateLow:m;
+		hi=n->isAggregate?n->aggregateHi:m;
+		v->entries++;
+		v->pairs+=sx_pow2(hi-m+1)-sx_pow2(lo-m);
+		if(lo<v->lo)
+			v->lo=lo;
+		if(hi>v->hi)
+			v->hi=hi;
+	};
+	/* children are next in pre-order: left at i+1, right after it */
+	for(c=i+1; c<i+v->size; c+=b->v[c].size) {
+		v->entries+=b->v[c].entries;
+		v->pairs+=b->v[c].pairs;
+		if(b->v[c].lo<v->lo)
+			v->lo=b->v[c].lo;
+		if(b->v[c].hi>v->hi)
+			v->hi=b->v[c].hi;
+	};
+};
+
+static int
+sx_budget_build(struct sx_budget* b, struct sx_radix_node* node, int parent)
+{
+	struct sx_budget_node* nv;
+	int i;
+
+	if(b->n==b->size) {
+		b->size=b->size?b->size*2:1024;
+		if(!(nv=realloc(b->v, b->size*sizeof(struct sx_budget_node)))) {
+			sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+				strerror(errno));
+			exit(1);
+		};
+		b->v=nv;
+	};
+	i=b->n++;
+	memset(b->v+i, 0, sizeof(struct sx_budget_node));
+	b->v[i].node=node;
+	b->v[i].parent=parent;
+	b->v[i].pos=-1;
+	if(node->l)
+		sx_budget_build(b, sx_radix_left(node), i);
+	if(node->r)
+		sx_budget_build(b, sx_radix_right(node), i);
+	b->v[i].size=b->n-i;
+	sx_budget_stats(b, i);
+	return i;
+};
+
+/* entries saved beyond what is still needed are worth nothing, so cost
+ * is over the useful part only. It only grows as fewer are needed, and
+ * is raised when a node comes up on top. */
+static double
+sx_budget_cost(struct sx_budget* b, int i, unsigned need)
+{
+	struct sx_budget_node* v=b->v+i;
+	double gain=sx_pow2(v->hi-v->node->prefix.masklen+1)-
+		sx_pow2(v->lo-v->node->prefix.masklen)-v->pairs;
+	return (gain>0?gain:0)/(v->entries-1<need?v->entries-1:need);
+};
+
+static void
+sx_budget_place(struct sx_budget* b, int k, int i)
+{
+	b->heap[k]=i;
+	b->v[i].pos=k;
+};
+
+static void
+sx_budget_sift(struct sx_budget* b, int k)
+{
+	int i=b->heap[k], c, p;
+	double cost=b->v[i].cost;
+
+	for(; k>0 && b->v[b->heap[p=(k-1)/2]].cost>cost; k=p)
+		sx_budget_place(b, k, b->heap[p]);
+	while((c=2*k+1)<b->nheap) {
+		if(c+1<b->nheap && b->v[b->heap[c+1]].cost<b->v[b->heap[c]].cost)
+			c++;
+		if(cost<=b->v[b->heap[c]].cost)
+			break;
+		sx_budget_place(b, k, b->heap[c]);
+		k=c;
+	};
+	sx_budget_place(b, k, i);
+};
+
+static void
+sx_budget_remove(struct sx_budget* b, int i)
+{
+	int k=b->v[i].pos;
+	if(k<0)
+		return;
+	b->v[i].pos=-1;
+	if(k==--b->nheap)
+		return;
+	sx_budget_place(b, k, b->heap[b->nheap]);
+	sx_budget_sift(b, k);
+};
+
+static void
+sx_budget_update(struct sx_budget* b, int i, unsigned need)
+{
+	struct sx_budget_node* v=b->v+i;
+	if(v->entries<2) {
+		sx_budget_remove(b, i);
+		return;
+	};
+	v->cost=sx_budget_cost(b, i, need);
+	if(v->pos<0) {
+		v->pos=b->nheap;
+		b->heap[b->nheap++]=i;
+	};
+	sx_budget_sift(b, v->pos);
+};
+
+/* one entry for the whole subtree of i, nodes below it are done with */
+static void
+sx_budget_collapse(struct sx_radix_tree* tree, struct sx_budget* b, int i,
+	unsigned need)
+{
+	struct sx_budget_node* v=b->v+i;
+	struct sx_radix_node* node=v->node;
+	int k;
+
+	for(k=i+1; k<i+v->size; k++)
+		sx_budget_remove(b, k);
+	sx_budget_remove(b, i);
+	sx_radix_node_release(tree, sx_radix_son(node));
+	node->son=0;
+	node->l=node->r=0;
+	node->isGlue=0;
+	node->isAggregated=0;
+	node->isAggregate=v->lo>node->prefix.masklen || v->hi>v->lo;
+	node->aggregateLow=v->lo;
+	node->aggregateHi=v->hi;
+	v->entries=1;
+	v->pairs=sx_pow2(v->hi-node->prefix.masklen+1)-
+		sx_pow2(v->lo-node->prefix.masklen);
+
+	for(k=v->parent; k>=0; k=b->v[k].parent) {
+		sx_budget_stats(b, k);
+		sx_budget_update(b, k, need);
+	};
+};
+
+int
+sx_radix_tree_budget(struct sx_radix_tree** trees, int ntrees, int max)
+{
+	struct sx_budget b;
+	int t, i, *roots, entries=0;
+	double cost;
+
+	memset(&b, 0, sizeof(b));
+	if(!(roots=calloc(ntrees, sizeof(int)))) {
+		sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+			strerror(errno));
+		exit(1);
+	};
+	for(t=0; t<ntrees; t++) {
+		roots[t]=-1;
+		if(trees[t] && trees[t]->head) {
+			roots[t]=sx_budget_build(&b, trees[t]->head, -1);
+			entries+=b.v[roots[t]].entries;
+		};
+	};
+	if(b.n && !(b.heap=malloc(b.n*sizeof(int)))) {
+		sx_report(SX_FATAL, "Unable to allocate memory: %s\n",
+			strerror(errno));
+		exit(1);
+	};
+	for(i=0; i<b.n; i++)
+		sx_budget_update(&b, i, entries>max?entries-max:1);
+
+	while(entries>max && b.nheap) {
+		i=b.heap[0];
+		if((cost=sx_budget_cost(&b, i, entries-max))>b.v[i].cost) {
+			b.v[i].cost=cost;
+			sx_budget_sift(&b, 0);
+			continue;
 		};
-		if(node->r) {
-			sx_radix_node_foreach(node->r, setGlueUpTo, &refine);
-			sx_radix_node_refine(node->r, refine);
+		/* the tree holding it is the one with the closest root before */
+		for(t=ntrees-1; t>0 && (roots[t]<0 || roots[t]>i); t--);
+		entries-=b.v[i].entries-1;
+		sx_budget_collapse(trees[t], &b, i, entries>max?entries-max:1);
+	};
+	SX_DEBUG(debug_aggregation, "Entry budget %i: %i entries\n", max,
+		entries);
+
+	free(roots);
+	free(b.v);
+	free(b.heap);
+	return entries;
+};
+
+static struct sx_radix_node*
+sx_radix_node_copy(struct sx_radix_tree* tree, struct sx_radix_node* node,
+	struct sx_radix_node* parent)
+{
+	struct sx_radix_node* copy, *n, *last, *son;
+
+	if(!(copy=sx_radix_node_new(tree, &node->prefix)))
+		goto fail;
+	*copy=*node;
+	copy->parent=sx_radix_link(parent);
+	copy->son=0;
+	for(n=sx_radix_son(node), last=copy; n; n=sx_radix_son(n),
+		last=son) {
+		if(!(son=sx_radix_node_new(tree, NULL)))
+			goto fail;
+		*son=*n;
+		son->son=0;
+		last->son=sx_radix_link(son);
+	};
+	if(node->l && !(copy->l=sx_radix_link(sx_radix_node_copy(tree,
+		sx_radix_left(node), copy))))
+		return NULL;
+	if(node->r && !(copy->r=sx_radix_link(sx_radix_node_copy(tree,
+		sx_radix_right(node), copy))))
+		return NULL;
+	return copy;
+
+fail:
+	sx_report(SX_ERROR,"Unable to create node: %s\n", strerror(errno));
+	return NULL;
+};
+
+struct sx_radix_tree*
+sx_radix_tree_copy(struct sx_radix_tree* tree)
+{
+	struct sx_radix_tree* copy=sx_radix_tree_new(tree->family);
+	if(!copy)
+		return NULL;
+	if(tree->head && !(copy->head=sx_radix_node_copy(copy, tree->head,
+		NULL))) {
+		sx_radix_tree_destroy(copy);
+		return NULL;
+	};
+	return copy;
+};
+
+/* masklens grow down the tree, so subtrees below max are not visited */
+static void
+sx_radix_node_glue_upto(struct sx_radix_node* root, unsigned max)
+{
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* n=sx_radix_cursor_first(&cur, root);
+	while(n) {
+		if(n->prefix.masklen <= max) {
+			n->isGlue=1;
+			n=sx_radix_cursor_next(&cur, n);
+		} else {
+			n=sx_radix_cursor_skip(&cur, n);
 		};
-	} else if(!node->isGlue && node->prefix.masklen==refine) {
-		/* not setting aggregate in this case */
-		if(node->l) sx_radix_node_refine(node->l, refine);
-		if(node->r) sx_radix_node_refine(node->r, refine);
-	} else if(node->isGlue) {
-		if(node->r) sx_radix_node_refine(node->r, refine);
-		if(node->l) sx_radix_node_refine(node->l, refine);
+	};
+};
+
+static void
+sx_radix_node_hyperaggregate(struct sx_radix_node* node, unsigned max)
+{
+	if(!node->isGlue) {
+		node->isAggregate=0;
+		if(node->l)
+			sx_radix_node_glue_upto(sx_radix_left(node), max);
+		if(node->r)
+			sx_radix_node_glue_upto(sx_radix_right(node), max);
 	} else {
-		/* node->prefix.masklen > refine */
-		/* do nothing, should pass specifics 'as is'. Also, do not
-		process any embedded routes, their masklen is bigger, too...
-		node->isGlue=1;
-		if(node->l) sx_radix_node_foreach(node->l, setGlue, NULL);
-		if(node->r) sx_radix_node_foreach(node->r, setGlue, NULL);
-		*/
+		if(node->l)
+			sx_radix_node_hyperaggregate(sx_radix_left(node), max);
+		if(node->r)
+			sx_radix_node_hyperaggregate(sx_radix_right(node), max);
 	};
-	return 0;
 };
-	
+
 int
-sx_radix_tree_refine(struct sx_radix_tree* tree, unsigned refine)
+sx_radix_tree_hyperaggregate(struct sx_radix_tree* tree)
+{
+	if(tree && tree->head) {
+		unsigned max = tree->family == AF_INET ? 32 : 128;
+		sx_radix_node_hyperaggregate(tree->head, max);
+	};
+	return 0;
+};
+
+/* -R and -r rework every entry (the node itself and its sons) as a length
+ * range under its prefix, the way they rework the plain routes the entry
+ * stands for. -R: an entry starting below refine accepts lengths up to
+ * refine. -r, applied after -R: an entry starting at or below refineLow
+ * accepts lengths from refineLow on, and up to the family maximum where
+ * its shortest routes were left exact by -R. Lengths accepted above an
+ * entry are cut from it, as refining the routes glues them. One walk,
+ * which carries down the lengths accepted above and stops past the bound. */
+struct sx_refine {
+	unsigned refine, refineLow, max;
+	struct sx_ranges open;
+	unsigned char* below;	/* by link: nodes with a glued node below */
+};
+
+/* node has an entry starting below refine, so -R glued the routes under
+ * it into shorter ones */
+static int
+sx_radix_node_glued(struct sx_radix_node* node, struct sx_refine* rf)
 {
-	if(tree && tree->head) return sx_radix_node_refine(tree->head, refine);
+	struct sx_radix_node* n;
+	if(node->prefix.masklen>=rf->refine)
+		return 0;
+	for(n=node; n; n=sx_radix_son(n))
+		if(!n->isGlue && (n->isAggregate?n->aggregateLow:
+			node->prefix.masklen)<rf->refine)
+			return 1;
 	return 0;
 };
 
-static void
-setGlueFrom(struct sx_radix_node* node, void* udata)
+/* marks nodes with a glued node below them in rf->below ahead of the
+ * walk, returns whether node is glued or has one below */
+static int
+sx_radix_node_refine_mark(struct sx_radix_node* node, struct sx_refine* rf)
 {
-	unsigned refine=*(unsigned*)udata;
-	if(node && node->prefix.masklen <= refine) {
-		node->isGlue=1;
+	sx_radix_link_t link;
+	int below=0;
+	if(node->prefix.masklen>=rf->refine)
+		return 0;
+	if(node->l)
+		below|=sx_radix_node_refine_mark(sx_radix_left(node), rf);
+	if(node->r)
+		below|=sx_radix_node_refine_mark(sx_radix_right(node), rf);
+	if(below) {
+		link=sx_radix_link(node);
+		rf->below[link/8]|=0x80>>(link%8);
 	};
+	return below || sx_radix_node_glued(node, rf);
 };
 
+/* an entry of node starting at refine (so at refineLow too) opens its
+ * routes up to max, except those -R glued into a shorter route: ones
+ * under a node below with an entry starting below refine. Returns 0 when
+ * there is no such node and the entry opens as a whole, otherwise what
+ * opens is kept in rf->open. *opened is set once that is done: the same
+ * routes open for every entry of node and for nodes below it, down to
+ * the next glued one, so they are not gone through again. */
 static int
-sx_radix_node_refineLow(struct sx_radix_node* node, unsigned refineLow)
+sx_radix_node_refine_exact(struct sx_radix_node* node, struct sx_refine* rf,
+	int* opened)
 {
-	if(!node->isGlue && node->prefix.masklen<=refineLow) {
-		if(!node->isAggregate) {
-			node->isAggregate=1;
-			node->aggregateLow=refineLow;
-			if(node->prefix.family == AF_INET) {
-				node->aggregateHi=32;
-			} else {
-				node->aggregateHi=128;
-			}
-		} else {
-			node->aggregateLow=refineLow;
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* x;
+	struct sx_prefix* glued=NULL, *p, q[130];
+	sx_radix_link_t link=sx_radix_link(node);
+	int nglued=0, size=0, depth, from[130], to[130], i, k;
+
+	if(!(rf->below[link/8]&(0x80>>(link%8))))
+		return 0;
+	if(*opened)
+		return 1;
+	*opened=1;
+	for(x=sx_radix_cursor_first(&cur, node); x; ) {
+		if(x==node || x->prefix.masklen>=rf->refine) {
+			x=x==node?sx_radix_cursor_next(&cur, x):
+				sx_radix_cursor_skip(&cur, x);
+			continue;
+		};
+		if(!sx_radix_node_glued(x, rf)) {
+			x=sx_radix_cursor_next(&cur, x);
+			continue;
 		};
-		if(node->l) {
-			sx_radix_node_foreach(node->l, setGlueFrom, &refineLow);
-			sx_radix_node_refineLow(node->l, refineLow);
+		if(nglued==size) {
+			size=size?size*2:16;
+			if(!(p=realloc(glued, size*sizeof(struct sx_prefix)))) {
+				sx_report(SX_ERROR,"Unable to allocate %lu bytes: %s\n",
+					(unsigned long)(size*sizeof(struct sx_prefix)),
+					strerror(errno));
+				break;
+			};
+			glued=p;
 		};
-		if(node->r) {
-			sx_radix_node_foreach(node->r, setGlueFrom, &refineLow);
-			sx_radix_node_refineLow(node->r, refineLow);
+		glued[nglued++]=x->prefix;
+		x=sx_radix_cursor_skip(&cur, x);
+	};
+	if(!nglued) {
+		free(glued);
+		return 0;
+	};
+	/* halves of node's prefix, down to ones clear of the glued nodes.
+	 * Glued nodes do not nest and come in address order, so those inside
+	 * a half are a slice of the list, split in two along with the half. */
+	q[0]=node->prefix;
+	from[0]=0;
+	to[0]=nglued;
+	for(depth=1; depth>0; ) {
+		p=&q[--depth];
+		i=from[depth];
+		if(i==to[depth]) {
+			sx_ranges_add(&rf->open, p, rf->refine, rf->max);
+			continue;
 		};
-	} else if(!node->isGlue && node->prefix.masklen==refineLow) {
-		/* not setting aggregate in this case */
-		if(node->l) sx_radix_node_refineLow(node->l, refineLow);
-		if(node->r) sx_radix_node_refineLow(node->r, refineLow);
-	} else if(node->isGlue) {
-		if(node->r) sx_radix_node_refineLow(node->r, refineLow);
-		if(node->l) sx_radix_node_refineLow(node->l, refineLow);
-	} else {
-		/* node->prefix.masklen > refine */
-		/* do nothing, should pass specifics 'as is'. Also, do not
-		process any embedded routes, their masklen is bigger, too...
-		node->isGlue=1;
-		if(node->l) sx_radix_node_foreach(node->l, setGlue, NULL);
-		if(node->r) sx_radix_node_foreach(node->r, setGlue, NULL);
-		*/
+		if(glued[i].masklen==p->masklen)
+			continue;
+		p->masklen++;
+		for(k=i; k<to[depth] && !sx_prefix_isbitset(&glued[k], p->masklen);
+			k++);
+		q[depth+1]=*p;
+		sx_prefix_setbit(&q[depth+1], p->masklen);
+		from[depth+1]=k;
+		to[depth+1]=to[depth];
+		to[depth]=k;
+		depth+=2;
+	};
+	free(glued);
+	return 1;
+};
+
+/* node's entries become the runs of l: the node itself holds the first,
+ * sons the rest, sons left over go back to the tree */
+static void
+sx_radix_node_set_levels(struct sx_radix_tree* tree,
+	struct sx_radix_node* node, const struct sx_levels* l)
+{
+	struct sx_radix_node* n=node, *son;
+	unsigned char lo[65], hi[65];
+	unsigned m=node->prefix.masklen;
+	int runs=sx_levels_runs(l, lo, hi), k;
+
+	node->isGlue=!runs;
+	for(k=0; k<runs; k++) {
+		if(k) {
+			if(!n->son) {
+				if(!(son=sx_radix_node_new(tree, &node->prefix))) {
+					sx_report(SX_ERROR,"Unable to create node: %s\n",
+						strerror(errno));
+					return;
+				};
+				n->son=sx_radix_link(son);
+			};
+			n=sx_radix_son(n);
+			n->isGlue=0;
+		};
+		n->isAggregate=(lo[k]!=m || hi[k]!=m);
+		n->aggregateLow=n->isAggregate?lo[k]:0;
+		n->aggregateHi=n->isAggregate?hi[k]:0;
+	};
+	sx_radix_node_release(tree, sx_radix_son(n));
+	n->son=0;
+};
+
+static void
+sx_radix_node_refine(struct sx_radix_tree* tree, struct sx_radix_node* node,
+	struct sx_refine* rf, struct sx_levels covered, int opened)
+{
+	struct sx_radix_node* n;
+	struct sx_levels l;
+	unsigned m=node->prefix.masklen, lo, hi;
+	int entries=0;
+
+	if(m>(rf->refineLow?rf->refineLow:rf->refine))
+		return;
+	/* routes opened above skip glued nodes and all below them */
+	if(opened && sx_radix_node_glued(node, rf))
+		opened=0;
+	memset(&l, 0, sizeof(l));
+	for(n=node; n; n=sx_radix_son(n)) {
+		if(n->isGlue)
+			continue;
+		entries++;
+		lo=n->isAggregate?n->aggregateLow:m;
+		hi=n->isAggregate?n->aggregateHi:m;
+		if(!rf->refineLow) {
+			if(lo<rf->refine && hi<rf->refine)
+				hi=rf->refine;
+		} else if(lo<=rf->refineLow) {
+			if(lo>=rf->refine && !sx_radix_node_refine_exact(node, rf,
+				&opened))
+				hi=rf->max;
+			lo=rf->refineLow;
+		};
+		sx_levels_set(&l, lo, hi);
+	};
+	if(entries) {
+		l=sx_levels_andnot(l, &covered);
+		covered=sx_levels_or(covered, &l);
+		sx_radix_node_set_levels(tree, node, &l);
+	};
+	if(node->l)
+		sx_radix_node_refine(tree, sx_radix_left(node), rf, covered, opened);
+	if(node->r)
+		sx_radix_node_refine(tree, sx_radix_right(node), rf, covered,
+			opened);
+};
+
+int
+sx_radix_tree_refine(struct sx_radix_tree* tree, unsigned refine)
+{
+	struct sx_refine rf;
+	struct sx_levels covered;
+	if(tree && tree->head) {
+		memset(&covered, 0, sizeof(covered));
+		memset(&rf, 0, sizeof(rf));
+		rf.refine=refine;
+		rf.max=tree->family==AF_INET?32:128;
+		sx_radix_node_refine(tree, tree->head, &rf, covered, 0);
 	};
 	return 0;
 };
-	
 
 int
-sx_radix_tree_refineLow(struct sx_radix_tree* tree, unsigned refineLow)
+sx_radix_tree_refineLow(struct sx_radix_tree* tree, unsigned refineLow,
+	unsigned refine)
 {
-	if(tree && tree->head)
-		return sx_radix_node_refineLow(tree->head, refineLow);
+	struct sx_refine rf;
+	struct sx_levels covered;
+	int i;
+	if(tree && tree->head) {
+		memset(&covered, 0, sizeof(covered));
+		memset(&rf, 0, sizeof(rf));
+		rf.refine=refine;
+		rf.refineLow=refineLow;
+		rf.max=tree->family==AF_INET?32:128;
+		if(!(rf.below=calloc((tree->nsegments*SX_RADIX_SEGMENT_NODES+7)/8,
+			1))) {
+			sx_report(SX_ERROR,"Unable to allocate memory: %s\n",
+				strerror(errno));
+			return 0;
+		};
+		sx_radix_node_refine_mark(tree->head, &rf);
+		sx_radix_node_refine(tree, tree->head, &rf, covered, 0);
+		free(rf.below);
+		for(i=0; i<rf.open.n; i++)
+			sx_radix_tree_insert_range(tree, &rf.open.v[i].p,
+				rf.open.v[i].lo, rf.open.v[i].hi);
+		free(rf.open.v);
+	};
 	return 0;
 };
 
@@ -5,10 +5,11 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <stdint.h>
 
 typedef struct sx_prefix { 
-	int family; 
-	int masklen; 
+	sa_family_t family; 
+	short masklen; 
 	union { 
 		struct in_addr  addr; 
 		struct in6_addr addr6; 
@@ -16,22 +17,107 @@ typedef struct sx_prefix {
 	} addr;
 } sx_prefix_t;
 
+/* nodes link to each other by 32-bit index into the segments of their
+ * tree, 0 standing for none. Links come first and masklens never exceed
+ * 128, so aggregate bounds fit in a byte and the node takes 40 bytes. */
+typedef uint32_t sx_radix_link_t;
+
 typedef struct sx_radix_node { 
-	struct sx_radix_node* parent, *l, *r, *son;
-	void* payload;
-	unsigned int isGlue:1;
-	unsigned int isAggregated:1;
-	unsigned int isAggregate:1;
-	unsigned int aggregateLow;
-	unsigned int aggregateHi;
+	sx_radix_link_t l, r;
 	struct sx_prefix prefix;
+	unsigned char isGlue:1;
+	unsigned char isAggregated:1;
+	unsigned char isAggregate:1;
+	unsigned char aggregateLow;
+	unsigned char aggregateHi;
+	sx_radix_link_t parent, son;
 } sx_radix_node_t;
 
+/* Segments are aligned to their size and the first slot of each holds
+ * its header, so the node a link is read from leads to the tree, and the
+ * tree to the segment linked to. A tree reaches SX_RADIX_DIR*SX_RADIX_LEAF
+ * segments through a directory that never moves, so aggregation workers
+ * can add segments while others follow links. */
+#define SX_RADIX_SEGMENT	65536
+#define SX_RADIX_SEGMENT_NODES	(SX_RADIX_SEGMENT/sizeof(struct sx_radix_node))
+#define SX_RADIX_LEAF		1024
+#define SX_RADIX_DIR		256
+
+struct sx_radix_segment {
+	struct sx_radix_tree* tree;
+	unsigned index;
+};
+
+/* unlinked nodes are chained through ->parent on freelist for reuse,
+ * sx_radix_tree_destroy frees the tree and all its segments at once.
+ * Nodes of a tree with an owner go to the owner's segments. */
 typedef struct sx_radix_tree { 
 	int family;
 	struct sx_radix_node* head;
+	struct sx_radix_node* freelist;
+	struct sx_radix_tree* owner;
+	struct sx_radix_segment** dir[SX_RADIX_DIR];
+	unsigned nsegments;
+	struct sx_radix_node* next, *end;
 } sx_radix_tree_t;
 
+static inline struct sx_radix_segment*
+sx_radix_segment_of(const struct sx_radix_node* node)
+{
+	return (struct sx_radix_segment*)((uintptr_t)node&
+		~(uintptr_t)(SX_RADIX_SEGMENT-1));
+};
+
+/* node link points to, from is any node of the same tree */
+static inline struct sx_radix_node*
+sx_radix_at(const struct sx_radix_node* from, sx_radix_link_t link)
+{
+	struct sx_radix_segment* seg;
+	unsigned index;
+	if(!link)
+		return NULL;
+	seg=sx_radix_segment_of(from);
+	index=link/SX_RADIX_SEGMENT_NODES;
+	if(index!=seg->index)
+		seg=seg->tree->dir[index/SX_RADIX_LEAF][index%SX_RADIX_LEAF];
+	return (struct sx_radix_node*)seg+link%SX_RADIX_SEGMENT_NODES;
+};
+
+static inline sx_radix_link_t
+sx_radix_link(const struct sx_radix_node* node)
+{
+	struct sx_radix_segment* seg;
+	if(!node)
+		return 0;
+	seg=sx_radix_segment_of(node);
+	return seg->index*SX_RADIX_SEGMENT_NODES+
+		(node-(const struct sx_radix_node*)seg);
+};
+
+static inline struct sx_radix_node*
+sx_radix_left(const struct sx_radix_node* node)
+{
+	return sx_radix_at(node, node->l);
+};
+
+static inline struct sx_radix_node*
+sx_radix_right(const struct sx_radix_node* node)
+{
+	return sx_radix_at(node, node->r);
+};
+
+static inline struct sx_radix_node*
+sx_radix_parent(const struct sx_radix_node* node)
+{
+	return sx_radix_at(node, node->parent);
+};
+
+static inline struct sx_radix_node*
+sx_radix_son(const struct sx_radix_node* node)
+{
+	return sx_radix_at(node, node->son);
+};
+
 /* most common operations with the tree is to: lookup/insert/unlink */
 struct sx_radix_node* sx_radix_tree_lookup(struct sx_radix_tree* tree,
 	struct sx_prefix* prefix);
@@ -40,32 +126,85 @@ struct sx_radix_node* sx_radix_tree_insert(struct sx_radix_tree* tree,
 void sx_radix_tree_unlink(struct sx_radix_tree* t, struct sx_radix_node* n);
 struct sx_radix_node* sx_radix_tree_lookup_exact(struct sx_radix_tree* tree,
 	struct sx_prefix* prefix);
+/* prefix-ranges (^-, ^+, ^n-m) as single entries, see sx_prefix.c */
+struct sx_radix_node* sx_radix_tree_insert_range(struct sx_radix_tree* tree,
+	struct sx_prefix* prefix, unsigned lo, unsigned hi);
+struct sx_radix_node* sx_radix_tree_match(struct sx_radix_tree* tree,
+	struct sx_prefix* prefix);
+/* same for n prefixes at once, entries (or NULL) go to found[0..n) */
+int sx_radix_tree_match_batch(struct sx_radix_tree* tree, struct sx_prefix* p,
+	int n, struct sx_radix_node** found);
+int sx_radix_tree_expand_ranges(struct sx_radix_tree* tree);
+/* bulk path: sort and dedupe an array, then build the tree from it */
+int sx_prefix_sort(struct sx_prefix* p, int n);
+int sx_radix_tree_load(struct sx_radix_tree* tree, struct sx_prefix* p, int n);
+/* compact pre-order image of a tree, as it is (glue, sons, aggregation) */
+int sx_radix_tree_write(struct sx_radix_tree* tree, FILE* f);
+const unsigned char* sx_radix_tree_read(struct sx_radix_tree* tree,
+	const unsigned char* p, const unsigned char* end);
 
 struct sx_prefix* sx_prefix_alloc(struct sx_prefix* p);
 void sx_prefix_destroy(struct sx_prefix* p);
 void sx_prefix_adjust_masklen(struct sx_prefix* p);
 struct sx_prefix* sx_prefix_new(int af, char* text);
 int sx_prefix_parse(struct sx_prefix* p, int af, char* text);
+int sx_prefix_parsen(struct sx_prefix* p, int af, const char* text,
+	size_t len);
 int sx_prefix_range_parse(struct sx_radix_tree* t, int af, int ml, char* text);
+int sx_prefix_ntop(struct sx_prefix* p, char* out);
 int sx_prefix_fprint(FILE* f, struct sx_prefix* p);
 int sx_prefix_snprintf(struct sx_prefix* p, char* rbuffer, int srb);
 int sx_prefix_snprintf_sep(struct sx_prefix* p, char* rbuffer, int srb, char*);
 int sx_prefix_snprintf_fmt(struct sx_prefix* p, char* rbuffer, int srb,
 	const char* name, const char* fmt);
 int sx_prefix_jsnprintf(struct sx_prefix* p, char* rbuffer, int srb);
+int sx_prefix_isbitset(struct sx_prefix* p, int n);
+int sx_prefix_eqbits(struct sx_prefix* a, struct sx_prefix* b);
 struct sx_radix_tree* sx_radix_tree_new(int af);
-struct sx_radix_node* sx_radix_node_new(struct sx_prefix* prefix);
+void sx_radix_tree_destroy(struct sx_radix_tree* t);
+struct sx_radix_node* sx_radix_node_new(struct sx_radix_tree* t,
+	struct sx_prefix* prefix);
 struct sx_prefix* sx_prefix_overlay(struct sx_prefix* p, int n);
 int  sx_radix_tree_empty(struct sx_radix_tree* t);
 void sx_radix_node_fprintf(struct sx_radix_node* node, void* udata);
+/* pre-order walk without recursion or callbacks, glue included:
+ *   SX_RADIX_FOREACH(node, &cursor, tree) { if(node->isGlue) continue; }
+ * a walk may start at any node and covers its subtree, _skip moves past
+ * the subtree of the current node */
+struct sx_radix_cursor {
+	struct sx_radix_node* stack[129];
+	int depth;
+};
+struct sx_radix_node* sx_radix_cursor_first(struct sx_radix_cursor* cur,
+	struct sx_radix_node* node);
+struct sx_radix_node* sx_radix_cursor_next(struct sx_radix_cursor* cur,
+	struct sx_radix_node* node);
+struct sx_radix_node* sx_radix_cursor_skip(struct sx_radix_cursor* cur,
+	struct sx_radix_node* node);
+#define SX_RADIX_FOREACH(node, cur, tree)				\
+	for ((node) = sx_radix_cursor_first((cur), (tree)->head); (node);	\
+		(node) = sx_radix_cursor_next((cur), (node)))
 int  sx_radix_node_foreach(struct sx_radix_node* node, 
 	void (*func)(struct sx_radix_node*, void*), void* udata);
 int sx_radix_tree_foreach(struct sx_radix_tree* tree, 
 	void (*func)(struct sx_radix_node*, void*), void* udata);
 int sx_radix_tree_aggregate(struct sx_radix_tree* tree);
+/* fewest entries accepting the same, against greedy sx_radix_tree_aggregate */
+int sx_radix_tree_optimize(struct sx_radix_tree* tree);
+int sx_radix_tree_entries(struct sx_radix_tree* tree);
+struct sx_radix_tree* sx_radix_tree_copy(struct sx_radix_tree* tree);
+/* lossy: collapse subtrees until all trees hold at most max entries */
+int sx_radix_tree_budget(struct sx_radix_tree** trees, int ntrees, int max);
+void sx_radix_tree_accepted(struct sx_radix_tree* tree, double* pairs,
+	double* addresses);
 int sx_radix_tree_refine(struct sx_radix_tree* tree, unsigned refine);
-int sx_radix_tree_refineLow(struct sx_radix_tree* tree, unsigned refineLow);
+int sx_radix_tree_refineLow(struct sx_radix_tree* tree, unsigned refineLow,
+	unsigned refine);
 int sx_radix_tree_hyperaggregate(struct sx_radix_tree* tree);
+int sx_radix_tree_intersect(struct sx_radix_tree* tree,
+	struct sx_radix_tree* other);
+int sx_radix_tree_subtract(struct sx_radix_tree* tree,
+	struct sx_radix_tree* other);
 
 #ifndef HAVE_STRLCPY
 size_t strlcpy(char* dst, const char* src, size_t size);
@@ -1,4 +1,5 @@
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
@@ -15,13 +16,97 @@ sx_slentry_new(char* t)
 	return e;
 };
 
+struct sx_slentry*
+sx_slentry_arena_new(struct sx_arena* a, char* t)
+{
+	struct sx_slentry* e=sx_arena_alloc(a, sizeof(struct sx_slentry));
+	if(!e) return NULL;
+	memset(e,0,sizeof(struct sx_slentry));
+	if(t && !(e->text=sx_arena_strdup(a, t))) return NULL;
+	return e;
+};
+
+/* FNV-1a over case-folded bytes */
+unsigned
+sx_tset_hash(const char* t)
+{
+	unsigned h=2166136261u;
+	for(;*t;t++) {
+		h^=(unsigned char)tolower((unsigned char)*t);
+		h*=16777619u;
+	};
+	return h;
+};
+
 struct sx_tentry*
-sx_tentry_new(char* t)
+sx_tset_find(struct sx_tset* set, const char* t, unsigned hash)
 {
-	struct sx_tentry* te = malloc(sizeof(struct sx_tentry));
-	if (!te)
+	unsigned i, mask=set->size-1;
+	if(!set->size)
 		return NULL;
-	memset(te, 0, sizeof(struct sx_tentry));
-	te->text = strdup(t);
+	for(i=hash&mask; set->slots[i].text; i=(i+1)&mask) {
+		if(set->slots[i].hash==hash && !strcasecmp(set->slots[i].text, t))
+			return set->slots+i;
+	};
+	return NULL;
+};
+
+static int
+sx_tset_grow(struct sx_tset* set)
+{
+	struct sx_tentry* old=set->slots;
+	unsigned i, j, osize=set->size, size=osize?osize*2:64;
+	set->slots=calloc(size, sizeof(struct sx_tentry));
+	if(!set->slots) {
+		set->slots=old;
+		return 0;
+	};
+	set->size=size;
+	for(i=0;i<osize;i++) {
+		if(!old[i].text)
+			continue;
+		for(j=old[i].hash&(size-1); set->slots[j].text; j=(j+1)&(size-1));
+		set->slots[j]=old[i];
+	};
+	free(old);
+	return 1;
+};
+
+struct sx_tentry*
+sx_tset_insert(struct sx_tset* set, const char* t)
+{
+	unsigned hash=sx_tset_hash(t), i;
+	struct sx_tentry* te;
+	if((te=sx_tset_find(set, t, hash)))
+		return te;
+	if((set->count+1)*4>set->size*3 && !sx_tset_grow(set))
+		return NULL;
+	for(i=hash&(set->size-1); set->slots[i].text; i=(i+1)&(set->size-1));
+	te=set->slots+i;
+	te->text=set->arena?sx_arena_strdup(set->arena, t):strdup(t);
+	if(!te->text)
+		return NULL;
+	te->hash=hash;
+	te->data=NULL;
+	set->count++;
 	return te;
 };
+
+int
+sx_tset_add(struct sx_tset* set, const char* t)
+{
+	return sx_tset_insert(set, t)!=NULL;
+};
+
+void
+sx_tset_free(struct sx_tset* set)
+{
+	unsigned i;
+	if(!set->arena) {
+		for(i=0;i<set->size;i++)
+			free(set->slots[i].text);
+	};
+	free(set->slots);
+	set->slots=NULL;
+	set->size=set->count=0;
+};
@@ -7,11 +7,7 @@
 #include "sys_queue.h"
 #endif
 
-#if HAVE_SYS_TREE_H
-#include <sys/tree.h>
-#else
-#include "sys_tree.h"
-#endif
+#include "sx_arena.h"
 
 struct sx_slentry {
 	STAILQ_ENTRY(sx_slentry) next;
@@ -19,12 +15,31 @@ struct sx_slentry {
 };
 
 struct sx_slentry* sx_slentry_new(char* text);
+struct sx_slentry* sx_slentry_arena_new(struct sx_arena* a, char* text);
 
 struct sx_tentry {
-	RB_ENTRY(sx_tentry) entry;
+	unsigned hash;
 	char* text;
+	void* data;
+};
+
+/* open-addressing hash set of case-insensitive strings, zero-initialized
+ * struct is an empty set. Names are kept as written (copied into arena
+ * when it is set); only hashing and comparison fold case. */
+struct sx_tset {
+	struct sx_tentry* slots;
+	unsigned size, count;
+	struct sx_arena* arena;
 };
 
-struct sx_tentry* sx_tentry_new(char* text);
+unsigned sx_tset_hash(const char* text);
+struct sx_tentry* sx_tset_find(struct sx_tset* set, const char* text,
+	unsigned hash);
+int sx_tset_add(struct sx_tset* set, const char* text);
+/* returns entry for text, adding it (with NULL data) when missing */
+struct sx_tentry* sx_tset_insert(struct sx_tset* set, const char* text);
+/* frees the slots, and names unless they are in arena; the set is empty
+ * afterwards */
+void sx_tset_free(struct sx_tset* set);
 
 #endif
@@ -0,0 +1,102 @@
+/* parallel sx_radix_tree_aggregate against the serial one: both copies of
+ * a generated tree have to end up the same, glue and sons included */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sx_prefix.h"
+
+extern int aggregation_threads;
+
+static void
+gen(struct sx_radix_tree* tree, int n, int dense)
+{
+	struct sx_prefix p;
+	int i, k, lo, hi, max=tree->family==AF_INET?32:128;
+
+	for(i=0; i<n; i++) {
+		memset(&p, 0, sizeof(p));
+		p.family=tree->family;
+		for(k=0; k<(max/8); k++)
+			p.addr.addrs[k]=rand();
+		if(dense) {
+			/* packed into a /14, so that much of it aggregates */
+			p.addr.addrs[0]=10;
+			p.addr.addrs[1]&=3;
+		};
+		p.masklen=tree->family==AF_INET ? 8+rand()%17 : 20+rand()%29;
+		sx_prefix_adjust_masklen(&p);
+		if(rand()%6==0) {
+			lo=p.masklen+rand()%3;
+			hi=lo+rand()%5;
+			sx_radix_tree_insert_range(tree, &p, lo, hi>max?max:hi);
+		} else {
+			sx_radix_tree_insert(tree, &p);
+		};
+	};
+};
+
+static int
+same(struct sx_radix_tree* a, struct sx_radix_tree* b)
+{
+	FILE* fa=tmpfile(), *fb=tmpfile();
+	int ca, cb;
+
+	if(!fa || !fb) {
+		perror("tmpfile");
+		exit(1);
+	};
+	sx_radix_tree_write(a, fa);
+	sx_radix_tree_write(b, fb);
+	rewind(fa);
+	rewind(fb);
+	do {
+		ca=getc(fa);
+		cb=getc(fb);
+	} while(ca==cb && ca!=EOF);
+	fclose(fa);
+	fclose(fb);
+	return ca==cb;
+};
+
+int
+main(void)
+{
+	static const int sizes[]={ 100, 5000, 200000 };
+	struct sx_radix_tree* serial, *parallel;
+	int seed, af, size, bad=0, runs=0;
+
+	for(seed=1; seed<=3; seed++) {
+		for(af=0; af<2; af++) {
+			for(size=0; size<3; size++) {
+				srand(seed);
+				serial=sx_radix_tree_new(af ? AF_INET6 : AF_INET);
+				gen(serial, sizes[size], seed==3);
+				parallel=sx_radix_tree_copy(serial);
+
+				aggregation_threads=1;
+				sx_radix_tree_aggregate(serial);
+				/* more than one thread asked for takes the parallel path
+				 * whatever the tree size */
+				aggregation_threads=4;
+				sx_radix_tree_aggregate(parallel);
+
+				runs++;
+				if(!same(serial, parallel)) {
+					printf("aggregation differs: seed %i, %s, %i prefixes\n",
+						seed, af ? "ipv6" : "ipv4", sizes[size]);
+					bad++;
+				};
+				sx_radix_tree_destroy(serial);
+				sx_radix_tree_destroy(parallel);
+			};
+		};
+	};
+	printf("aggregate: %i trees, %i differ\n", runs, bad);
+	return bad!=0;
+};
@@ -0,0 +1,173 @@
+/* -e, sx_radix_tree_budget: random range sets under 10.0.0.0/16 and
+ * 2001::/16, alone and sharing a budget as with -x, cut to a random number
+ * of entries. Every prefix accepted before has to be accepted after, the
+ * entries left have to fit the budget and be the ones returned, and the
+ * prefixes and addresses sx_radix_tree_accepted counts have to be those of
+ * the accepted sets. Then how long it takes to cut a large tree. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sx_prefix.h"
+
+/* prefixes of the /16 down to /28, numbered level by level */
+#define LEVELS 13
+#define PREFIXES ((1<<LEVELS)-1)
+
+static void
+block_prefix(struct sx_prefix* p, int af, int len, int v)
+{
+	memset(p, 0, sizeof(*p));
+	p->family=af;
+	p->addr.addrs[0]=af==AF_INET ? 10 : 0x20;
+	p->addr.addrs[1]=af==AF_INET ? 0 : 0x01;
+	v<<=32-len;
+	p->addr.addrs[2]=v>>8;
+	p->addr.addrs[3]=v;
+	p->masklen=len;
+};
+
+static void
+accepted(struct sx_radix_tree* tree, unsigned char* acc)
+{
+	struct sx_prefix p;
+	int len, v;
+
+	for(len=16; len<16+LEVELS; len++)
+		for(v=0; v<1<<(len-16); v++) {
+			block_prefix(&p, tree->family, len, v);
+			*acc++=sx_radix_tree_match(tree, &p)!=NULL;
+		};
+};
+
+/* prefixes and addresses of an accepted set */
+static void
+count(int af, unsigned char* acc, double* pairs, double* addresses)
+{
+	static unsigned char inside[1<<(LEVELS-1)];
+	double unit=1;
+	int len, v, k, i=0;
+
+	memset(inside, 0, sizeof(inside));
+	*pairs=*addresses=0;
+	for(len=16; len<16+LEVELS; len++)
+		for(v=0; v<1<<(len-16); v++, i++) {
+			if(!acc[i])
+				continue;
+			++*pairs;
+			for(k=v<<(15+LEVELS-len); k<(v+1)<<(15+LEVELS-len); k++)
+				inside[k]=1;
+		};
+	for(k=0; k<(af==AF_INET?32:128)-15-LEVELS; k++)
+		unit*=2;
+	for(k=0; k<1<<(LEVELS-1); k++)
+		*addresses+=inside[k]*unit;
+};
+
+static void
+gen(struct sx_radix_tree* tree, int n)
+{
+	struct sx_prefix p;
+	int i, len, lo, hi;
+
+	for(i=0; i<n; i++) {
+		len=16+rand()%(LEVELS-4);
+		block_prefix(&p, tree->family, len, rand()%(1<<(len-16)));
+		if(rand()%3) {
+			sx_radix_tree_insert(tree, &p);
+		} else {
+			lo=len+rand()%3;
+			hi=lo+rand()%(16+LEVELS-lo);
+			sx_radix_tree_insert_range(tree, &p, lo, hi);
+		};
+	};
+	sx_radix_tree_aggregate(tree);
+};
+
+static int
+check(int ntrees, int n)
+{
+	unsigned char before[2][PREFIXES], after[2][PREFIXES];
+	struct sx_radix_tree* trees[2];
+	double pairs, addresses, setpairs, setaddresses;
+	int t, i, max, entries=0, left, bad=0;
+
+	for(t=0; t<ntrees; t++) {
+		trees[t]=sx_radix_tree_new(t ? AF_INET6 : AF_INET);
+		gen(trees[t], n);
+		entries+=sx_radix_tree_entries(trees[t]);
+		accepted(trees[t], before[t]);
+	};
+	max=ntrees+rand()%entries;
+	left=sx_radix_tree_budget(trees, ntrees, max);
+	bad+=left>max;
+	bad+=left>entries;
+	for(t=0; t<ntrees; t++) {
+		left-=sx_radix_tree_entries(trees[t]);
+		accepted(trees[t], after[t]);
+		for(i=0; i<PREFIXES; i++)
+			bad+=before[t][i] && !after[t][i];
+		sx_radix_tree_accepted(trees[t], &pairs, &addresses);
+		count(trees[t]->family, after[t], &setpairs, &setaddresses);
+		bad+=pairs!=setpairs || addresses!=setaddresses;
+		sx_radix_tree_destroy(trees[t]);
+	};
+	bad+=left!=0;
+	return bad;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+static void
+bench(int n, int max)
+{
+	struct sx_radix_tree* tree=sx_radix_tree_new(AF_INET);
+	struct sx_prefix p;
+	double t0;
+	int i, k, entries, left;
+
+	for(i=0; i<n; i++) {
+		memset(&p, 0, sizeof(p));
+		p.family=AF_INET;
+		for(k=0; k<4; k++)
+			p.addr.addrs[k]=rand();
+		p.masklen=12+rand()%13;
+		sx_prefix_adjust_masklen(&p);
+		sx_radix_tree_insert(tree, &p);
+	};
+	sx_radix_tree_aggregate(tree);
+	entries=sx_radix_tree_entries(tree);
+	t0=now();
+	left=sx_radix_tree_budget(&tree, 1, max);
+	printf("budget: %i entries cut to %i in %.3f s\n", entries, left,
+		now()-t0);
+	sx_radix_tree_destroy(tree);
+};
+
+int
+main(int argc, char* argv[])
+{
+	static const int sizes[]={ 1, 10, 100, 1000 };
+	int i, bad=0;
+
+	srand(argc>1?atoi(argv[1]):1);
+	for(i=0; i<400; i++)
+		bad+=check(1+i%2, sizes[i/2%4]);
+	printf("budget: 400 range sets, %i mismatches\n", bad);
+	if(bad)
+		return 1;
+	bench(500000, 1000);
+	return 0;
+};
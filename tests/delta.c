@@ -0,0 +1,355 @@
+/* -i deltas applied back: the entries of the filter printed whole for an
+ * old tree, with the removals and additions bgpq_state_delta prints against
+ * its saved state applied, have to be the entries of the new filter printed
+ * whole. Cisco prefix-lists, Juniper route-filter-lists and JSON, ipv4 and
+ * ipv6, and an unchanged filter has to give an empty delta. Then how long
+ * a delta takes on a large filter against printing it whole. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bgpq3.h"
+
+struct entry {
+	struct sx_prefix p;
+	unsigned lo, hi;
+};
+
+struct lines {
+	char** v;
+	int n, size;
+};
+
+static const struct {
+	bgpq_vendor_t vendor;
+	bgpq_gen_t generation;
+	const char* name;
+} formats[]={
+	{ V_CISCO, T_PREFIXLIST, "cisco" },
+	{ V_JUNIPER, T_ROUTE_FILTER_LIST, "juniper" },
+	{ V_JSON, T_PREFIXLIST, "json" }
+};
+
+static void
+add(struct lines* l, const char* s, size_t len)
+{
+	if(l->n==l->size) {
+		l->size=l->size ? l->size*2 : 1024;
+		if(!(l->v=realloc(l->v, l->size*sizeof(char*)))) {
+			perror("realloc");
+			exit(1);
+		};
+	};
+	l->v[l->n]=malloc(len+1);
+	memcpy(l->v[l->n], s, len);
+	l->v[l->n++][len]=0;
+};
+
+static void
+clear(struct lines* l)
+{
+	int i;
+	for(i=0; i<l->n; i++)
+		free(l->v[i]);
+	free(l->v);
+	memset(l, 0, sizeof(*l));
+};
+
+static int
+cmp(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+};
+
+/* line without leading blanks and a trailing ';' or ',' */
+static char*
+trim(char* line, size_t* len)
+{
+	while(*line==' ')
+		line++;
+	*len=strcspn(line, "\n");
+	if(*len && (line[*len-1]==';' || line[*len-1]==','))
+		--*len;
+	return line;
+};
+
+/* entries of a whole filter, one string each */
+static void
+entries(FILE* f, int format, struct lines* l)
+{
+	char line[512], *s;
+	size_t len;
+
+	rewind(f);
+	while(fgets(line, sizeof(line), f)) {
+		s=trim(line, &len);
+		if(format==0 ? strncmp(s, "ip", 2) || strstr(s, " permit ")==NULL :
+			format==1 ? !len || !strchr("0123456789abcdef:", s[0]) :
+			strncmp(s, "{ \"prefix\"", 10))
+			continue;
+		add(l, s, len);
+	};
+};
+
+/* removals and additions of a delta, as entries of a whole filter */
+static void
+delta(FILE* f, int format, struct lines* removed, struct lines* added)
+{
+	static const char path[]="policy-options route-filter-list NN ";
+	char line[512], *s;
+	struct lines* to=NULL;
+	size_t len;
+
+	rewind(f);
+	while(fgets(line, sizeof(line), f)) {
+		s=trim(line, &len);
+		if(format==0) {
+			if(!strncmp(s, "no ", 3))
+				add(removed, s+3, len-3);
+			else
+				add(added, s, len);
+		} else if(format==1) {
+			if(!strncmp(s, "delete ", 7) && !strncmp(s+7, path, 36))
+				add(removed, s+7+36, len-7-36);
+			else if(!strncmp(s, "set ", 4) && !strncmp(s+4, path, 36))
+				add(added, s+4+36, len-4-36);
+			else
+				add(added, "?", 1);
+		} else {
+			if(strstr(s, "\"removed\""))
+				to=removed;
+			else if(strstr(s, "\"added\""))
+				to=added;
+			else if(!strncmp(s, "{ \"prefix\"", 10) && to)
+				add(to, s, len);
+		};
+	};
+};
+
+static int
+applies(struct lines* old, struct lines* removed, struct lines* added,
+	struct lines* new)
+{
+	struct lines got={NULL, 0, 0};
+	int i, j, bad=0;
+
+	for(i=0; i<old->n; i++) {
+		for(j=0; j<removed->n; j++)
+			if(removed->v[j] && !strcmp(old->v[i], removed->v[j]))
+				break;
+		if(j<removed->n) {
+			free(removed->v[j]);
+			removed->v[j]=NULL;
+		} else {
+			add(&got, old->v[i], strlen(old->v[i]));
+		};
+	};
+	/* nothing removed that was not there */
+	for(j=0; j<removed->n; j++)
+		bad+=removed->v[j]!=NULL;
+	for(i=0; i<added->n; i++)
+		add(&got, added->v[i], strlen(added->v[i]));
+	qsort(got.v, got.n, sizeof(char*), cmp);
+	qsort(new->v, new->n, sizeof(char*), cmp);
+	if(got.n!=new->n)
+		bad++;
+	for(i=0; !bad && i<got.n; i++)
+		bad+=strcmp(got.v[i], new->v[i])!=0;
+	clear(&got);
+	return bad;
+};
+
+static void
+gen(struct entry* e, int af)
+{
+	int k, max=af==AF_INET?32:128;
+
+	memset(&e->p, 0, sizeof(e->p));
+	e->p.family=af;
+	for(k=1; k<max/8; k++)
+		e->p.addr.addrs[k]=rand();
+	e->p.addr.addrs[0]=af==AF_INET?10:0x20;
+	e->p.addr.addrs[1]&=0x0f;
+	e->p.masklen=af==AF_INET ? 12+rand()%13 : 24+rand()%41;
+	sx_prefix_adjust_masklen(&e->p);
+	e->lo=e->p.masklen+(rand()%3 ? 0 : rand()%4);
+	e->hi=rand()%2 ? e->lo : e->lo+rand()%(max-e->lo+1);
+};
+
+static void
+load(struct bgpq_expander* b, int af, int format, struct entry* e, int n)
+{
+	int i;
+
+	bgpq_expander_init(b, af);
+	b->vendor=formats[format].vendor;
+	b->generation=formats[format].generation;
+	for(i=0; i<n; i++)
+		sx_radix_tree_insert_range(b->tree, &e[i].p, e[i].lo, e[i].hi);
+	sx_radix_tree_aggregate(b->tree);
+};
+
+static void
+print(FILE* f, struct bgpq_expander* b)
+{
+	if(b->generation==T_ROUTE_FILTER_LIST)
+		bgpq3_print_route_filter_list(f, b);
+	else
+		bgpq3_print_prefixlist(f, b);
+};
+
+static void
+release(struct bgpq_expander* b)
+{
+	sx_radix_tree_destroy(b->tree);
+	sx_arena_free(&b->arena);
+};
+
+static char state[]="/tmp/bgpq3-state.XXXXXX";
+
+static int
+check(int af, int format, int n)
+{
+	struct entry* e=malloc(2*n*sizeof(*e)), *ne=malloc(2*n*sizeof(*e));
+	struct lines old={NULL, 0, 0}, new={NULL, 0, 0};
+	struct lines removed={NULL, 0, 0}, added={NULL, 0, 0};
+	struct bgpq_expander b;
+	FILE* fo=tmpfile(), *fn=tmpfile(), *fd=tmpfile();
+	int i, nn=0, bad=0;
+
+	if(!fo || !fn || !fd) {
+		perror("tmpfile");
+		exit(1);
+	};
+	for(i=0; i<n; i++)
+		gen(e+i, af);
+	/* some entries dropped, some added, some with another range */
+	for(i=0; i<n; i++) {
+		if(rand()%10==0)
+			continue;
+		ne[nn]=e[i];
+		if(rand()%10==0)
+			ne[nn].hi=ne[nn].lo+rand()%((af==AF_INET?32:128)-ne[nn].lo+1);
+		nn++;
+	};
+	for(i=0; i<n/10+1; i++)
+		gen(ne+nn++, af);
+
+	load(&b, af, format, e, n);
+	print(fo, &b);
+	entries(fo, format, &old);
+	bgpq_state_save(&b, state);
+
+	/* unchanged: nothing to print */
+	if(!bgpq_state_delta(fd, &b, state))
+		bad++;
+	delta(fd, format, &removed, &added);
+	bad+=removed.n+added.n;
+	clear(&removed);
+	clear(&added);
+	release(&b);
+
+	load(&b, af, format, ne, nn);
+	print(fn, &b);
+	entries(fn, format, &new);
+	rewind(fd);
+	if(ftruncate(fileno(fd), 0) || !bgpq_state_delta(fd, &b, state))
+		bad++;
+	delta(fd, format, &removed, &added);
+	bad+=applies(&old, &removed, &added, &new);
+	if(bad)
+		printf("delta: %s, %s, %i entries: does not apply\n",
+			formats[format].name, af==AF_INET?"ipv4":"ipv6", n);
+	release(&b);
+
+	clear(&old);
+	clear(&new);
+	clear(&removed);
+	clear(&added);
+	fclose(fo);
+	fclose(fn);
+	fclose(fd);
+	free(e);
+	free(ne);
+	return bad;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+/* a prefix-list of 500k routes, one in a hundred changed */
+static void
+bench(int n)
+{
+	struct entry* e=malloc(n*sizeof(*e));
+	struct bgpq_expander b;
+	FILE* out=fopen("/dev/null", "w");
+	double t0, t1, t2;
+	int i;
+
+	if(!out) {
+		perror("/dev/null");
+		exit(1);
+	};
+	for(i=0; i<n; i++) {
+		gen(e+i, AF_INET);
+		e[i].p.addr.addrs[0]=1+rand()%223;
+		e[i].p.addr.addrs[1]=rand();
+		sx_prefix_adjust_masklen(&e[i].p);
+	};
+	load(&b, AF_INET, 0, e, n);
+	bgpq_state_save(&b, state);
+	release(&b);
+	for(i=0; i<n/100; i++)
+		gen(e+rand()%n, AF_INET);
+	load(&b, AF_INET, 0, e, n);
+	t0=now();
+	bgpq3_print_prefixlist(out, &b);
+	t1=now();
+	bgpq_state_delta(out, &b, state);
+	t2=now();
+	printf("delta: %i entries, printed whole %.3f s, as a delta %.3f s\n",
+		sx_radix_tree_entries(b.tree), t1-t0, t2-t1);
+	release(&b);
+	fclose(out);
+	free(e);
+};
+
+int
+main(int argc, char* argv[])
+{
+	static const int sizes[]={ 1, 10, 300, 3000 };
+	int fd, af, format, size, runs=0, bad=0;
+
+	if((fd=mkstemp(state))==-1) {
+		perror(state);
+		return 1;
+	};
+	close(fd);
+	srand(argc>1?atoi(argv[1]):1);
+	for(af=0; af<2; af++) {
+		for(format=0; format<3; format++) {
+			for(size=0; size<4; size++) {
+				bad+=check(af ? AF_INET6 : AF_INET, format, sizes[size]);
+				runs++;
+			};
+		};
+	};
+	printf("delta: %i filters, %i do not apply\n", runs, bad);
+	if(!bad)
+		bench(500000);
+	unlink(state);
+	return bad!=0;
+};
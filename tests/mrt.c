@@ -0,0 +1,460 @@
+/* -k on generated MRT TABLE_DUMP_V2 dumps: plain and add-path RIB
+ * records, two and four byte peer AS numbers, paths ending in an AS_SET or
+ * empty, records of other types and families in between. The listing has
+ * to be exactly the rejected entries a linear scan of the filter finds,
+ * with their origins, and the per-peer totals. Dumps with corrupted bytes
+ * and truncated ones have to be read through without a crash. Then how
+ * long a million records take. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bgpq3.h"
+
+struct dump {
+	unsigned char* buf;
+	size_t len, size;
+};
+
+struct entry {
+	struct sx_prefix p;
+	unsigned lo, hi;
+};
+
+struct peer {
+	const char* addr;
+	int v6, as4;
+	uint32_t as;
+	unsigned long accepted, rejected, member;
+};
+
+static struct peer peers[]={
+	{ "192.0.2.1", 0, 0, 65001 },
+	{ "2001:db8::1", 1, 1, 100 },
+	{ "198.51.100.7", 0, 1, 4200000000u }
+};
+
+#define NPEERS (int)(sizeof(peers)/sizeof(peers[0]))
+
+static void
+put(struct dump* d, const void* p, size_t n)
+{
+	if(d->len+n>d->size) {
+		while(d->len+n>d->size)
+			d->size=d->size ? d->size*2 : 65536;
+		if(!(d->buf=realloc(d->buf, d->size))) {
+			perror("realloc");
+			exit(1);
+		};
+	};
+	memcpy(d->buf+d->len, p, n);
+	d->len+=n;
+};
+
+static void
+put8(struct dump* d, unsigned v)
+{
+	unsigned char c=v;
+	put(d, &c, 1);
+};
+
+static void
+put16(struct dump* d, unsigned v)
+{
+	put8(d, v>>8);
+	put8(d, v);
+};
+
+static void
+put32(struct dump* d, uint32_t v)
+{
+	put16(d, v>>16);
+	put16(d, v);
+};
+
+static void
+set16(struct dump* d, size_t at, unsigned v)
+{
+	d->buf[at]=v>>8;
+	d->buf[at+1]=v;
+};
+
+static void
+set32(struct dump* d, size_t at, uint32_t v)
+{
+	set16(d, at, v>>16);
+	set16(d, at+2, v);
+};
+
+/* record header, the length is set by end */
+static size_t
+begin(struct dump* d, unsigned type, unsigned subtype)
+{
+	put32(d, 0);
+	put16(d, type);
+	put16(d, subtype);
+	put32(d, 0);
+	return d->len;
+};
+
+static void
+end(struct dump* d, size_t body)
+{
+	set32(d, body-4, d->len-body);
+};
+
+static void
+peer_index(struct dump* d)
+{
+	size_t body=begin(d, 13, 1);
+	struct sx_prefix a;
+	int i;
+
+	put32(d, 0x01020304);
+	put16(d, 4);
+	put(d, "view", 4);
+	put16(d, NPEERS);
+	for(i=0; i<NPEERS; i++) {
+		put8(d, (peers[i].v6?1:0)|(peers[i].as4?2:0));
+		put32(d, i+1);
+		sx_prefix_parse(&a, 0, (char*)peers[i].addr);
+		put(d, a.addr.addrs, peers[i].v6?16:4);
+		if(peers[i].as4)
+			put32(d, peers[i].as);
+		else
+			put16(d, peers[i].as);
+	};
+	end(d, body);
+};
+
+static int
+covers(struct entry* e, struct sx_prefix* q)
+{
+	int i;
+	if(q->family!=e->p.family || q->masklen<e->lo || q->masklen>e->hi ||
+		q->masklen<e->p.masklen)
+		return 0;
+	for(i=0; i<e->p.masklen; i++)
+		if(sx_prefix_isbitset(&e->p, i+1)!=sx_prefix_isbitset(q, i+1))
+			return 0;
+	return 1;
+};
+
+static void
+gen(struct sx_prefix* p, int af, int minlen, int maxlen)
+{
+	int k, max=af==AF_INET?32:128;
+
+	memset(p, 0, sizeof(*p));
+	p->family=af;
+	for(k=1; k<max/8; k++)
+		p->addr.addrs[k]=rand();
+	p->addr.addrs[0]=10;
+	p->addr.addrs[1]&=0x0f;
+	p->masklen=minlen+rand()%(maxlen-minlen+1);
+	sx_prefix_adjust_masklen(p);
+};
+
+/* AS_PATH with origin last, an AS_SET after it, or no segments at all;
+ * returns the origin the listing should show */
+static uint32_t
+aspath(struct dump* d, struct peer* peer)
+{
+	uint32_t origin=90+rand()%60;
+	int kind=rand()%6, ext=rand()%2;
+	unsigned len=kind==4 ? 0 : kind==5 ? 2+12+2+8 : 2+12;
+
+	put8(d, ext ? 0x50 : 0x40);
+	put8(d, 2);
+	if(ext)
+		put16(d, len);
+	else
+		put8(d, len);
+	if(kind==4)
+		return peer->as;
+	put8(d, 2);
+	put8(d, 3);
+	put32(d, peer->as);
+	put32(d, 64512+rand()%1000);
+	put32(d, origin);
+	if(kind==5) {
+		put8(d, 1);
+		put8(d, 2);
+		put32(d, origin+1);
+		put32(d, origin+2);
+		return 0;
+	};
+	return origin;
+};
+
+/* a RIB record for p with a few entries; what -k has to list for the
+ * rejected ones goes to expect */
+static void
+rib(struct dump* d, struct sx_prefix* p, int accepted, int addpath,
+	int counted, struct bgpq_expander* b, FILE* expect)
+{
+	int i, idx, n=1+rand()%3, member;
+	size_t body, attr;
+	char text[128];
+	uint32_t origin;
+
+	body=begin(d, 13, p->family==AF_INET ? (addpath?8:2) : (addpath?10:4));
+	put32(d, rand());
+	put8(d, p->masklen);
+	put(d, p->addr.addrs, (p->masklen+7)/8);
+	put16(d, n);
+	sx_prefix_snprintf(p, text, sizeof(text));
+	for(i=0; i<n; i++) {
+		idx=rand()%NPEERS;
+		put16(d, idx);
+		put32(d, 0);
+		if(addpath)
+			put32(d, rand());
+		attr=d->len;
+		put16(d, 0);
+		put8(d, 0x40);
+		put8(d, 1);
+		put8(d, 1);
+		put8(d, 0);
+		origin=aspath(d, &peers[idx]);
+		set16(d, attr, d->len-attr-2);
+		if(!counted)
+			continue;
+		if(accepted) {
+			peers[idx].accepted++;
+			continue;
+		};
+		member=origin && bgpq_expander_asn_isset(b, origin);
+		fprintf(expect, "%s rejected peer %s AS%u origin AS%u%s\n", text,
+			peers[idx].addr, peers[idx].as, origin, member?" member":"");
+		peers[idx].rejected++;
+		peers[idx].member+=member;
+	};
+	end(d, body);
+};
+
+static char*
+save(struct dump* d, size_t len)
+{
+	static char name[]="/tmp/bgpq3-mrt.XXXXXX";
+	int fd;
+
+	strcpy(name+strlen(name)-6, "XXXXXX");
+	if((fd=mkstemp(name))==-1 || write(fd, d->buf, len)!=(ssize_t)len) {
+		perror(name);
+		exit(1);
+	};
+	close(fd);
+	return name;
+};
+
+static int
+same(FILE* a, FILE* b)
+{
+	int ca, cb;
+	rewind(a);
+	rewind(b);
+	do {
+		ca=getc(a);
+		cb=getc(b);
+	} while(ca==cb && ca!=EOF);
+	return ca==cb;
+};
+
+static void
+filter(struct bgpq_expander* b, struct entry* e, int n)
+{
+	char as[16];
+	int i;
+
+	bgpq_expander_init(b, AF_INET);
+	b->asn32=1;
+	for(i=100; i<=120; i++) {
+		snprintf(as, sizeof(as), "AS%i", i);
+		bgpq_expander_add_as(b, as);
+	};
+	for(i=0; i<n; i++) {
+		gen(&e[i].p, AF_INET, 12, 24);
+		e[i].lo=e[i].p.masklen+(rand()%2 ? 0 : rand()%4);
+		e[i].hi=rand()%2 ? e[i].lo : e[i].lo+rand()%(33-e[i].lo);
+		sx_radix_tree_insert_range(b->tree, &e[i].p, e[i].lo, e[i].hi);
+	};
+};
+
+static int
+check(int nentries, int nrecords, struct dump* d)
+{
+	struct bgpq_expander b;
+	struct entry* e=malloc(nentries*sizeof(*e));
+	struct sx_prefix p;
+	FILE* out=tmpfile(), *expect=tmpfile();
+	int i, k, af, accepted, bad;
+	size_t body;
+	char* name;
+
+	if(!out || !expect) {
+		perror("tmpfile");
+		exit(1);
+	};
+	for(i=0; i<NPEERS; i++)
+		peers[i].accepted=peers[i].rejected=peers[i].member=0;
+	filter(&b, e, nentries);
+	d->len=0;
+	peer_index(d);
+	for(i=0; i<nrecords; i++) {
+		switch(rand()%10) {
+			case 0:
+				/* BGP4MP, not a RIB dump */
+				body=begin(d, 16, 4);
+				put32(d, rand());
+				end(d, body);
+				continue;
+			case 1:
+				/* RIB_GENERIC, not handled */
+				body=begin(d, 13, 6);
+				put32(d, rand());
+				end(d, body);
+				continue;
+		};
+		af=rand()%5 ? AF_INET : AF_INET6;
+		gen(&p, af, 8, af==AF_INET?32:128);
+		for(accepted=0, k=0; k<nentries && !accepted; k++)
+			accepted=covers(e+k, &p);
+		/* ipv6 records do not concern an ipv4 filter */
+		rib(d, &p, accepted, rand()%4==0, af==AF_INET, &b, expect);
+	};
+	for(i=0; i<NPEERS; i++) {
+		if(!peers[i].accepted && !peers[i].rejected)
+			continue;
+		fprintf(expect, "peer %s AS%u: %lu accepted, %lu rejected (%lu "
+			"member)\n", peers[i].addr, peers[i].as, peers[i].accepted,
+			peers[i].rejected, peers[i].member);
+	};
+
+	sx_radix_tree_aggregate(b.tree);
+	name=save(d, d->len);
+	bgpq_check_routes(out, &b, name);
+	unlink(name);
+	bad=!same(out, expect);
+	fclose(out);
+	fclose(expect);
+	sx_radix_tree_destroy(b.tree);
+	sx_arena_free(&b.arena);
+	free(e);
+	return bad;
+};
+
+/* the last dump, with bytes changed here and there or cut short */
+static void
+damage(struct dump* d, int copies)
+{
+	struct bgpq_expander b;
+	struct entry e[50];
+	struct dump c={NULL, 0, 0};
+	FILE* out=fopen("/dev/null", "w");
+	size_t len;
+	char* name;
+	int i, k;
+
+	if(!out) {
+		perror("/dev/null");
+		exit(1);
+	};
+	filter(&b, e, 50);
+	for(i=0; i<copies; i++) {
+		c.len=0;
+		put(&c, d->buf, d->len);
+		len=d->len;
+		if(i%4==3) {
+			len=12+rand()%(d->len-12);
+		} else {
+			for(k=1+rand()%8; k; k--)
+				c.buf[12+rand()%(c.len-12)]=rand();
+		};
+		name=save(&c, len);
+		bgpq_check_routes(out, &b, name);
+		unlink(name);
+	};
+	fclose(out);
+	sx_radix_tree_destroy(b.tree);
+	sx_arena_free(&b.arena);
+	free(c.buf);
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+static void
+bench(int nrecords)
+{
+	struct bgpq_expander b;
+	struct entry* e=malloc(10000*sizeof(*e));
+	struct dump d={NULL, 0, 0};
+	struct sx_prefix p;
+	FILE* out=fopen("/dev/null", "w"), *expect=fopen("/dev/null", "w");
+	double t0, t1;
+	char* name;
+	int i;
+
+	if(!out || !expect) {
+		perror("/dev/null");
+		exit(1);
+	};
+	filter(&b, e, 10000);
+	sx_radix_tree_aggregate(b.tree);
+	peer_index(&d);
+	for(i=0; i<nrecords; i++) {
+		gen(&p, AF_INET, 16, 24);
+		rib(&d, &p, 0, 0, 0, &b, expect);
+	};
+	name=save(&d, d.len);
+	t0=now();
+	bgpq_check_routes(out, &b, name);
+	t1=now();
+	unlink(name);
+	printf("mrt: %i records, %lu bytes in %.3f s, %.2f M records/s\n",
+		nrecords, (unsigned long)d.len, t1-t0, nrecords/(t1-t0)/1e6);
+	fclose(out);
+	fclose(expect);
+	sx_radix_tree_destroy(b.tree);
+	sx_arena_free(&b.arena);
+	free(d.buf);
+	free(e);
+};
+
+int
+main(int argc, char* argv[])
+{
+	static const int sizes[]={ 1, 20, 300 };
+	struct dump d={NULL, 0, 0};
+	int size, runs=0, bad=0;
+
+	/* totals and complaints about damaged dumps go to stderr */
+	if(!freopen("/dev/null", "w", stderr))
+		return 1;
+	srand(argc>1?atoi(argv[1]):1);
+	for(size=0; size<3; size++) {
+		bad+=check(sizes[size], 3000, &d);
+		runs++;
+	};
+	printf("mrt: %i dumps, %i differ\n", runs, bad);
+	if(bad)
+		return 1;
+	damage(&d, 200);
+	printf("mrt: 200 damaged dumps read through\n");
+	free(d.buf);
+	bench(1000000);
+	return 0;
+};
@@ -0,0 +1,163 @@
+/* sx_tset, the already/stoplist name set, against a linear list compared
+ * with strcasecmp on generated as-set names in mixed case, then how long
+ * lookups take in both */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "sx_arena.h"
+#include "sx_slentry.h"
+
+struct names {
+	char** v;
+	int n;
+};
+
+static const char*
+linear_find(struct names* l, const char* name)
+{
+	int i;
+	for(i=0; i<l->n; i++)
+		if(!strcasecmp(l->v[i], name))
+			return l->v[i];
+	return NULL;
+};
+
+/* names of a few thousand sets, each spelt in random case */
+static void
+gen(char* name, int range)
+{
+	static const char* kinds[]={ "AS-", "RS-", "AS", "AS65000:AS-" };
+	char* c;
+	int k=rand()%4;
+	if(k==2)
+		sprintf(name, "%s%i", kinds[k], rand()%range);
+	else
+		sprintf(name, "%s%c%i", kinds[k], 'A'+rand()%26, rand()%range);
+	for(c=name; *c; c++)
+		if(rand()%2)
+			*c=*c>='a' && *c<='z' ? *c-32 : *c>='A' && *c<='Z' ? *c+32 : *c;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+static int
+check(int n, int lookups, struct sx_arena* arena)
+{
+	struct sx_tset set;
+	struct sx_tentry* te;
+	struct names list;
+	const char* ref;
+	char name[64];
+	int i, bad=0;
+
+	memset(&set, 0, sizeof(set));
+	set.arena=arena;
+	list.v=malloc(n*sizeof(char*));
+	list.n=0;
+	for(i=0; i<n; i++) {
+		gen(name, n/4+1);
+		ref=linear_find(&list, name);
+		if(!(te=sx_tset_insert(&set, name))) {
+			printf("name_set: insert failed\n");
+			exit(1);
+		};
+		/* the first spelling is kept */
+		if(ref ? strcmp(te->text, ref) : strcmp(te->text, name))
+			bad++;
+		if(!ref)
+			list.v[list.n++]=strdup(name);
+	};
+	if(set.count!=(unsigned)list.n)
+		bad++;
+	for(i=0; i<lookups; i++) {
+		gen(name, n/2+1);
+		ref=linear_find(&list, name);
+		te=sx_tset_find(&set, name, sx_tset_hash(name));
+		if(!ref!=!te || (te && strcmp(te->text, ref)))
+			bad++;
+	};
+	sx_tset_free(&set);
+	for(i=0; i<list.n; i++)
+		free(list.v[i]);
+	free(list.v);
+	return bad;
+};
+
+static void
+bench(int n, int lookups)
+{
+	struct sx_tset set;
+	struct names list;
+	char name[64], **q;
+	double t0, t1, t2;
+	volatile long found=0;
+	int i;
+
+	memset(&set, 0, sizeof(set));
+	list.v=malloc(n*sizeof(char*));
+	list.n=0;
+	q=malloc(lookups*sizeof(char*));
+	for(i=0; i<n; i++) {
+		gen(name, n);
+		if(linear_find(&list, name))
+			continue;
+		list.v[list.n++]=strdup(name);
+		sx_tset_add(&set, name);
+	};
+	for(i=0; i<lookups; i++) {
+		gen(name, 2*n);
+		q[i]=strdup(name);
+	};
+	t0=now();
+	for(i=0; i<lookups; i++)
+		found+=linear_find(&list, q[i])!=NULL;
+	t1=now();
+	for(i=0; i<lookups; i++)
+		found+=sx_tset_find(&set, q[i], sx_tset_hash(q[i]))!=NULL;
+	t2=now();
+	printf("name_set: %i names, %i lookups, linear %.1f us, sx_tset %.3f us "
+		"per lookup\n", list.n, lookups, (t1-t0)*1e6/lookups,
+		(t2-t1)*1e6/lookups);
+	for(i=0; i<lookups; i++)
+		free(q[i]);
+	for(i=0; i<list.n; i++)
+		free(list.v[i]);
+	free(q);
+	free(list.v);
+	sx_tset_free(&set);
+};
+
+int
+main(int argc, char* argv[])
+{
+	static const int sizes[]={ 1, 10, 100, 1000, 5000 };
+	struct sx_arena arena;
+	int i, bad=0;
+
+	srand(argc>1?atoi(argv[1]):1);
+	memset(&arena, 0, sizeof(arena));
+	for(i=0; i<5; i++) {
+		bad+=check(sizes[i], 20000, NULL);
+		bad+=check(sizes[i], 20000, &arena);
+	};
+	sx_arena_free(&arena);
+	printf("name_set: 10 sets, %i mismatches\n", bad);
+	if(bad)
+		return 1;
+	bench(5000, 20000);
+	return 0;
+};
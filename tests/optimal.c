@@ -0,0 +1,289 @@
+/* -Z, sx_radix_tree_optimize: the entries it leaves have to accept exactly
+ * what the tree accepted, never more than -A leaves, and on sets small
+ * enough for an exhaustive search over every prefix^low-high entry, as few
+ * as that search finds. A prefix allowing more separate runs of lengths than
+ * it searches through exactly has to get the notice. Then how long it takes
+ * on a large tree against greedy aggregation. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sx_prefix.h"
+
+/* small sets: prefixes of 10.0.0.0/24 up to /27, 15 of them, numbered
+ * level by level */
+#define SMALL_LEVELS 4
+#define SMALL_PREFIXES ((1<<SMALL_LEVELS)-1)
+
+static void
+small_prefix(struct sx_prefix* p, int len, int v)
+{
+	memset(p, 0, sizeof(*p));
+	p->family=AF_INET;
+	p->addr.addrs[0]=10;
+	p->addr.addrs[3]=len>24 ? v<<(32-len) : 0;
+	p->masklen=len;
+};
+
+/* prefixes of len/v accepted by ^lo-hi */
+static unsigned
+small_cover(int len, int v, int lo, int hi)
+{
+	unsigned mask=0;
+	int l, k;
+
+	for(l=lo; l<=hi; l++)
+		for(k=v<<(l-len); k<(v+1)<<(l-len); k++)
+			mask|=1u<<((1<<(l-24))-1+k);
+	return mask;
+};
+
+/* what the tree accepts of every prefix of the /24 down to /32 */
+static void
+small_accepted(struct sx_radix_tree* tree, unsigned char* acc)
+{
+	struct sx_prefix p;
+	int len, v;
+
+	for(len=24; len<=32; len++)
+		for(v=0; v<1<<(len-24); v++) {
+			small_prefix(&p, len, v);
+			*acc++=sx_radix_tree_match(tree, &p)!=NULL;
+		};
+};
+
+static int
+small(int* worse)
+{
+	static unsigned char dist[1<<SMALL_PREFIXES];
+	unsigned cover[SMALL_PREFIXES*SMALL_LEVELS*SMALL_LEVELS];
+	unsigned char acc[511], got[511];
+	unsigned set=0, mask, next;
+	struct sx_radix_tree* tree=sx_radix_tree_new(AF_INET), *greedy;
+	struct sx_prefix p;
+	int i, n, len, v, lo, hi, ncover=0, best, entries, bad=0;
+	unsigned* queue;
+
+	/* a few random entries make the set */
+	for(n=1+rand()%6, i=0; i<n; i++) {
+		len=24+rand()%SMALL_LEVELS;
+		v=rand()%(1<<(len-24));
+		lo=len+rand()%(28-len);
+		hi=lo+rand()%(28-lo);
+		small_prefix(&p, len, v);
+		sx_radix_tree_insert_range(tree, &p, lo, hi);
+		set|=small_cover(len, v, lo, hi);
+	};
+	/* entries accepting nothing outside the set */
+	for(len=24; len<24+SMALL_LEVELS; len++)
+		for(v=0; v<1<<(len-24); v++)
+			for(lo=len; lo<24+SMALL_LEVELS; lo++)
+				for(hi=lo; hi<24+SMALL_LEVELS; hi++) {
+					mask=small_cover(len, v, lo, hi);
+					if(!(mask&~set))
+						cover[ncover++]=mask;
+				};
+	/* fewest of them covering the set, breadth first */
+	memset(dist, 0xff, sizeof(dist));
+	queue=malloc(sizeof(unsigned)<<SMALL_PREFIXES);
+	dist[0]=0;
+	queue[0]=0;
+	for(i=0, n=1; i<n && dist[set]==0xff; i++) {
+		for(v=0; v<ncover; v++) {
+			next=queue[i]|cover[v];
+			if(dist[next]==0xff) {
+				dist[next]=dist[queue[i]]+1;
+				queue[n++]=next;
+			};
+		};
+	};
+	best=dist[set];
+	free(queue);
+
+	small_accepted(tree, acc);
+	greedy=sx_radix_tree_copy(tree);
+	sx_radix_tree_aggregate(greedy);
+	entries=sx_radix_tree_optimize(tree);
+	small_accepted(tree, got);
+	bad+=memcmp(acc, got, sizeof(acc))!=0;
+	bad+=entries!=sx_radix_tree_entries(tree);
+	bad+=entries>sx_radix_tree_entries(greedy);
+	*worse+=entries>best;
+	sx_radix_tree_destroy(tree);
+	sx_radix_tree_destroy(greedy);
+	return bad;
+};
+
+/* routes and ranges under a /16 or a /112 */
+static void
+gen(struct sx_radix_tree* tree, int n, int spread)
+{
+	int i, k, lo, hi, max=tree->family==AF_INET?32:128;
+	struct sx_prefix p;
+
+	for(i=0; i<n; i++) {
+		memset(&p, 0, sizeof(p));
+		p.family=tree->family;
+		for(k=0; k<max/8; k++)
+			p.addr.addrs[k]=rand();
+		if(!spread) {
+			memset(p.addr.addrs, 0, max/8-2);
+			p.addr.addrs[0]=10;
+		};
+		p.masklen=max-16+rand()%9;
+		if(spread)
+			p.masklen=max==32 ? 12+rand()%13 : 24+rand()%25;
+		sx_prefix_adjust_masklen(&p);
+		if(rand()%4) {
+			sx_radix_tree_insert(tree, &p);
+		} else {
+			lo=p.masklen+rand()%3;
+			hi=lo+rand()%5;
+			sx_radix_tree_insert_range(tree, &p, lo, hi>max?max:hi);
+		};
+	};
+};
+
+/* every prefix of the block accepted the same */
+static int
+same(struct sx_radix_tree* a, struct sx_radix_tree* b)
+{
+	int bad=0, max=a->family==AF_INET?32:128;
+	unsigned len, j;
+	struct sx_prefix p;
+
+	for(len=max-16; len<=max; len++) {
+		for(j=0; j<1u<<(len-max+16); j++) {
+			memset(&p, 0, sizeof(p));
+			p.family=a->family;
+			p.addr.addrs[0]=10;
+			p.addr.addrs[max/8-2]=(j<<(max-len))>>8;
+			p.addr.addrs[max/8-1]=j<<(max-len);
+			p.masklen=len;
+			bad+=!sx_radix_tree_match(a, &p)!=!sx_radix_tree_match(b, &p);
+		};
+	};
+	return bad;
+};
+
+static int
+block(int af, int n)
+{
+	struct sx_radix_tree* tree=sx_radix_tree_new(af), *orig, *greedy;
+	int entries, bad=0;
+
+	gen(tree, n, 0);
+	orig=sx_radix_tree_copy(tree);
+	greedy=sx_radix_tree_copy(tree);
+	sx_radix_tree_aggregate(greedy);
+	entries=sx_radix_tree_optimize(tree);
+	bad+=same(orig, tree)!=0;
+	bad+=entries!=sx_radix_tree_entries(tree);
+	bad+=entries>sx_radix_tree_entries(greedy);
+	sx_radix_tree_destroy(tree);
+	sx_radix_tree_destroy(orig);
+	sx_radix_tree_destroy(greedy);
+	return bad;
+};
+
+/* every other length of 2001:db8::/32, runs of them, with the notice
+ * going to f */
+static int
+runs(FILE* f, int nruns)
+{
+	struct sx_radix_tree* tree=sx_radix_tree_new(AF_INET6), *orig;
+	struct sx_prefix p, q;
+	char line[256];
+	int len, entries, notice=0, bad=0;
+
+	sx_prefix_parse(&p, AF_INET6, "2001:db8::/32");
+	for(len=0; len<nruns; len++)
+		sx_radix_tree_insert_range(tree, &p, 32+2*len, 32+2*len);
+	orig=sx_radix_tree_copy(tree);
+	rewind(f);
+	if(ftruncate(fileno(f), 0))
+		bad++;
+	entries=sx_radix_tree_optimize(tree);
+	fflush(f);
+	rewind(f);
+	while(fgets(line, sizeof(line), f))
+		notice+=strstr(line, "may not be the fewest")!=NULL;
+	bad+=notice!=(nruns>16);
+	bad+=entries!=nruns || entries!=sx_radix_tree_entries(tree);
+	for(len=32; len<=128; len++) {
+		q=p;
+		q.masklen=len;
+		bad+=!sx_radix_tree_match(orig, &q)!=!sx_radix_tree_match(tree, &q);
+	};
+	sx_radix_tree_destroy(tree);
+	sx_radix_tree_destroy(orig);
+	return bad;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+static void
+bench(int n)
+{
+	struct sx_radix_tree* tree=sx_radix_tree_new(AF_INET), *greedy;
+	double t0, t1, t2;
+	int entries;
+
+	gen(tree, n, 1);
+	greedy=sx_radix_tree_copy(tree);
+	t0=now();
+	sx_radix_tree_aggregate(greedy);
+	t1=now();
+	entries=sx_radix_tree_optimize(tree);
+	t2=now();
+	printf("optimal: %i prefixes, -A %i entries in %.3f s, -Z %i entries in "
+		"%.3f s\n", n, sx_radix_tree_entries(greedy), t1-t0, entries, t2-t1);
+	sx_radix_tree_destroy(tree);
+	sx_radix_tree_destroy(greedy);
+};
+
+int
+main(int argc, char* argv[])
+{
+	static const int sizes[]={ 1, 10, 100, 2000 };
+	static char name[]="/tmp/bgpq3-notice.XXXXXX";
+	int i, af, size, fd, bad=0, worse=0;
+
+	/* notices go to stderr */
+	if((fd=mkstemp(name))==-1 || !freopen(name, "w+", stderr)) {
+		perror(name);
+		return 1;
+	};
+	close(fd);
+	unlink(name);
+	srand(argc>1?atoi(argv[1]):1);
+	for(i=0; i<500; i++)
+		bad+=small(&worse);
+	printf("optimal: 500 small sets, %i wrong, %i above the minimum\n", bad,
+		worse);
+	for(i=0; i<10; i++)
+		for(af=0; af<2; af++)
+			for(size=0; size<4; size++)
+				bad+=block(af ? AF_INET6 : AF_INET, sizes[size]);
+	printf("optimal: 80 trees, %i wrong\n", bad);
+	for(i=1; i<=40; i++)
+		bad+=runs(stderr, i);
+	printf("optimal: 1 to 40 runs of lengths, %i wrong\n", bad);
+	if(bad || worse)
+		return 1;
+	bench(200000);
+	return 0;
+};
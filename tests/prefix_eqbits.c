@@ -0,0 +1,134 @@
+/* word-wide sx_prefix_eqbits and sx_prefix_isbitset against bit-by-bit
+ * references on generated prefix pairs, then how long both take and how
+ * long a routing table's worth of inserts takes */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sx_prefix.h"
+
+static int
+ref_isbitset(struct sx_prefix* p, int n)
+{
+	if(n<1 || n>(p->family==AF_INET?32:128))
+		return 0;
+	return (p->addr.addrs[(n-1)/8]&(0x80>>((n-1)%8)))!=0;
+};
+
+static int
+ref_eqbits(struct sx_prefix* a, struct sx_prefix* b)
+{
+	int n, minlen=a->masklen<b->masklen?a->masklen:b->masklen;
+	for(n=0; n<minlen && ref_isbitset(a, n+1)==ref_isbitset(b, n+1); n++);
+	return n;
+};
+
+static void
+gen(struct sx_prefix* p, int af)
+{
+	int i, nbytes=af==AF_INET?4:16;
+	memset(p, 0, sizeof(*p));
+	p->family=af;
+	/* few distinct bytes, so long common runs are frequent */
+	for(i=0; i<nbytes; i++)
+		p->addr.addrs[i]=rand()%4 ? 0x20+i%3 : rand();
+	p->masklen=rand()%(nbytes*8+1);
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+static void
+bench(void)
+{
+	static struct sx_prefix v[4096];
+	struct sx_radix_tree* tree;
+	struct sx_prefix p;
+	double t0, t1, t2;
+	volatile long sum=0;
+	int af, i, k, r;
+
+	for(af=0; af<2; af++) {
+		for(i=0; i<4096; i++)
+			gen(v+i, af ? AF_INET6 : AF_INET);
+		t0=now();
+		for(r=0; r<500; r++)
+			for(i=1; i<4096; i++)
+				sum+=ref_eqbits(v+i-1, v+i);
+		t1=now();
+		for(r=0; r<500; r++)
+			for(i=1; i<4096; i++)
+				sum+=sx_prefix_eqbits(v+i-1, v+i);
+		t2=now();
+		printf("prefix_eqbits: %s, bitwise %.1f ns, sx_prefix_eqbits %.1f ns "
+			"per pair\n", af ? "ipv6" : "ipv4", (t1-t0)*1e9/500/4095,
+			(t2-t1)*1e9/500/4095);
+	};
+
+	/* about what a full ipv4 table holds */
+	tree=sx_radix_tree_new(AF_INET);
+	t0=now();
+	for(i=0; i<900000; i++) {
+		memset(&p, 0, sizeof(p));
+		p.family=AF_INET;
+		for(k=0; k<4; k++)
+			p.addr.addrs[k]=rand();
+		p.masklen=16+rand()%9;
+		sx_prefix_adjust_masklen(&p);
+		sx_radix_tree_insert(tree, &p);
+	};
+	t1=now();
+	printf("prefix_eqbits: 900000 ipv4 inserts in %.3f s\n", t1-t0);
+	sx_radix_tree_destroy(tree);
+};
+
+int
+main(int argc, char* argv[])
+{
+	struct sx_prefix a, b;
+	long i, n=argc>1?atol(argv[1]):2000000, bad=0;
+	int af, bit, maxlen;
+
+	srand(argc>2?atoi(argv[2]):1);
+	for(i=0; i<n; i++) {
+		af=i&1 ? AF_INET6 : AF_INET;
+		maxlen=af==AF_INET?32:128;
+		gen(&a, af);
+		if(rand()%2) {
+			gen(&b, af);
+		} else {
+			/* differing in a single bit */
+			b=a;
+			bit=rand()%maxlen;
+			b.addr.addrs[bit/8]^=0x80>>(bit%8);
+			b.masklen=rand()%(maxlen+1);
+		};
+		if(sx_prefix_eqbits(&a, &b)!=ref_eqbits(&a, &b)) {
+			if(bad++<10)
+				printf("eqbits mismatch: %i, expected %i\n",
+					sx_prefix_eqbits(&a, &b), ref_eqbits(&a, &b));
+		};
+		bit=rand()%(maxlen+8)-4;
+		if(sx_prefix_isbitset(&a, bit)!=ref_isbitset(&a, bit)) {
+			if(bad++<10)
+				printf("isbitset mismatch on bit %i: %i, expected %i\n", bit,
+					sx_prefix_isbitset(&a, bit), ref_isbitset(&a, bit));
+		};
+	};
+	printf("prefix_eqbits: %li pairs, %li mismatches\n", n, bad);
+	if(bad)
+		return 1;
+	bench();
+	return 0;
+};
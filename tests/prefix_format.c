@@ -0,0 +1,149 @@
+/* sx_prefix_snprintf and friends against inet_ntop and snprintf on
+ * generated prefixes, zero runs and embedded quads included, then how
+ * long both take on 500k prefixes */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sx_prefix.h"
+
+static void
+gen(struct sx_prefix* p)
+{
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	if(rand()%3==0) {
+		p->family=AF_INET;
+		for(i=0; i<4; i++)
+			p->addr.addrs[i]=rand()%4 ? rand() : 0;
+		p->masklen=rand()%33;
+		return;
+	};
+	p->family=AF_INET6;
+	/* zero groups are common, so are runs of them */
+	for(i=0; i<16; i+=2) {
+		if(rand()%2) {
+			p->addr.addrs[i]=rand()%3 ? 0 : rand();
+			p->addr.addrs[i+1]=rand();
+		};
+	};
+	switch(rand()%8) {
+		case 0:
+			/* ::a.b.c.d and ::ffff:a.b.c.d */
+			memset(p->addr.addrs, 0, 12);
+			if(rand()%2)
+				p->addr.addrs[10]=p->addr.addrs[11]=0xff;
+			break;
+		case 1:
+			memset(p->addr.addrs, 0, 16-rand()%3);
+			break;
+	};
+	p->masklen=rand()%129;
+};
+
+static void
+ref_mask(struct sx_prefix* p, struct sx_prefix* q)
+{
+	int i;
+	memset(q, 0, sizeof(*q));
+	q->family=p->family;
+	for(i=0; i<p->masklen; i++)
+		q->addr.addrs[i/8]|=0x80>>(i%8);
+};
+
+static int
+check(const char* what, struct sx_prefix* p, const char* ref, int rlen,
+	const char* out, int len)
+{
+	static int reported;
+	char text[INET6_ADDRSTRLEN];
+	if(rlen==len && !strcmp(ref, out))
+		return 0;
+	if(reported++>=10)
+		return 1;
+	inet_ntop(p->family, &p->addr, text, sizeof(text));
+	printf("%s mismatch on %s/%u: '%s' (%i), expected '%s' (%i)\n", what,
+		text, p->masklen, out, len, ref, rlen);
+	return 1;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+static void
+bench(void)
+{
+	static struct sx_prefix v[500000];
+	char addr[INET6_ADDRSTRLEN], out[128];
+	double t0, t1, t2;
+	volatile long sum=0;
+	int i;
+
+	for(i=0; i<500000; i++)
+		gen(v+i);
+	t0=now();
+	for(i=0; i<500000; i++) {
+		inet_ntop(v[i].family, &v[i].addr, addr, sizeof(addr));
+		sum+=snprintf(out, sizeof(out), "%s/%u", addr, v[i].masklen);
+	};
+	t1=now();
+	for(i=0; i<500000; i++)
+		sum+=sx_prefix_snprintf(v+i, out, sizeof(out));
+	t2=now();
+	printf("prefix_format: 500000 prefixes, inet_ntop+snprintf %.3f s, "
+		"sx_prefix_snprintf %.3f s\n", t1-t0, t2-t1);
+};
+
+int
+main(int argc, char* argv[])
+{
+	struct sx_prefix p, q;
+	char addr[INET6_ADDRSTRLEN], mask[INET6_ADDRSTRLEN];
+	char ref[128], out[128];
+	long i, n=argc>1?atol(argv[1]):1000000, bad=0;
+	int size;
+
+	srand(argc>2?atoi(argv[2]):1);
+	for(i=0; i<n; i++) {
+		gen(&p);
+		inet_ntop(p.family, &p.addr, addr, sizeof(addr));
+
+		bad+=check("snprintf", &p, ref,
+			snprintf(ref, sizeof(ref), "%s/%u", addr, p.masklen), out,
+			sx_prefix_snprintf(&p, out, sizeof(out)));
+		bad+=check("jsnprintf", &p, ref,
+			snprintf(ref, sizeof(ref), "%s\\/%u", addr, p.masklen), out,
+			sx_prefix_jsnprintf(&p, out, sizeof(out)));
+
+		/* short buffers truncate the way snprintf does */
+		size=1+rand()%50;
+		memset(out, 0, sizeof(out));
+		bad+=check("truncated snprintf", &p, ref,
+			snprintf(ref, size, "%s/%u", addr, p.masklen), out,
+			sx_prefix_snprintf(&p, out, size));
+
+		ref_mask(&p, &q);
+		inet_ntop(q.family, &q.addr, mask, sizeof(mask));
+		memset(out, 0, sizeof(out));
+		bad+=check("snprintf_fmt", &p, ref,
+			snprintf(ref, sizeof(ref), "%s %u %s", addr, p.masklen, mask),
+			out, sx_prefix_snprintf_fmt(&p, out, sizeof(out), "", "%n %l %m"));
+	};
+	printf("prefix_format: %li prefixes, %li mismatches\n", n, bad);
+	if(bad)
+		return 1;
+	bench();
+	return 0;
+};
@@ -0,0 +1,204 @@
+/* sx_prefix_parse against a parser built on inet_pton, the way prefixes
+ * were parsed before the single-pass parser, on generated text, then the
+ * time both take on a million-line route dump */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sx_prefix.h"
+
+static int
+ref_parse(struct sx_prefix* p, int af, const char* text)
+{
+	char mtext[INET6_ADDRSTRLEN+5], *c, *eod;
+	int masklen=-1, aparts[4];
+
+	snprintf(mtext, sizeof(mtext), "%s", text);
+	if((c=strchr(mtext, '/'))) {
+		*c=0;
+		masklen=strtol(c+1, &eod, 10);
+		if(eod[0] && !isspace((unsigned char)eod[0]))
+			return 0;
+	};
+	if(!af)
+		af=strchr(mtext, ':') ? AF_INET6 : AF_INET;
+	if(inet_pton(af, mtext, &p->addr)!=1) {
+		/* leading zeros in a dotted quad */
+		if(af!=AF_INET || sscanf(mtext, "%i.%i.%i.%i", aparts, aparts+1,
+			aparts+2, aparts+3)!=4 || aparts[0]<0 || aparts[0]>255 ||
+			aparts[1]<0 || aparts[1]>255 || aparts[2]<0 || aparts[2]>255 ||
+			aparts[3]<0 || aparts[3]>255)
+			return 0;
+		p->addr.addr.s_addr=htonl(((uint32_t)aparts[0]<<24) +
+			(aparts[1]<<16) + (aparts[2]<<8) + aparts[3]);
+	};
+	p->family=af;
+	p->masklen=af==AF_INET?32:128;
+	if(masklen>=0 && masklen<=p->masklen)
+		p->masklen=masklen;
+	sx_prefix_adjust_masklen(p);
+	return 1;
+};
+
+static const char junk[]="0123456789abcdefABCDEF.:/ x-+";
+
+static void
+gen_v6(char* s)
+{
+	int i, n=rand()%9, dc=rand()%(n+2);
+	for(i=0; i<n; i++) {
+		if(i==dc)
+			s+=sprintf(s, "::");
+		else if(i)
+			*s++=':';
+		switch(rand()%4) {
+			case 0: s+=sprintf(s, "%04x", rand()%65536); break;
+			case 1: s+=sprintf(s, "%X", rand()%16); break;
+			default: s+=sprintf(s, "%x", rand()%65536);
+		};
+	};
+	if(dc>=n && rand()%2)
+		s+=sprintf(s, "::");
+	if(rand()%5==0)
+		s+=sprintf(s, "%s%d.%d.%d.%d", n?":":"::", rand()%256, rand()%256,
+			rand()%256, rand()%256);
+	*s=0;
+};
+
+static void
+gen(char* b)
+{
+	char* s;
+	int i, n;
+
+	switch(rand()%6) {
+		case 0:
+			for(n=rand()%30, i=0; i<n; i++)
+				b[i]=junk[rand()%(sizeof(junk)-1)];
+			b[n]=0;
+			return;
+		case 1:
+			sprintf(b, "%d.%d.%d.%d", rand()%300, rand()%260, rand()%256,
+				rand()%256);
+			if(rand()%4==0)
+				b[rand()%strlen(b)]='0';
+			break;
+		case 2:
+			sprintf(b, "%d.%d.%d.%d", rand()%256, rand()%256, rand()%256,
+				rand()%256);
+			break;
+		case 3:
+			gen_v6(b);
+			if(b[0])
+				b[rand()%strlen(b)]=junk[rand()%(sizeof(junk)-1)];
+			break;
+		default:
+			gen_v6(b);
+	};
+	s=b+strlen(b);
+	switch(rand()%8) {
+		case 0: strcpy(s, "/"); break;
+		case 1: case 2: case 3: case 4:
+			sprintf(s, "/%d", rand()%140);
+			break;
+		case 5:
+			sprintf(s, "/%03d%s", rand()%140, rand()%2?" x":"");
+			break;
+		case 6:
+			sprintf(s, "/%d", -(rand()%3));
+			break;
+	};
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+/* prefixes the way IRRd replies list them, three in four ipv4 */
+static void
+throughput(long n)
+{
+	char* dump, *s, *end, *eol;
+	struct sx_prefix p;
+	double t0, t1, t2;
+	long i, refok=0, ok=0;
+
+	if(!(dump=malloc(n*48))) {
+		perror("malloc");
+		exit(1);
+	};
+	for(s=dump, i=0; i<n; i++) {
+		if(i%4)
+			s+=sprintf(s, "%d.%d.%d.0/%d\n", 1+rand()%223, rand()%256,
+				rand()%256, 16+rand()%9);
+		else
+			s+=sprintf(s, "2001:%x:%x::/%d\n", rand()%65536, rand()%65536,
+				32+rand()%17);
+	};
+	end=s;
+
+	t0=now();
+	for(s=dump; s<end; s=strchr(s, '\n')+1) {
+		*strchr(s, '\n')=0;
+		refok+=ref_parse(&p, 0, s);
+		s[strlen(s)]='\n';
+	};
+	t1=now();
+	for(s=dump; s<end; s=eol+1) {
+		eol=memchr(s, '\n', end-s);
+		ok+=sx_prefix_parsen(&p, 0, s, eol-s);
+	};
+	t2=now();
+
+	printf("prefix_parse: %li lines (%li/%li parsed), inet_pton %.1f ns, "
+		"sx_prefix_parsen %.1f ns per line\n", n, refok, ok,
+		(t1-t0)*1e9/n, (t2-t1)*1e9/n);
+	free(dump);
+	if(ok!=n || refok!=n)
+		exit(1);
+};
+
+int
+main(int argc, char* argv[])
+{
+	struct sx_prefix a, b;
+	char text[256];
+	long i, n=argc>1?atol(argv[1]):1000000, valid=0, bad=0;
+	int af, ra, rb;
+
+	/* rejected text gets reported, there is plenty of it */
+	if(!freopen("/dev/null", "w", stderr))
+		return 1;
+	srand(argc>2?atoi(argv[2]):1);
+	for(i=0; i<n; i++) {
+		gen(text);
+		af=rand()%3 ? 0 : rand()%2 ? AF_INET : AF_INET6;
+		memset(&a, 0, sizeof(a));
+		memset(&b, 0, sizeof(b));
+		ra=ref_parse(&a, af, text);
+		rb=sx_prefix_parse(&b, af, text);
+		valid+=ra;
+		if(ra!=rb || (ra && (a.family!=b.family || a.masklen!=b.masklen ||
+			memcmp(a.addr.addrs, b.addr.addrs, a.family==AF_INET?4:16)))) {
+			if(bad++<10)
+				printf("mismatch on '%s' af %i: %i/%i\n", text, af, ra, rb);
+		};
+	};
+	printf("prefix_parse: %li strings, %li valid, %li mismatches\n", n, valid,
+		bad);
+	if(bad)
+		return 1;
+	throughput(1000000);
+	return 0;
+};
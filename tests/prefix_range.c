@@ -0,0 +1,198 @@
+/* prefix-ranges kept as native aggregate entries against the same ranges
+ * inserted prefix by prefix: both trees have to accept the same prefixes
+ * as they are, once aggregated and once expanded back into routes, then
+ * how long a route-set full of ranges takes to load both ways */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sx_prefix.h"
+
+/* every prefix of p with a masklen in lo-hi, as plain routes */
+static void
+insert_expanded(struct sx_radix_tree* tree, struct sx_prefix* p, unsigned lo,
+	unsigned hi)
+{
+	struct sx_prefix q;
+	unsigned len, j, b, pos;
+
+	for(len=lo; len<=hi; len++) {
+		for(j=0; j<1u<<(len-p->masklen); j++) {
+			q=*p;
+			q.masklen=len;
+			for(b=0; b<len-p->masklen; b++) {
+				pos=p->masklen+b;
+				if(j&(1u<<(len-p->masklen-1-b)))
+					q.addr.addrs[pos/8]|=0x80>>(pos%8);
+			};
+			sx_radix_tree_insert(tree, &q);
+		};
+	};
+};
+
+/* prefixes of /20 and longer and ranges within the last 16 bits, so
+ * ranges stay small */
+static void
+gen(struct sx_radix_tree* native, struct sx_radix_tree* expanded, int n)
+{
+	int i, k, max=native->family==AF_INET?32:128;
+	unsigned lo, hi;
+	struct sx_prefix p;
+
+	for(i=0; i<n; i++) {
+		memset(&p, 0, sizeof(p));
+		p.family=native->family;
+		for(k=max/8-2; k<max/8; k++)
+			p.addr.addrs[k]=rand();
+		p.addr.addrs[0]=10;
+		p.masklen=max-12+rand()%9;
+		sx_prefix_adjust_masklen(&p);
+		if(rand()%3==0) {
+			sx_radix_tree_insert(native, &p);
+			sx_radix_tree_insert(expanded, &p);
+			continue;
+		};
+		lo=p.masklen+(rand()%2 ? 0 : rand()%(max-p.masklen+1));
+		hi=lo+rand()%(max-lo+1);
+		if(hi>lo+6)
+			hi=lo+6;
+		sx_radix_tree_insert_range(native, &p, lo, hi);
+		insert_expanded(expanded, &p, lo, hi);
+	};
+};
+
+/* both trees accept the same prefixes, as far as sx_radix_tree_match
+ * tells, trying every prefix of the /16 or /112 the ranges are in */
+static int
+same_match(struct sx_radix_tree* a, struct sx_radix_tree* b)
+{
+	int bad=0, max=a->family==AF_INET?32:128;
+	unsigned len, j;
+	struct sx_prefix p;
+
+	for(len=max-16; len<=max; len++) {
+		for(j=0; j<1u<<(len-max+16); j++) {
+			memset(&p, 0, sizeof(p));
+			p.family=a->family;
+			p.addr.addrs[0]=10;
+			p.addr.addrs[max/8-2]=(j<<(max-len))>>8;
+			p.addr.addrs[max/8-1]=j<<(max-len);
+			p.masklen=len;
+			bad+=!sx_radix_tree_match(a, &p)!=!sx_radix_tree_match(b, &p);
+		};
+	};
+	return bad;
+};
+
+/* nothing but plain routes left */
+static int
+plain(struct sx_radix_tree* tree)
+{
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* node;
+	int bad=0;
+
+	SX_RADIX_FOREACH(node, &cur, tree)
+		bad+=node->son || (!node->isGlue && node->isAggregate);
+	return bad;
+};
+
+static int
+check(int af, int n)
+{
+	struct sx_radix_tree* native=sx_radix_tree_new(af);
+	struct sx_radix_tree* expanded=sx_radix_tree_new(af);
+	struct sx_radix_tree* copy;
+	int bad=0;
+
+	gen(native, expanded, n);
+	bad+=same_match(native, expanded);
+
+	copy=sx_radix_tree_copy(native);
+	sx_radix_tree_expand_ranges(copy);
+	bad+=plain(copy)+same_match(copy, expanded);
+	sx_radix_tree_destroy(copy);
+
+	sx_radix_tree_aggregate(native);
+	sx_radix_tree_aggregate(expanded);
+	bad+=same_match(native, expanded);
+
+	sx_radix_tree_expand_ranges(native);
+	sx_radix_tree_expand_ranges(expanded);
+	bad+=plain(native)+plain(expanded)+same_match(native, expanded);
+
+	sx_radix_tree_destroy(native);
+	sx_radix_tree_destroy(expanded);
+	return bad;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+/* ipv4 route-set members with ^+ and ^16-24 ranges */
+static void
+bench(int n)
+{
+	struct sx_radix_tree* native=sx_radix_tree_new(AF_INET);
+	struct sx_radix_tree* expanded=sx_radix_tree_new(AF_INET);
+	struct sx_prefix* v=malloc(n*sizeof(*v));
+	double t0, t1, t2;
+	int i;
+
+	for(i=0; i<n; i++) {
+		memset(v+i, 0, sizeof(*v));
+		v[i].family=AF_INET;
+		v[i].addr.addrs[0]=1+rand()%223;
+		v[i].addr.addrs[1]=rand();
+		v[i].addr.addrs[2]=rand();
+		v[i].masklen=16+rand()%5;
+		sx_prefix_adjust_masklen(v+i);
+	};
+	t0=now();
+	for(i=0; i<n; i++)
+		sx_radix_tree_insert_range(native, v+i, v[i].masklen, 24);
+	t1=now();
+	for(i=0; i<n; i++)
+		insert_expanded(expanded, v+i, v[i].masklen, 24);
+	t2=now();
+	printf("prefix_range: %i ranges up to /24, native %i entries in %.3f s, "
+		"expanded %i entries in %.3f s\n", n,
+		sx_radix_tree_entries(native), t1-t0,
+		sx_radix_tree_entries(expanded), t2-t1);
+	sx_radix_tree_destroy(native);
+	sx_radix_tree_destroy(expanded);
+	free(v);
+};
+
+int
+main(int argc, char* argv[])
+{
+	static const int sizes[]={ 1, 5, 50, 500 };
+	int seed, af, size, runs=0, bad=0;
+
+	for(seed=1; seed<=5; seed++) {
+		srand(seed);
+		for(af=0; af<2; af++) {
+			for(size=0; size<4; size++) {
+				bad+=check(af ? AF_INET6 : AF_INET, sizes[size]);
+				runs++;
+			};
+		};
+	};
+	printf("prefix_range: %i trees, %i mismatches\n", runs, bad);
+	if(bad)
+		return 1;
+	bench(argc>1?atoi(argv[1]):2000);
+	return 0;
+};
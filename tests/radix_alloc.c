@@ -0,0 +1,180 @@
+/* radix nodes carved from the tree's own segments: every node has to sit
+ * in a segment of its tree, unlinked nodes have to come back through the
+ * free list without new segments, and the tree has to hold exactly the
+ * prefixes inserted; then how long a million nodes take to allocate and
+ * release against malloc and free */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sx_prefix.h"
+
+static void
+gen(struct sx_prefix* p, int af)
+{
+	int k, max=af==AF_INET?32:128;
+
+	memset(p, 0, sizeof(*p));
+	p->family=af;
+	for(k=0; k<max/8; k++)
+		p->addr.addrs[k]=rand();
+	/* a narrow block, so that glue nodes appear */
+	p->addr.addrs[0]=af==AF_INET?10:0x20;
+	p->masklen=af==AF_INET ? 8+rand()%25 : 16+rand()%113;
+	sx_prefix_adjust_masklen(p);
+};
+
+static int
+cmp(const void* a, const void* b)
+{
+	const struct sx_prefix* pa=a, *pb=b;
+	int r=memcmp(pa->addr.addrs, pb->addr.addrs, sizeof(pa->addr.addrs));
+	return r ? r : pa->masklen-pb->masklen;
+};
+
+/* every node in one of the tree's segments, the prefixes the ones wanted */
+static int
+check(struct sx_radix_tree* tree, struct sx_prefix* v, int n, int from,
+	int to)
+{
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* node;
+	int i, real=0, bad=0;
+
+	SX_RADIX_FOREACH(node, &cur, tree) {
+		if(sx_radix_segment_of(node)->tree!=tree)
+			bad++;
+		if(!node->isGlue)
+			real++;
+	};
+	for(i=0; i<n; i++) {
+		node=sx_radix_tree_lookup_exact(tree, v+i);
+		if((i>=from && i<to) != (node && !node->isGlue))
+			bad++;
+	};
+	return bad+(real!=to-from);
+};
+
+static int
+run(int af, int n)
+{
+	struct sx_radix_tree* tree=sx_radix_tree_new(af);
+	struct sx_radix_node* node, *next;
+	struct sx_prefix* v=malloc(n*sizeof(*v));
+	unsigned segments;
+	int i, u, bad=0;
+
+	for(i=0; i<n; i++)
+		gen(v+i, af);
+	qsort(v, n, sizeof(*v), cmp);
+	for(u=0, i=0; i<n; i++)
+		if(!u || cmp(v+u-1, v+i))
+			v[u++]=v[i];
+	n=u;
+	for(i=n-1; i>0; i--) {
+		struct sx_prefix t=v[i];
+		u=rand()%(i+1);
+		v[i]=v[u];
+		v[u]=t;
+	};
+
+	for(i=0; i<n; i++)
+		sx_radix_tree_insert(tree, v+i);
+	bad+=check(tree, v, n, 0, n);
+	segments=tree->nsegments;
+	next=tree->next;
+
+	/* the second half out and back in, from the free list */
+	for(i=n/2; i<n; i++) {
+		node=sx_radix_tree_lookup_exact(tree, v+i);
+		if(node && !node->isGlue)
+			sx_radix_tree_unlink(tree, node);
+	};
+	bad+=check(tree, v, n, 0, n/2);
+	for(i=n/2; i<n; i++)
+		sx_radix_tree_insert(tree, v+i);
+	bad+=check(tree, v, n, 0, n);
+	if(tree->nsegments!=segments || tree->next!=next) {
+		printf("radix_alloc: %s, %i prefixes, reinsertion took new nodes\n",
+			af==AF_INET?"ipv4":"ipv6", n);
+		bad++;
+	};
+	sx_radix_tree_destroy(tree);
+	free(v);
+	return bad;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+static void
+bench(int n)
+{
+	struct sx_radix_tree* tree=sx_radix_tree_new(AF_INET);
+	struct sx_radix_node* node;
+	void** blocks=malloc(n*sizeof(void*));
+	double t0, t1, t2, t3, t4;
+	struct sx_prefix p;
+	int i;
+
+	memset(&p, 0, sizeof(p));
+	p.family=AF_INET;
+	p.masklen=32;
+	t0=now();
+	for(i=0; i<n; i++) {
+		if(!(node=sx_radix_node_new(tree, &p))) {
+			perror("sx_radix_node_new");
+			exit(1);
+		};
+		node->aggregateLow=i;
+	};
+	t1=now();
+	sx_radix_tree_destroy(tree);
+	t2=now();
+	for(i=0; i<n; i++) {
+		if(!(blocks[i]=malloc(sizeof(struct sx_radix_node)))) {
+			perror("malloc");
+			exit(1);
+		};
+		memset(blocks[i], 0, sizeof(struct sx_radix_node));
+	};
+	t3=now();
+	for(i=0; i<n; i++)
+		free(blocks[i]);
+	t4=now();
+	printf("radix_alloc: %i nodes, new %.1f ns, destroy %.2f ms; "
+		"malloc %.1f ns, free %.2f ms\n", n, (t1-t0)*1e9/n, (t2-t1)*1e3,
+		(t3-t2)*1e9/n, (t4-t3)*1e3);
+	free(blocks);
+};
+
+int
+main(int argc, char* argv[])
+{
+	static const int sizes[]={ 1, 10, 1000, 100000 };
+	int af, size, runs=0, bad=0;
+
+	srand(argc>1?atoi(argv[1]):1);
+	for(af=0; af<2; af++) {
+		for(size=0; size<4; size++) {
+			bad+=run(af ? AF_INET6 : AF_INET, sizes[size]);
+			runs++;
+		};
+	};
+	printf("radix_alloc: %i trees, %i mismatches\n", runs, bad);
+	if(bad)
+		return 1;
+	bench(1000000);
+	return 0;
+};
@@ -0,0 +1,192 @@
+/* the explicit-stack cursor against a recursive walk: SX_RADIX_FOREACH,
+ * sx_radix_tree_foreach, walks of subtrees and walks that skip subtrees
+ * have to visit the same nodes in the same order, then how long ten walks
+ * of a million-prefix tree take both ways */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sx_prefix.h"
+
+struct walk {
+	struct sx_radix_node** v;
+	int n, size;
+};
+
+static void
+add(struct sx_radix_node* node, void* udata)
+{
+	struct walk* w=udata;
+	if(w->n==w->size) {
+		w->size=w->size ? w->size*2 : 1024;
+		if(!(w->v=realloc(w->v, w->size*sizeof(*w->v)))) {
+			perror("realloc");
+			exit(1);
+		};
+	};
+	w->v[w->n++]=node;
+};
+
+/* subtrees the skipping walks leave out */
+static int
+skipped(struct sx_radix_node* node)
+{
+	return (node->prefix.masklen+node->prefix.addr.addrs[1])%7==0;
+};
+
+static void
+recurse(struct sx_radix_node* node, struct walk* w, int skip)
+{
+	add(node, w);
+	if(skip && skipped(node))
+		return;
+	if(node->l)
+		recurse(sx_radix_left(node), w, skip);
+	if(node->r)
+		recurse(sx_radix_right(node), w, skip);
+};
+
+static int
+same(struct walk* a, struct walk* b)
+{
+	return a->n==b->n && !memcmp(a->v, b->v, a->n*sizeof(*a->v));
+};
+
+static void
+gen(struct sx_radix_tree* tree, int n)
+{
+	struct sx_prefix p;
+	int i, k, max=tree->family==AF_INET?32:128;
+
+	for(i=0; i<n; i++) {
+		memset(&p, 0, sizeof(p));
+		p.family=tree->family;
+		for(k=0; k<max/8; k++)
+			p.addr.addrs[k]=rand();
+		p.masklen=tree->family==AF_INET ? 8+rand()%17 : 16+rand()%33;
+		sx_prefix_adjust_masklen(&p);
+		sx_radix_tree_insert(tree, &p);
+	};
+};
+
+static int
+check(struct sx_radix_tree* tree)
+{
+	struct walk ref={NULL, 0, 0}, got={NULL, 0, 0};
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* node;
+	int i, bad=0;
+
+	recurse(tree->head, &ref, 0);
+	SX_RADIX_FOREACH(node, &cur, tree)
+		add(node, &got);
+	bad+=!same(&ref, &got);
+
+	got.n=0;
+	sx_radix_tree_foreach(tree, add, &got);
+	bad+=!same(&ref, &got);
+
+	/* subtrees of a few nodes, walked on their own */
+	for(i=0; i<20 && ref.n; i++) {
+		struct walk sub={NULL, 0, 0};
+		node=ref.v[rand()%ref.n];
+		recurse(node, &sub, 0);
+		got.n=0;
+		sx_radix_node_foreach(node, add, &got);
+		bad+=!same(&sub, &got);
+		free(sub.v);
+	};
+
+	ref.n=0;
+	recurse(tree->head, &ref, 1);
+	got.n=0;
+	for(node=sx_radix_cursor_first(&cur, tree->head); node; ) {
+		add(node, &got);
+		node=skipped(node) ? sx_radix_cursor_skip(&cur, node) :
+			sx_radix_cursor_next(&cur, node);
+	};
+	bad+=!same(&ref, &got);
+
+	free(ref.v);
+	free(got.v);
+	return bad;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+static void
+count(struct sx_radix_node* node, long* n)
+{
+	if(!node->isGlue)
+		++*n;
+	if(node->l)
+		count(sx_radix_left(node), n);
+	if(node->r)
+		count(sx_radix_right(node), n);
+};
+
+static void
+bench(int n)
+{
+	struct sx_radix_tree* tree=sx_radix_tree_new(AF_INET);
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* node;
+	volatile long a=0, b=0;
+	double t0, t1, t2;
+	long c;
+	int r;
+
+	gen(tree, n);
+	t0=now();
+	for(r=0; r<10; r++) {
+		c=0;
+		count(tree->head, &c);
+		a+=c;
+	};
+	t1=now();
+	for(r=0; r<10; r++)
+		SX_RADIX_FOREACH(node, &cur, tree)
+			b+=!node->isGlue;
+	t2=now();
+	printf("radix_walk: 10 walks of %li prefixes, recursion %.3f s, "
+		"cursor %.3f s\n", c, t1-t0, t2-t1);
+	sx_radix_tree_destroy(tree);
+	if(a!=b)
+		exit(1);
+};
+
+int
+main(int argc, char* argv[])
+{
+	static const int sizes[]={ 1, 2, 100, 10000, 200000 };
+	struct sx_radix_tree* tree;
+	int af, size, runs=0, bad=0;
+
+	srand(argc>1?atoi(argv[1]):1);
+	for(af=0; af<2; af++) {
+		for(size=0; size<5; size++) {
+			tree=sx_radix_tree_new(af ? AF_INET6 : AF_INET);
+			gen(tree, sizes[size]);
+			bad+=check(tree);
+			runs++;
+			sx_radix_tree_destroy(tree);
+		};
+	};
+	printf("radix_walk: %i trees, %i mismatches\n", runs, bad);
+	if(bad)
+		return 1;
+	bench(1000000);
+	return 0;
+};
@@ -0,0 +1,221 @@
+/* -R and -r, sx_radix_tree_refine and sx_radix_tree_refineLow, against
+ * their definition on trees with ranges expanded: the first route at or
+ * above the length refined becomes an aggregate up to it (or from it, for
+ * -r), routes it covers become glue. Random routes and ranges in a block
+ * of 10.0.0.0/8 or 0a00::/8 with random -R and -r, the prefixes both
+ * accept compared one by one. Then how long they take on nested chains
+ * of routes. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sx_prefix.h"
+
+static void
+ref_refine(struct sx_radix_node* node, unsigned refine, int covered)
+{
+	if(node->prefix.masklen>refine)
+		return;
+	if(covered) {
+		node->isGlue=1;
+	} else if(!node->isGlue && node->prefix.masklen<refine) {
+		node->isAggregate=1;
+		node->aggregateLow=node->prefix.masklen;
+		node->aggregateHi=refine;
+		covered=1;
+	};
+	if(node->l)
+		ref_refine(sx_radix_left(node), refine, covered);
+	if(node->r)
+		ref_refine(sx_radix_right(node), refine, covered);
+};
+
+static void
+ref_refineLow(struct sx_radix_node* node, unsigned refineLow, int covered)
+{
+	if(node->prefix.masklen>refineLow)
+		return;
+	if(covered) {
+		node->isGlue=1;
+	} else if(!node->isGlue) {
+		if(!node->isAggregate) {
+			node->isAggregate=1;
+			node->aggregateHi=node->prefix.family==AF_INET?32:128;
+		};
+		node->aggregateLow=refineLow;
+		covered=1;
+	};
+	if(node->l)
+		ref_refineLow(sx_radix_left(node), refineLow, covered);
+	if(node->r)
+		ref_refineLow(sx_radix_right(node), refineLow, covered);
+};
+
+static int
+cmp(const void* a, const void* b)
+{
+	const struct sx_prefix* x=a, *y=b;
+	int ret=memcmp(x->addr.addrs, y->addr.addrs, sizeof(x->addr.addrs));
+	return ret ? ret : x->masklen-y->masklen;
+};
+
+/* prefixes a tree accepts, sorted */
+static struct sx_prefix*
+flat(struct sx_radix_tree* tree, int* n)
+{
+	struct sx_radix_tree* copy=sx_radix_tree_copy(tree);
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* node, *son;
+	struct sx_prefix* v=NULL;
+	int size=0;
+
+	sx_radix_tree_expand_ranges(copy);
+	*n=0;
+	SX_RADIX_FOREACH(node, &cur, copy) {
+		for(son=node; son; son=sx_radix_son(son)) {
+			if(son->isGlue)
+				continue;
+			if(*n==size) {
+				size=size ? size*2 : 1024;
+				if(!(v=realloc(v, size*sizeof(*v)))) {
+					perror("realloc");
+					exit(1);
+				};
+			};
+			v[(*n)++]=node->prefix;
+		};
+	};
+	qsort(v, *n, sizeof(*v), cmp);
+	sx_radix_tree_destroy(copy);
+	return v;
+};
+
+static void
+gen(struct sx_radix_tree* tree, int n, int base)
+{
+	int i, k, lim, lo, hi, max=tree->family==AF_INET?32:128;
+	struct sx_prefix p;
+
+	for(i=0; i<n; i++) {
+		memset(&p, 0, sizeof(p));
+		p.family=tree->family;
+		for(k=max/8-3; k<max/8; k++)
+			p.addr.addrs[k]=rand();
+		p.addr.addrs[0]=10;
+		p.masklen=base+rand()%6;
+		sx_prefix_adjust_masklen(&p);
+		lim=p.masklen+rand()%7;
+		if(lim>max)
+			lim=max;
+		if(rand()%3==0 || p.masklen>=lim) {
+			sx_radix_tree_insert(tree, &p);
+		} else {
+			lo=rand()%3 ? p.masklen+rand()%(lim-p.masklen+1) : p.masklen;
+			hi=lo+rand()%(lim-lo+1);
+			sx_radix_tree_insert_range(tree, &p, lo, hi);
+		};
+	};
+};
+
+static int
+check(int af)
+{
+	struct sx_radix_tree* tree=sx_radix_tree_new(af), *ref, *got;
+	struct sx_prefix* fr, *fg;
+	int max=af==AF_INET?32:128, base=max-9, nr, ng, mode=rand()%4, bad=0;
+	unsigned refine=0, refineLow=0;
+
+	gen(tree, 1+rand()%30, base);
+	/* -R, -r, or both */
+	if(mode!=1)
+		refine=base+rand()%(max-base+1);
+	if(mode!=0) {
+		if(!refine)
+			refine=max;
+		refineLow=base+rand()%(refine-base+1);
+		if(rand()%5==0)
+			refineLow=refine;
+	};
+
+	ref=sx_radix_tree_copy(tree);
+	got=sx_radix_tree_copy(tree);
+	sx_radix_tree_expand_ranges(ref);
+	if(refine)
+		ref_refine(ref->head, refine, 0);
+	if(refineLow)
+		ref_refineLow(ref->head, refineLow, 0);
+	if(refine)
+		sx_radix_tree_refine(got, refine);
+	if(refineLow)
+		sx_radix_tree_refineLow(got, refineLow, refine);
+
+	fr=flat(ref, &nr);
+	fg=flat(got, &ng);
+	if(nr!=ng || (nr && memcmp(fr, fg, nr*sizeof(*fr))))
+		bad++;
+	free(fr);
+	free(fg);
+	sx_radix_tree_destroy(tree);
+	sx_radix_tree_destroy(ref);
+	sx_radix_tree_destroy(got);
+	return bad;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+/* every length from /8 of random addresses routed */
+static void
+bench(int af, int n, unsigned refine, unsigned refineLow)
+{
+	struct sx_radix_tree* tree=sx_radix_tree_new(af);
+	int i, k, len, max=af==AF_INET?32:128;
+	struct sx_prefix p, q;
+	double t0;
+
+	for(i=0; i<n; i++) {
+		memset(&p, 0, sizeof(p));
+		p.family=af;
+		for(k=0; k<max/8; k++)
+			p.addr.addrs[k]=rand();
+		for(len=8; len<=max; len++) {
+			q=p;
+			q.masklen=len;
+			sx_prefix_adjust_masklen(&q);
+			sx_radix_tree_insert(tree, &q);
+		};
+	};
+	t0=now();
+	sx_radix_tree_refine(tree, refine);
+	sx_radix_tree_refineLow(tree, refineLow, refine);
+	printf("refine: %i nested %s chains, -R %u -r %u in %.1f ms\n", n,
+		af==AF_INET ? "ipv4" : "ipv6", refine, refineLow, (now()-t0)*1e3);
+	sx_radix_tree_destroy(tree);
+};
+
+int
+main(int argc, char* argv[])
+{
+	int i, bad=0;
+
+	srand(argc>1?atoi(argv[1]):1);
+	for(i=0; i<2000; i++)
+		bad+=check(i%3 ? AF_INET : AF_INET6);
+	printf("refine: 2000 trees, %i mismatches\n", bad);
+	if(bad)
+		return 1;
+	bench(AF_INET, 20000, 32, 8);
+	bench(AF_INET6, 5000, 128, 16);
+	return 0;
+};
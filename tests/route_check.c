@@ -0,0 +1,210 @@
+/* the -k route check against a linear scan of the filter's entries: every
+ * prefix read has to be reported accepted exactly when some entry covers
+ * it, and a range reported has to cover it, then how many lookups a
+ * second go through bgpq_check_routes on two million prefixes */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bgpq3.h"
+
+struct entry {
+	struct sx_prefix p;
+	unsigned lo, hi;
+};
+
+static int
+covers(struct sx_prefix* p, unsigned lo, unsigned hi, struct sx_prefix* q)
+{
+	int i;
+	if(q->masklen<lo || q->masklen>hi || q->masklen<p->masklen)
+		return 0;
+	for(i=0; i<p->masklen; i++)
+		if(sx_prefix_isbitset(p, i+1)!=sx_prefix_isbitset(q, i+1))
+			return 0;
+	return 1;
+};
+
+/* within 10.0.0.0/12 or 0a00::/12, so that most prefixes are close to
+ * some entry, unless spread */
+static int spread;
+
+static void
+gen(struct sx_prefix* p, int af, int minlen, int maxlen)
+{
+	int k, max=af==AF_INET?32:128;
+
+	memset(p, 0, sizeof(*p));
+	p->family=af;
+	for(k=0; k<max/8; k++)
+		p->addr.addrs[k]=rand();
+	if(!spread) {
+		p->addr.addrs[0]=10;
+		p->addr.addrs[1]&=0x0f;
+	};
+	p->masklen=minlen+rand()%(maxlen-minlen+1);
+	sx_prefix_adjust_masklen(p);
+};
+
+static void
+fill(struct bgpq_expander* b, struct entry* e, int n)
+{
+	int i, max=b->family==AF_INET?32:128;
+
+	for(i=0; i<n; i++) {
+		gen(&e[i].p, b->family, 12, 24);
+		if(rand()%3) {
+			e[i].lo=e[i].hi=e[i].p.masklen;
+			sx_radix_tree_insert(b->tree, &e[i].p);
+		} else {
+			e[i].lo=e[i].p.masklen+rand()%4;
+			e[i].hi=e[i].lo+rand()%(max-e[i].lo+1);
+			sx_radix_tree_insert_range(b->tree, &e[i].p, e[i].lo, e[i].hi);
+		};
+	};
+	sx_radix_tree_aggregate(b->tree);
+};
+
+/* prefixes to check, one a line, in a file bgpq_check_routes can open */
+static char*
+probes(struct sx_prefix* v, int n, int af)
+{
+	static char name[]="/tmp/bgpq3-check.XXXXXX";
+	char text[128];
+	FILE* f;
+	int fd, i, max=af==AF_INET?32:128;
+
+	strcpy(name+strlen(name)-6, "XXXXXX");
+	if((fd=mkstemp(name))==-1 || !(f=fdopen(fd, "w"))) {
+		perror("mkstemp");
+		exit(1);
+	};
+	for(i=0; i<n; i++) {
+		gen(v+i, af, 8, max);
+		sx_prefix_snprintf(v+i, text, sizeof(text));
+		fprintf(f, "%s\n", text);
+	};
+	fclose(f);
+	return name;
+};
+
+static int
+check(int af, int nentries, int n)
+{
+	struct bgpq_expander b;
+	struct entry* e=malloc(nentries*sizeof(*e));
+	struct sx_prefix* v=malloc(n*sizeof(*v)), q;
+	char line[256], *word, *c, *name;
+	unsigned lo, hi;
+	int i, k, accepted, bad=0;
+	FILE* out=tmpfile();
+
+	if(!out) {
+		perror("tmpfile");
+		exit(1);
+	};
+	bgpq_expander_init(&b, af);
+	fill(&b, e, nentries);
+	name=probes(v, n, af);
+	bgpq_check_routes(out, &b, name);
+	unlink(name);
+	rewind(out);
+
+	for(i=0; i<n; i++) {
+		for(accepted=0, k=0; k<nentries && !accepted; k++)
+			accepted=covers(&e[k].p, e[k].lo, e[k].hi, v+i);
+		if(!fgets(line, sizeof(line), out) || !(word=strchr(line, ' '))) {
+			bad++;
+			break;
+		};
+		word++;
+		if(!strncmp(word, "rejected", 8)) {
+			bad+=accepted;
+		} else if(!strncmp(word, "exact", 5)) {
+			bad+=!accepted || !sx_radix_tree_lookup_exact(b.tree, v+i);
+		} else if(!strncmp(word, "range ", 6) && (c=strchr(word, '^')) &&
+			sscanf(c, "^%u-%u", &lo, &hi)==2) {
+			*c=0;
+			bad+=!accepted || !sx_prefix_parse(&q, af, word+6) ||
+				!covers(&q, lo, hi, v+i);
+		} else {
+			bad++;
+		};
+	};
+	fclose(out);
+	sx_radix_tree_destroy(b.tree);
+	sx_arena_free(&b.arena);
+	free(e);
+	free(v);
+	return bad;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+static void
+bench(int nentries, int n)
+{
+	struct bgpq_expander b;
+	struct entry* e=malloc(nentries*sizeof(*e));
+	struct sx_prefix* v=malloc(n*sizeof(*v));
+	FILE* out=fopen("/dev/null", "w");
+	double t0, t1;
+	char* name;
+
+	if(!out) {
+		perror("/dev/null");
+		exit(1);
+	};
+	bgpq_expander_init(&b, AF_INET);
+	fill(&b, e, nentries);
+	name=probes(v, n, AF_INET);
+	t0=now();
+	bgpq_check_routes(out, &b, name);
+	t1=now();
+	unlink(name);
+	printf("route_check: %i prefixes against %i entries in %.3f s, "
+		"%.2f M lookups/s\n", n, sx_radix_tree_entries(b.tree), t1-t0,
+		n/(t1-t0)/1e6);
+	fclose(out);
+	sx_radix_tree_destroy(b.tree);
+	sx_arena_free(&b.arena);
+	free(e);
+	free(v);
+};
+
+int
+main(int argc, char* argv[])
+{
+	static const int sizes[]={ 1, 20, 500 };
+	int af, size, runs=0, bad=0;
+
+	/* totals go to stderr */
+	if(!freopen("/dev/null", "w", stderr))
+		return 1;
+	srand(argc>1?atoi(argv[1]):1);
+	for(af=0; af<2; af++) {
+		for(size=0; size<3; size++) {
+			bad+=check(af ? AF_INET6 : AF_INET, sizes[size], 50000);
+			runs++;
+		};
+	};
+	printf("route_check: %i filters, %i mismatches\n", runs, bad);
+	if(bad)
+		return 1;
+	spread=1;
+	bench(200000, 2000000);
+	return 0;
+};
@@ -0,0 +1,366 @@
+/* trees saved with -O and loaded with -I: read back they have to write the
+ * same bytes, and print the same as the trees they were saved from in
+ * every vendor and option combination bgpq3 accepts for them (-x and
+ * prefix-ranges included). Damaged files have to be refused or give a
+ * valid tree. Then how long loading takes against inserting. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bgpq3.h"
+
+static const struct {
+	bgpq_vendor_t vendor;
+	bgpq_gen_t generation;
+	const char* name;
+} targets[]={
+	{ V_CISCO, T_PREFIXLIST, "-P" },
+	{ V_JUNIPER, T_PREFIXLIST, "-J -P" },
+	{ V_CISCO_XR, T_PREFIXLIST, "-X -P" },
+	{ V_JSON, T_PREFIXLIST, "-j -P" },
+	{ V_BIRD, T_PREFIXLIST, "-b -P" },
+	{ V_OPENBGPD, T_PREFIXLIST, "-B -P" },
+	{ V_FORMAT, T_PREFIXLIST, "-F" },
+	{ V_NOKIA, T_PREFIXLIST, "-N -P" },
+	{ V_HUAWEI, T_PREFIXLIST, "-U -P" },
+	{ V_NOKIA_MD, T_PREFIXLIST, "-n -P" },
+	{ V_JUNIPER, T_EACL, "-J -E" },
+	{ V_CISCO, T_EACL, "-E" },
+	{ V_OPENBGPD, T_EACL, "-B -E" },
+	{ V_NOKIA, T_EACL, "-N -E" },
+	{ V_NOKIA_MD, T_EACL, "-n -E" },
+	{ V_JUNIPER, T_ROUTE_FILTER_LIST, "-J -z" }
+};
+
+#define NTARGETS (int)(sizeof(targets)/sizeof(targets[0]))
+
+enum { O_NONE, O_A, O_R, O_ARr, O_H, NOPTIONS };
+
+static const char* options[]={ "", "-A", "-R", "-A -R -r", "-H" };
+
+/* what bgpq3 refuses */
+static int
+valid(int t, int o, int mixed)
+{
+	bgpq_vendor_t v=targets[t].vendor;
+	bgpq_gen_t g=targets[t].generation;
+	int aggregate=o==O_A || o==O_ARr, refine=o==O_R || o==O_ARr;
+
+	if(mixed && (refine || g<T_PREFIXLIST ||
+		!(v==V_JUNIPER || v==V_JSON || v==V_FORMAT)))
+		return 0;
+	if(v==V_FORMAT && (aggregate || refine))
+		return 0;
+	if(v==V_JUNIPER && g==T_PREFIXLIST && (aggregate || refine))
+		return 0;
+	if((v==V_NOKIA || v==V_NOKIA_MD) && g!=T_PREFIXLIST &&
+		(aggregate || refine))
+		return 0;
+	return 1;
+};
+
+/* the processing bgpq3 does between expansion and printing */
+static void
+print(FILE* f, struct bgpq_expander* b, int t, int o)
+{
+	/* bgpq3_print_format_prefixlist looks at the two bytes before the
+	 * format */
+	static char format[]="\0\0%n/%l";
+	unsigned max=b->family==AF_INET?32:128;
+	struct sx_radix_tree* tree=b->tree, *treex=b->treex;
+
+	b->tree=sx_radix_tree_copy(tree);
+	b->treex=treex ? sx_radix_tree_copy(treex) : NULL;
+	b->vendor=targets[t].vendor;
+	b->generation=targets[t].generation;
+	b->format=format+2;
+
+	if(b->vendor==V_FORMAT ||
+		(b->vendor==V_JUNIPER && b->generation==T_PREFIXLIST) ||
+		((b->vendor==V_NOKIA_MD || b->vendor==V_NOKIA) &&
+		b->generation!=T_PREFIXLIST)) {
+		sx_radix_tree_expand_ranges(b->tree);
+		if(b->treex)
+			sx_radix_tree_expand_ranges(b->treex);
+	};
+	if(o==O_R || o==O_ARr)
+		sx_radix_tree_refine(b->tree, max-8);
+	if(o==O_ARr)
+		sx_radix_tree_refineLow(b->tree, max-12, max-8);
+	if(o==O_A || o==O_ARr || o==O_H) {
+		sx_radix_tree_aggregate(b->tree);
+		if(b->treex)
+			sx_radix_tree_aggregate(b->treex);
+	};
+	if(o==O_H) {
+		sx_radix_tree_hyperaggregate(b->tree);
+		if(b->treex)
+			sx_radix_tree_hyperaggregate(b->treex);
+	};
+
+	if(b->generation==T_PREFIXLIST)
+		bgpq3_print_prefixlist(f, b);
+	else if(b->generation==T_EACL)
+		bgpq3_print_eacl(f, b);
+	else
+		bgpq3_print_route_filter_list(f, b);
+
+	sx_radix_tree_destroy(b->tree);
+	sx_radix_tree_destroy(b->treex);
+	b->tree=tree;
+	b->treex=treex;
+};
+
+/* within 10.0.0.0/12 or 2000::/12, unless spread */
+static void
+gen(struct sx_radix_tree* tree, int n, int spread)
+{
+	int i, k, lo, hi, max=tree->family==AF_INET?32:128;
+	struct sx_prefix p;
+
+	for(i=0; i<n; i++) {
+		memset(&p, 0, sizeof(p));
+		p.family=tree->family;
+		for(k=0; k<max/8; k++)
+			p.addr.addrs[k]=rand();
+		if(!spread) {
+			p.addr.addrs[0]=tree->family==AF_INET ? 10 : 0x20;
+			p.addr.addrs[1]&=0x0f;
+		};
+		p.masklen=max==32 ? 12+rand()%17 : 28+rand()%37;
+		sx_prefix_adjust_masklen(&p);
+		if(rand()%5) {
+			sx_radix_tree_insert(tree, &p);
+		} else {
+			lo=p.masklen+rand()%3;
+			hi=lo+rand()%6;
+			sx_radix_tree_insert_range(tree, &p, lo, hi>max?max:hi);
+		};
+	};
+};
+
+static int
+same(FILE* a, FILE* b)
+{
+	int ca, cb;
+	rewind(a);
+	rewind(b);
+	do {
+		ca=getc(a);
+		cb=getc(b);
+	} while(ca==cb && ca!=EOF);
+	return ca==cb;
+};
+
+static int
+same_tree(struct sx_radix_tree* a, struct sx_radix_tree* b)
+{
+	FILE* fa=tmpfile(), *fb=tmpfile();
+	int ret;
+
+	if(!fa || !fb) {
+		perror("tmpfile");
+		exit(1);
+	};
+	sx_radix_tree_write(a, fa);
+	sx_radix_tree_write(b, fb);
+	ret=same(fa, fb);
+	fclose(fa);
+	fclose(fb);
+	return ret;
+};
+
+static char file[]="/tmp/bgpq3-trees.XXXXXX";
+
+static void
+expander(struct bgpq_expander* b, int af, int mixed)
+{
+	bgpq_expander_init(b, af);
+	if(mixed)
+		b->treex=sx_radix_tree_new(AF_INET6);
+};
+
+static void
+release(struct bgpq_expander* b)
+{
+	sx_radix_tree_destroy(b->tree);
+	sx_radix_tree_destroy(b->treex);
+	sx_arena_free(&b->arena);
+};
+
+/* combinations run for one input */
+static int
+check(int af, int mixed, int n, int* bad)
+{
+	struct bgpq_expander b, l;
+	FILE* fb, *fl;
+	int t, o, runs=0;
+
+	expander(&b, af, mixed);
+	gen(b.tree, n, 0);
+	if(mixed)
+		gen(b.treex, n, 0);
+	if(!bgpq_tree_save(&b, file)) {
+		printf("tree_file: unable to save\n");
+		exit(1);
+	};
+	expander(&l, af, mixed);
+	if(!bgpq_tree_load(&l, file) || !same_tree(b.tree, l.tree) ||
+		(mixed && !same_tree(b.treex, l.treex))) {
+		printf("tree_file: %s%s, %i prefixes: does not load back\n",
+			af==AF_INET ? "ipv4" : "ipv6", mixed ? " -x" : "", n);
+		++*bad;
+	};
+	for(t=0; t<NTARGETS; t++) {
+		for(o=0; o<NOPTIONS; o++) {
+			if(!valid(t, o, mixed))
+				continue;
+			if(!(fb=tmpfile()) || !(fl=tmpfile())) {
+				perror("tmpfile");
+				exit(1);
+			};
+			print(fb, &b, t, o);
+			print(fl, &l, t, o);
+			if(!same(fb, fl)) {
+				printf("tree_file: %s %s%s, %i prefixes: prints another "
+					"filter\n", targets[t].name, options[o], mixed ? " -x" :
+					"", n);
+				++*bad;
+			};
+			fclose(fb);
+			fclose(fl);
+			runs++;
+		};
+	};
+	release(&b);
+	release(&l);
+	return runs;
+};
+
+/* every prefix found where it is, under its parent */
+static int
+consistent(struct sx_radix_tree* tree)
+{
+	struct sx_radix_cursor cur;
+	struct sx_radix_node* node;
+	int bad=0;
+
+	SX_RADIX_FOREACH(node, &cur, tree) {
+		if(!node->isGlue && sx_radix_tree_lookup_exact(tree,
+			&node->prefix)!=node)
+			bad++;
+	};
+	return bad;
+};
+
+static int
+damage(int copies)
+{
+	struct bgpq_expander b, l;
+	unsigned char* image, *copy;
+	size_t len, cut;
+	FILE* f;
+	int i, k, bad=0;
+
+	expander(&b, AF_INET, 0);
+	gen(b.tree, 2000, 0);
+	sx_radix_tree_aggregate(b.tree);
+	bgpq_tree_save(&b, file);
+	release(&b);
+	if(!(f=fopen(file, "r")) || fseek(f, 0, SEEK_END) ||
+		!(image=malloc(len=ftell(f))) || !(copy=malloc(len))) {
+		perror(file);
+		exit(1);
+	};
+	rewind(f);
+	if(fread(image, 1, len, f)!=len) {
+		perror(file);
+		exit(1);
+	};
+	fclose(f);
+
+	for(i=0; i<copies; i++) {
+		if(!(f=fopen(file, "w"))) {
+			perror(file);
+			exit(1);
+		};
+		memcpy(copy, image, len);
+		cut=i%4==3 ? rand()%len : len;
+		for(k=1+rand()%4; k; k--)
+			copy[10+rand()%(len-10)]^=1<<(rand()%8);
+		fwrite(copy, 1, cut, f);
+		fclose(f);
+		expander(&l, AF_INET, 0);
+		if(bgpq_tree_load(&l, file))
+			bad+=consistent(l.tree);
+		release(&l);
+	};
+	free(image);
+	free(copy);
+	return bad;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+};
+
+static void
+bench(int n)
+{
+	struct bgpq_expander b, l;
+	double t0, t1, t2;
+
+	expander(&b, AF_INET, 0);
+	t0=now();
+	gen(b.tree, n, 1);
+	t1=now();
+	bgpq_tree_save(&b, file);
+	expander(&l, AF_INET, 0);
+	t2=now();
+	if(!bgpq_tree_load(&l, file))
+		exit(1);
+	printf("tree_file: %i prefixes, inserted in %.1f ms, loaded in %.1f ms\n",
+		sx_radix_tree_entries(l.tree), (t1-t0)*1e3, (now()-t2)*1e3);
+	release(&b);
+	release(&l);
+};
+
+int
+main(int argc, char* argv[])
+{
+	static const int sizes[]={ 0, 1, 50, 2000 };
+	int fd, size, runs=0, bad=0, damaged;
+
+	/* damaged files get reported */
+	if(!freopen("/dev/null", "w", stderr))
+		return 1;
+	if((fd=mkstemp(file))==-1) {
+		perror(file);
+		return 1;
+	};
+	close(fd);
+	srand(argc>1?atoi(argv[1]):1);
+	for(size=0; size<4; size++) {
+		runs+=check(AF_INET, 0, sizes[size], &bad);
+		runs+=check(AF_INET6, 0, sizes[size], &bad);
+		runs+=check(AF_INET, 1, sizes[size], &bad);
+	};
+	printf("tree_file: 12 trees in %i combinations, %i differ\n", runs, bad);
+	damaged=damage(2000);
+	printf("tree_file: 2000 damaged files, %i invalid trees\n", damaged);
+	if(!bad && !damaged)
+		bench(300000);
+	unlink(file);
+	return bad || damaged;
+};